@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include "admin_server.h"
+
+admin_server::admin_server() : m_count(0), m_listenfd(-1), m_running(false)
+{
+}
+
+admin_server::~admin_server()
+{
+    stop();
+}
+
+bool admin_server::add_command(const char *name, const char *help, admin_handler handler, void *arg)
+{
+    if (m_running || m_count >= MAX_COMMANDS || !name || !handler)
+    {
+        return false;
+    }
+    command &c = m_commands[m_count++];
+    c.name = name;
+    c.help = help;
+    c.handler = handler;
+    c.arg = arg;
+    return true;
+}
+
+bool admin_server::start(const char *path)
+{
+    struct sockaddr_un address;
+    if (m_running || !path || strlen(path) >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    m_listenfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (m_listenfd < 0)
+    {
+        return false;
+    }
+    //上次运行遗留的套接字文件会导致bind失败
+    unlink(path);
+    //只允许运行服务器的用户访问
+    mode_t old_mask = umask(077);
+    int ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
+    umask(old_mask);
+    if (ret != 0 || listen(m_listenfd, 8) != 0)
+    {
+        close(m_listenfd);
+        m_listenfd = -1;
+        return false;
+    }
+    m_path = path;
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        close(m_listenfd);
+        m_listenfd = -1;
+        unlink(path);
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+void admin_server::stop()
+{
+    if (!m_running)
+    {
+        return;
+    }
+    //shutdown使阻塞在accept中的服务线程返回
+    shutdown(m_listenfd, SHUT_RDWR);
+    pthread_join(m_thread, NULL);
+    close(m_listenfd);
+    m_listenfd = -1;
+    unlink(m_path.c_str());
+    m_running = false;
+}
+
+void *admin_server::worker(void *arg)
+{
+    admin_server *server = (admin_server *)arg;
+    server->run();
+    return server;
+}
+
+void admin_server::run()
+{
+    while (true)
+    {
+        int fd = accept4(m_listenfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            break;
+        }
+        serve(fd);
+        close(fd);
+    }
+}
+
+//一次只服务一个客户端，读写都有超时，客户端停止响应时不会卡住服务线程
+void admin_server::serve(int fd)
+{
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    char line[MAX_LINE];
+    int length = 0;
+    while (length < MAX_LINE - 1)
+    {
+        int n = recv(fd, line + length, MAX_LINE - 1 - length, 0);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        length += n;
+        if (memchr(line, '\n', length))
+        {
+            break;
+        }
+    }
+    line[length] = '\0';
+    line[strcspn(line, "\r\n")] = '\0';
+
+    std::string out;
+    execute(line, out);
+
+    size_t sent = 0;
+    while (sent < out.size())
+    {
+        ssize_t n = send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        sent += n;
+    }
+}
+
+void admin_server::execute(const char *line, std::string &out)
+{
+    line += strspn(line, " \t");
+    size_t name_length = strcspn(line, " \t");
+    const char *args = line + name_length;
+    args += strspn(args, " \t");
+
+    if (name_length == 0 || (name_length == 4 && strncmp(line, "help", 4) == 0))
+    {
+        out += "commands:\n";
+        for (int i = 0; i < m_count; i++)
+        {
+            out += "  ";
+            out += m_commands[i].name;
+            out += "\t";
+            out += m_commands[i].help ? m_commands[i].help : "";
+            out += "\n";
+        }
+        out += "  all\trun every command above without arguments\n";
+        return;
+    }
+
+    if (name_length == 3 && strncmp(line, "all", 3) == 0)
+    {
+        for (int i = 0; i < m_count; i++)
+        {
+            out += "== ";
+            out += m_commands[i].name;
+            out += " ==\n";
+            m_commands[i].handler(out, "", m_commands[i].arg);
+        }
+        return;
+    }
+
+    for (int i = 0; i < m_count; i++)
+    {
+        if (strlen(m_commands[i].name) == name_length && strncmp(line, m_commands[i].name, name_length) == 0)
+        {
+            m_commands[i].handler(out, args, m_commands[i].arg);
+            return;
+        }
+    }
+    out += "unknown command, try help\n";
+}
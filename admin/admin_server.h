@@ -0,0 +1,64 @@
+#ifndef _ADMIN_SERVER_H_
+#define _ADMIN_SERVER_H_
+/*************************************************************
+*管理接口：在unix域套接字上提供运行状态查询，不需要重启即可排查容量问题
+*协议为一问一答：客户端发送一行命令，如"conns"，服务端写回文本后关闭连接
+*可用 socat - UNIX-CONNECT:admin.sock 或 nc -U admin.sock 访问
+*在单独的线程中处理，不经过事件循环；命令读取的状态来自其他线程，只保证各项自身大致一致
+**************************************************************/
+
+#include <string>
+#include <pthread.h>
+
+//命令的处理函数，args为命令名之后的参数（已去掉前导空格），结果追加到out
+typedef void (*admin_handler)(std::string &out, const char *args, void *arg);
+
+class admin_server
+{
+public:
+    //最多可注册的命令数、命令行的最大长度
+    static const int MAX_COMMANDS = 32;
+    static const int MAX_LINE = 256;
+
+    static admin_server *get_instance()
+    {
+        static admin_server instance;
+        return &instance;
+    }
+
+    //注册命令，需在start()之前调用；help和all为内置命令，分别列出所有命令、依次执行所有命令
+    bool add_command(const char *name, const char *help, admin_handler handler, void *arg);
+    //在path上创建套接字（已存在的文件会被删除），启动服务线程
+    bool start(const char *path);
+    //停止服务线程并删除套接字文件，可重复调用
+    void stop();
+
+    //执行一行命令，结果追加到out
+    void execute(const char *line, std::string &out);
+
+private:
+    admin_server();
+    ~admin_server();
+
+    static void *worker(void *arg);
+    void run();
+    void serve(int fd);
+
+private:
+    struct command
+    {
+        const char *name;
+        const char *help;
+        admin_handler handler;
+        void *arg;
+    };
+
+    command m_commands[MAX_COMMANDS];
+    int m_count;
+    int m_listenfd;
+    std::string m_path;
+    pthread_t m_thread;
+    bool m_running;
+};
+
+#endif
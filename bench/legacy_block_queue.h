@@ -0,0 +1,254 @@
+#ifndef _LEGACY_BLOCK_QUEUE_H_
+#define _LEGACY_BLOCK_QUEUE_H_
+/*************************************************************
+*修改前的block_queue，只用于queue_bench对比
+*pop()在持有m_mutex时等待legacy_cond内部的另一把锁，队列为空时生产者无法再放入，会死锁；
+*pop(item, ms)对已持有的m_mutex重复加锁。基准测试中消费者只在size() > 0时调用pop()
+**************************************************************/
+
+#include <iostream>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include "../lock/locker.h"
+
+//修改前的条件变量：wait()使用自己内部的互斥锁，timewait()对传入的互斥锁再加一次锁
+class legacy_cond
+{
+private:
+    pthread_mutex_t m_mutex;
+    pthread_cond_t m_cond;
+
+public:
+    legacy_cond()
+    {
+        pthread_mutex_init(&m_mutex, NULL);
+        pthread_cond_init(&m_cond, NULL);
+    }
+    ~legacy_cond()
+    {
+        pthread_mutex_destroy(&m_mutex);
+        pthread_cond_destroy(&m_cond);
+    }
+    bool wait()
+    {
+        int res = 0;
+        pthread_mutex_lock(&m_mutex);
+        res = pthread_cond_wait(&m_cond, &m_mutex);
+        pthread_mutex_unlock(&m_mutex);
+        return res == 0;
+    }
+    bool timewait(pthread_mutex_t *m_mutex, struct timespec t)
+    {
+        int ret = 0;
+        pthread_mutex_lock(m_mutex);
+        ret = pthread_cond_timedwait(&m_cond, m_mutex, &t);
+        pthread_mutex_unlock(m_mutex);
+        return ret == 0;
+    }
+    bool signal()
+    {
+        return pthread_cond_signal(&m_cond) == 0;
+    }
+    bool broadcast()
+    {
+        return pthread_cond_broadcast(&m_cond) == 0;
+    }
+};
+
+template <typename T>
+class legacy_block_queue
+{
+private:
+    locker *m_mutex;     // 封装的互斥锁
+    legacy_cond *m_cond;        // 封装的条件变量
+    
+    T *m_array;         // 循环数组实现阻塞队列
+    int m_size;         // 队列的长度
+    int m_max_size;     // 队列的最大长度
+    int m_front;        // 队首位置
+    int m_back;         // 队尾位置
+
+public:
+    // 构造函数，初始化私有成员
+    legacy_block_queue(int max_size = 1000)
+    {
+        if (max_size <= 0)
+        {
+            exit(-1);
+        }
+
+        // 构造函数创建循环数组
+        m_max_size = max_size;
+        m_array = new T[max_size];
+        m_size = 0;
+        m_front = -1;
+        m_back = -1;
+
+        // 创建互斥锁和条件变量
+        m_mutex = new locker();
+        m_cond = new legacy_cond();
+    }
+
+    // 清空队列
+    void clear()
+    {
+        m_mutex->lock();
+        m_size = 0;
+        m_front = -1;
+        m_back = -1;
+        m_mutex->unlock();
+    }
+
+    // 析构函数，释放资源
+    ~legacy_block_queue()
+    {
+        m_mutex->lock();
+        if (m_array) delete[] m_array;
+        m_mutex->unlock();
+    }
+
+    // 判断队列是否满了
+    bool full()
+    {
+        m_mutex->lock();
+        if (m_size >= m_max_size)
+        {
+            m_mutex->unlock();
+            return true;
+        }
+        m_mutex->unlock();
+        return false;
+    }
+
+    //返回队首元素
+    bool front(T &value) 
+    {
+        m_mutex->lock();
+        if (0 == m_size)
+        {
+            m_mutex->unlock();
+            return false;
+        }
+        value = m_array[m_front];
+        m_mutex->unlock();
+        return true;
+    }
+    //返回队尾元素
+    bool back(T &value) 
+    {
+        m_mutex->lock();
+        if (0 == m_size)
+        {
+            m_mutex->unlock();
+            return false;
+        }
+        value = m_array[m_back];
+        m_mutex->unlock();
+        return true;
+    }
+
+    int size() 
+    {
+        int tmp = 0;
+
+        m_mutex->lock();
+        tmp = m_size;
+
+        m_mutex->unlock();
+        return tmp;
+    }
+
+    int max_size()
+    {
+        int tmp = 0;
+
+        m_mutex->lock();
+        tmp = m_max_size;
+
+        m_mutex->unlock();
+        return tmp;
+    }
+
+    //往队列添加元素，需要将所有使用队列的线程先唤醒
+    //当有元素push进队列,相当于生产者生产了一个元素
+    //若当前没有线程等待条件变量,则唤醒无意义
+    bool push(const T &item)
+    {
+
+        m_mutex->lock();
+        if (m_size >= m_max_size)
+        {
+
+            m_cond->broadcast();
+            m_mutex->unlock();
+            return false;
+        }
+
+        m_back = (m_back + 1) % m_max_size;
+        m_array[m_back] = item;
+
+        m_size++;
+
+        m_cond->broadcast();
+        m_mutex->unlock();
+        return true;
+    }
+    //pop时,如果当前队列没有元素,将会等待条件变量
+    bool pop(T &item)
+    {
+
+        m_mutex->lock();
+        while (m_size <= 0)
+        {
+            
+            if ( !m_cond->wait() )
+            {
+                m_mutex->unlock();
+                return false;
+            }
+        }
+
+        m_front = (m_front + 1) % m_max_size;
+        item = m_array[m_front];
+        m_size--;
+        m_mutex->unlock();
+        return true;
+    }
+
+    //增加了超时处理
+    bool pop(T &item, int ms_timeout)
+    {
+        struct timespec t = {0, 0};
+        struct timeval now = {0, 0};
+        gettimeofday(&now, NULL);
+        m_mutex->lock();
+        if (m_size <= 0)
+        {
+            t.tv_sec = now.tv_sec + ms_timeout / 1000;
+            t.tv_nsec = (ms_timeout % 1000) * 1000;
+            if (!m_cond->timewait(m_mutex->get(), t))
+            {
+                m_mutex->unlock();
+                return false;
+            }
+        }
+
+        if (m_size <= 0)
+        {
+            m_mutex->unlock();
+            return false;
+        }
+
+        m_front = (m_front + 1) % m_max_size;
+        item = m_array[m_front];
+        m_size--;
+        m_mutex->unlock();
+        return true;
+    }
+};
+
+
+
+
+#endif
\ No newline at end of file
@@ -0,0 +1,343 @@
+/*************************************************************
+*HTTP请求解析的基准测试
+*直接调用http_conn::process_read（parse_line、parse_request_line、parse_headers、parse_content），不经过socket和线程池
+*语料覆盖常见的请求形态：短GET、带30个头部的浏览器请求、长Cookie、带消息体的请求（服务器只接受GET）、
+*一次读入的流水线请求，以及在每个字节处被拆成两次读入的请求
+*每种请求重复执行至少0.2秒，减去同样次数的拷贝开销后报告每个请求的ns和周期数、每周期解析的字节数
+*周期数优先取自perf_event的CPU周期计数器，不可用时退回到TSC
+*另外单独报告每个请求结束后init()重置连接的开销
+*用法：./parser_bench [每种请求的最短运行时间ms]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <string>
+#include <vector>
+#include "../http/http_conn.h"
+#include "../log/log.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// http_conn的友元，访问读缓冲区和解析状态
+class parser_bench
+{
+public:
+    // 把len字节放入读缓冲区，只有前available字节视为已读入
+    static void load(http_conn &c, const char *data, int len, int available)
+    {
+        memcpy(c.m_read_buf, data, len);
+        c.m_read_idx = available;
+        restart(c, 0);
+    }
+    // 从缓冲区的start处开始解析下一个请求
+    static void restart(http_conn &c, int start)
+    {
+        c.m_check_state = http_conn::CHECK_STATE_REQUESTLINE;
+        c.m_checked_idx = start;
+        c.m_start_line = start;
+        c.m_content_length = 0;
+        c.m_linger = false;
+        c.m_url = 0;
+        c.m_version = 0;
+        c.m_host = 0;
+    }
+    static void set_available(http_conn &c, int available)
+    {
+        c.m_read_idx = available;
+    }
+    static int checked(const http_conn &c)
+    {
+        return c.m_checked_idx;
+    }
+    static http_conn::HTTP_CODE parse(http_conn &c)
+    {
+        return c.process_read();
+    }
+    static void init(http_conn &c)
+    {
+        c.init();
+    }
+    static const char *url(const http_conn &c)
+    {
+        return c.m_url;
+    }
+};
+
+static long long now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// 周期计数：perf_event的用户态CPU周期，不可用时为TSC
+static int cycle_fd = -1;
+
+static void open_cycle_counter()
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cycle_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static unsigned long long read_cycles()
+{
+    if (cycle_fd >= 0)
+    {
+        unsigned long long value = 0;
+        if (read(cycle_fd, &value, sizeof(value)) == sizeof(value))
+        {
+            return value;
+        }
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// 一种请求形态
+struct shape
+{
+    const char *name;
+    std::string data;
+    int requests;   // data中的请求个数
+    bool split;     // 在每个字节处拆成两次读入
+};
+
+static std::string short_get()
+{
+    return "GET /welcome.html HTTP/1.1\r\nHost: 127.0.0.1:9006\r\n\r\n";
+}
+
+static std::string browser_get(const std::string &cookie)
+{
+    std::string r = "GET /static/js/app.3f9c2a1b.js?v=20210710 HTTP/1.1\r\n"
+                    "Host: www.example.com\r\n"
+                    "Connection: keep-alive\r\n"
+                    "Cache-Control: max-age=0\r\n"
+                    "sec-ch-ua: \" Not;A Brand\";v=\"99\", \"Google Chrome\";v=\"91\", \"Chromium\";v=\"91\"\r\n"
+                    "sec-ch-ua-mobile: ?0\r\n"
+                    "sec-ch-ua-platform: \"Linux\"\r\n"
+                    "Upgrade-Insecure-Requests: 1\r\n"
+                    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/91.0.4472.114 Safari/537.36\r\n"
+                    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,image/apng,*/*;q=0.8\r\n"
+                    "Sec-Fetch-Site: same-origin\r\n"
+                    "Sec-Fetch-Mode: no-cors\r\n"
+                    "Sec-Fetch-User: ?1\r\n"
+                    "Sec-Fetch-Dest: script\r\n"
+                    "Referer: https://www.example.com/index.html\r\n"
+                    "Accept-Encoding: gzip, deflate, br\r\n"
+                    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+                    "If-None-Match: W/\"5e15-17a8f3c2b10\"\r\n"
+                    "If-Modified-Since: Sat, 10 Jul 2021 08:00:00 GMT\r\n"
+                    "DNT: 1\r\n"
+                    "Pragma: no-cache\r\n"
+                    "Origin: https://www.example.com\r\n"
+                    "X-Requested-With: XMLHttpRequest\r\n"
+                    "X-Forwarded-For: 10.0.0.1, 10.0.0.2\r\n"
+                    "X-Forwarded-Proto: https\r\n"
+                    "X-Real-IP: 10.0.0.1\r\n"
+                    "X-Request-ID: 6f1c2d9e-8a4b-4c3d-9e2f-1a2b3c4d5e6f\r\n"
+                    "Via: 1.1 proxy.example.com\r\n"
+                    "TE: trailers\r\n"
+                    "Priority: u=1, i\r\n";
+    r += "Cookie: " + cookie + "\r\n";
+    r += "\r\n";
+    return r;
+}
+
+static std::string long_cookie()
+{
+    std::string cookie = "sessionid=8f14e45fceea167a5a36dedd4bea2543";
+    char item[64];
+    for (int i = 0; cookie.size() < 1800; i++)
+    {
+        snprintf(item, sizeof(item), "; _ga_%02d=GA1.2.%d.%d", i, 1000000 + i * 7919, 1625900000 + i);
+        cookie += item;
+    }
+    return cookie;
+}
+
+static std::string cookie_get(const std::string &cookie)
+{
+    return "GET /index.html HTTP/1.1\r\nHost: www.example.com\r\nConnection: keep-alive\r\n"
+           "Accept: */*\r\nCookie: " + cookie + "\r\n\r\n";
+}
+
+static std::string form_body()
+{
+    std::string body = "user=qqh&password=123456&remember=on";
+    char length[16];
+    snprintf(length, sizeof(length), "%d", (int)body.size());
+    return std::string("GET /login HTTP/1.1\r\nHost: 127.0.0.1:9006\r\n"
+                       "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: ") +
+           length + "\r\nConnection: keep-alive\r\n\r\n" + body;
+}
+
+// 解析一遍形态中的所有请求，返回成功解析的请求数
+static int parse_shape(http_conn &c, const shape &s, int split_at)
+{
+    const char *data = s.data.data();
+    int len = (int)s.data.size();
+    if (s.split)
+    {
+        // 先读入前split_at字节，请求不完整；再读入剩余部分
+        parser_bench::load(c, data, len, split_at);
+        if (parser_bench::parse(c) != http_conn::NO_REQUEST)
+        {
+            return 0;
+        }
+        parser_bench::set_available(c, len);
+        return parser_bench::parse(c) == http_conn::GET_REQUEST ? 1 : 0;
+    }
+    parser_bench::load(c, data, len, len);
+    int parsed = 0;
+    for (int i = 0; i < s.requests; i++)
+    {
+        if (parser_bench::parse(c) != http_conn::GET_REQUEST)
+        {
+            return parsed;
+        }
+        parsed++;
+        // 消息体不以换行结束，下一个请求从消息体之后开始
+        int next = parser_bench::checked(c);
+        parser_bench::restart(c, next);
+    }
+    return parsed;
+}
+
+struct measurement
+{
+    double ns;
+    double cycles;
+};
+
+// 运行至少min_ns，返回每次调用的平均耗时
+template <typename F>
+static measurement measure(long long min_ns, F body)
+{
+    long long iterations = 0;
+    long long begin = now_ns();
+    unsigned long long begin_cycles = read_cycles();
+    long long elapsed = 0;
+    do
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            body();
+        }
+        iterations += 256;
+        elapsed = now_ns() - begin;
+    } while (elapsed < min_ns);
+    measurement m;
+    m.ns = (double)elapsed / iterations;
+    m.cycles = (double)(read_cycles() - begin_cycles) / iterations;
+    return m;
+}
+
+int main(int argc, char *argv[])
+{
+    long long min_ns = (argc > 1 ? atoll(argv[1]) : 200) * 1000000LL;
+    // 与服务器的默认级别一致，解析路径上的DEBUG日志只做级别判断
+    Log::get_instance()->set_level(LOG_LEVEL_INFO);
+    open_cycle_counter();
+
+    std::vector<shape> shapes;
+    shape s;
+    s.split = false;
+
+    s.name = "short_get";
+    s.data = short_get();
+    s.requests = 1;
+    shapes.push_back(s);
+
+    s.name = "browser_30_headers";
+    s.data = browser_get("sessionid=8f14e45fceea167a5a36dedd4bea2543; csrftoken=c4ca4238a0b923820dcc509a6f75849b");
+    shapes.push_back(s);
+
+    s.name = "long_cookie";
+    s.data = cookie_get(long_cookie());
+    shapes.push_back(s);
+
+    s.name = "form_body";
+    s.data = form_body();
+    shapes.push_back(s);
+
+    s.name = "pipelined_x8";
+    s.data.clear();
+    for (int i = 0; i < 8; i++)
+    {
+        s.data += short_get();
+    }
+    s.requests = 8;
+    shapes.push_back(s);
+
+    s.name = "split_every_byte";
+    s.data = browser_get("sessionid=8f14e45fceea167a5a36dedd4bea2543");
+    s.requests = 1;
+    s.split = true;
+    shapes.push_back(s);
+
+    static http_conn conn;
+    char scratch[http_conn::READ_BUFFER_SIZE];
+
+    printf("cycles from %s\n", cycle_fd >= 0 ? "perf_event cpu-cycles" : "tsc");
+    printf("%-20s %8s %10s %12s %12s\n", "shape", "bytes", "ns/req", "cycles/req", "bytes/cycle");
+    for (size_t i = 0; i < shapes.size(); i++)
+    {
+        const shape &sh = shapes[i];
+        int len = (int)sh.data.size();
+        if (len > http_conn::READ_BUFFER_SIZE)
+        {
+            printf("%-20s %8d does not fit in the read buffer\n", sh.name, len);
+            continue;
+        }
+
+        // 先检查一遍解析结果，解析器改坏时直接报错
+        int checks = sh.split ? len - 1 : 1;
+        for (int k = 1; k <= checks; k++)
+        {
+            if (parse_shape(conn, sh, k) != sh.requests)
+            {
+                fprintf(stderr, "%s: parse failed (split at %d)\n", sh.name, k);
+                return 1;
+            }
+        }
+
+        // 拆分形态每轮遍历所有拆分点；拷贝到读缓冲区的开销另外测出后减去
+        int split_at = 1;
+        measurement total = measure(min_ns, [&] {
+            parse_shape(conn, sh, split_at);
+            if (sh.split && ++split_at >= len)
+            {
+                split_at = 1;
+            }
+        });
+        measurement copy = measure(min_ns / 4, [&] {
+            memcpy(scratch, sh.data.data(), len);
+            __asm__ __volatile__("" : : "r"(scratch) : "memory");
+        });
+        double ns = (total.ns - copy.ns) / sh.requests;
+        double cycles = (total.cycles - copy.cycles) / sh.requests;
+        double bytes = (double)len / sh.requests;
+        printf("%-20s %8.0f %10.1f %12.1f %12.3f\n", sh.name, bytes, ns, cycles, cycles > 0 ? bytes / cycles : 0.0);
+    }
+
+    measurement reset = measure(min_ns, [&] { parser_bench::init(conn); });
+    printf("%-20s %8s %10.1f %12.1f %12s\n", "init()", "-", reset.ns, reset.cycles, "-");
+    return 0;
+}
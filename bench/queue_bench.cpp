@@ -0,0 +1,153 @@
+/*************************************************************
+*阻塞队列的吞吐量与延迟基准测试
+*对比修改前的legacy_block_queue、互斥锁版本block_queue和无锁版本mpsc_queue
+*flood：多个生产者尽快放入，测吞吐量以及从放入到取出的延迟
+*paced：一个生产者每隔一段时间放入一个，测消费者被唤醒的延迟
+*用法：./queue_bench [每个生产者放入的个数] [队列长度]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <vector>
+#include <algorithm>
+#include "legacy_block_queue.h"
+#include "../log/block_queue.h"
+#include "../log/mpsc_queue.h"
+
+static long long now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+// 修改前的pop()在队列为空时会死锁，只在有数据时调用
+static bool consume(legacy_block_queue<long long> &q, long long &item)
+{
+    if (q.size() <= 0)
+    {
+        sched_yield();
+        return false;
+    }
+    return q.pop(item);
+}
+
+static bool consume(block_queue<long long> &q, long long &item)
+{
+    return q.pop(item);
+}
+
+static bool consume(mpsc_queue<long long> &q, long long &item)
+{
+    return q.pop(item);
+}
+
+struct result
+{
+    double seconds;
+    std::vector<long long> latency; // ns
+};
+
+template <typename Q>
+static result run(int producers, long long per_producer, int capacity, long long interval_ns)
+{
+    Q q(capacity);
+    result r;
+    long long total = producers * per_producer;
+    r.latency.reserve(total);
+
+    std::vector<pthread_t> threads(producers);
+    struct producer_arg
+    {
+        Q *q;
+        long long count;
+        long long interval;
+    } arg = {&q, per_producer, interval_ns};
+
+    long long begin = now_ns();
+    for (int i = 0; i < producers; i++)
+    {
+        pthread_create(&threads[i], NULL, [](void *p) -> void * {
+            producer_arg *a = (producer_arg *)p;
+            long long next = now_ns();
+            for (long long n = 0; n < a->count; n++)
+            {
+                if (a->interval > 0)
+                {
+                    next += a->interval;
+                    while (now_ns() < next)
+                    {
+                    }
+                }
+                //队列满时让出CPU后重试
+                while (!a->q->push(now_ns()))
+                {
+                    sched_yield();
+                }
+            }
+            return NULL;
+        }, &arg);
+    }
+
+    long long item = 0;
+    for (long long n = 0; n < total;)
+    {
+        if (consume(q, item))
+        {
+            r.latency.push_back(now_ns() - item);
+            n++;
+        }
+    }
+    r.seconds = (now_ns() - begin) / 1e9;
+
+    for (int i = 0; i < producers; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    return r;
+}
+
+static long long percentile(std::vector<long long> &v, double p)
+{
+    size_t k = (size_t)(p * (v.size() - 1));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+static void report(const char *name, const char *mode, int producers, result r)
+{
+    double ops = r.latency.size() / r.seconds;
+    long long p50 = percentile(r.latency, 0.50);
+    long long p99 = percentile(r.latency, 0.99);
+    long long p999 = percentile(r.latency, 0.999);
+    long long max = *std::max_element(r.latency.begin(), r.latency.end());
+    printf("%-20s %-6s %9d %12.0f %10lld %10lld %10lld %12lld\n",
+           name, mode, producers, ops, p50 / 1000, p99 / 1000, p999 / 1000, max / 1000);
+}
+
+int main(int argc, char *argv[])
+{
+    long long count = argc > 1 ? atoll(argv[1]) : 200000;
+    int capacity = argc > 2 ? atoi(argv[2]) : 1024;
+    //paced模式下生产者放入的间隔和个数
+    const long long interval = 20000;
+    const long long paced_count = 20000;
+
+    printf("%-20s %-6s %9s %12s %10s %10s %10s %12s\n",
+           "queue", "mode", "producers", "ops/s", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+    int producer_counts[] = {1, 2, 4};
+    for (int i = 0; i < 3; i++)
+    {
+        int p = producer_counts[i];
+        report("legacy_block_queue", "flood", p, run<legacy_block_queue<long long> >(p, count, capacity, 0));
+        report("block_queue", "flood", p, run<block_queue<long long> >(p, count, capacity, 0));
+        report("mpsc_queue", "flood", p, run<mpsc_queue<long long> >(p, count, capacity, 0));
+    }
+    report("legacy_block_queue", "paced", 1, run<legacy_block_queue<long long> >(1, paced_count, capacity, interval));
+    report("block_queue", "paced", 1, run<block_queue<long long> >(1, paced_count, capacity, interval));
+    report("mpsc_queue", "paced", 1, run<mpsc_queue<long long> >(1, paced_count, capacity, interval));
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*************************************************************
+*定时器容器的基准测试
+*对升序链表sort_timer_lst、二叉堆、4叉堆和时间轮wheel_timer重放连接的变化过程：
+*  add      建立n个连接，每个连接加入一个定时器，超时时间为当前时间+15s
+*  refresh  长连接上每个请求都把超时时间推后到当前时间+15s，随机选择连接调整n次
+*  churn    随机关闭一个连接并建立新连接，删除一个定时器再加入一个，共n次
+*  expire   所有连接同时超时，一次tick执行并删除全部定时器
+*时间是模拟的，每处理n/15个操作前进1秒，tick直接传入模拟时间
+*堆和时间轮不限时，总是按给定的n运行；链表的加入和调整是O(n)的，最后运行，每个阶段最多运行给定的时间，
+*时限内加入的定时器数少于n时，链表按它达到的个数报告，并单独注明
+*内存为加入阶段后malloc统计的增量除以定时器个数，包括util_timer本身
+*用法：./timer_bench [连接数] [链表每个阶段的最长时间ms，0为不限]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <malloc.h>
+#include <vector>
+#include "../timer/lst_timer.h"
+#include "../timer/heap_timer.h"
+#include "../timer/wheel_timer.h"
+#include "../log/log.h"
+
+#define TIMEOUT 15
+
+static long long now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static unsigned int rand_state = 2463534242u;
+
+static unsigned int next_rand()
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+static long long fired = 0;
+
+static void on_expire(client_data *)
+{
+    fired++;
+}
+
+static timer_container *make_list(time_t) { return new sort_timer_lst; }
+static timer_container *make_heap2(time_t) { return new heap_timer<2>; }
+static timer_container *make_heap4(time_t) { return new heap_timer<4>; }
+static timer_container *make_wheel(time_t now) { return new wheel_timer(64, now); }
+
+// 模拟时钟：每step个操作前进1秒
+struct clock_sim
+{
+    time_t now;
+    long long ops;
+    long long step;
+    void advance()
+    {
+        if (++ops % step == 0)
+        {
+            now++;
+        }
+    }
+};
+
+static util_timer *new_timer(client_data *user, time_t now)
+{
+    util_timer *timer = new util_timer;
+    timer->user_data = user;
+    timer->cb_func = on_expire;
+    timer->expire = now + TIMEOUT;
+    return timer;
+}
+
+static void report(const char *name, const char *phase, size_t timers, long long ops, long long ns, long long target)
+{
+    printf("%-8s %-8s %8zu %10lld %10.1f%s\n", name, phase, timers, ops, ops > 0 ? (double)ns / ops : 0.0,
+           ops < target ? "  (time limit)" : "");
+}
+
+static bool over_limit(long long begin, long long limit_ns)
+{
+    return limit_ns > 0 && now_ns() - begin >= limit_ns;
+}
+
+// 按n个连接运行各阶段，limit_ns为每个阶段的最长时间，0为不限；reached返回实际加入的定时器数
+static bool run(const char *name, timer_container *(*make)(time_t), int n, long long limit_ns, int &reached)
+{
+    std::vector<client_data> users(n);
+    std::vector<util_timer *> timers;
+    timers.reserve(n);
+    clock_sim clock = {1000000000, 0, n / TIMEOUT > 0 ? n / TIMEOUT : 1};
+
+    size_t heap_before = mallinfo2().uordblks;
+    timer_container *c = make(clock.now);
+
+    long long begin = now_ns();
+    long long elapsed = 0;
+    for (int i = 0; i < n; i++)
+    {
+        util_timer *timer = new_timer(&users[i], clock.now);
+        users[i].timer = timer;
+        c->add_timer(timer);
+        timers.push_back(timer);
+        clock.advance();
+        if ((i & 255) == 255 && over_limit(begin, limit_ns))
+        {
+            break;
+        }
+    }
+    elapsed = now_ns() - begin;
+    size_t heap_after = mallinfo2().uordblks;
+    report(name, "add", timers.size(), (long long)timers.size(), elapsed, n);
+    size_t live = timers.size();
+    reached = (int)live;
+
+    //调整和替换的次数与实际的定时器数相同
+    long long target = (long long)live;
+    long long ops = 0;
+    begin = now_ns();
+    for (; ops < target; ops++)
+    {
+        util_timer *timer = timers[next_rand() % live];
+        timer->expire = clock.now + TIMEOUT;
+        c->adjust_timer(timer);
+        clock.advance();
+        if ((ops & 255) == 255 && over_limit(begin, limit_ns))
+        {
+            ops++;
+            break;
+        }
+    }
+    report(name, "refresh", live, ops, now_ns() - begin, target);
+
+    ops = 0;
+    begin = now_ns();
+    for (; ops < target; ops++)
+    {
+        size_t idx = next_rand() % live;
+        client_data *user = timers[idx]->user_data;
+        c->del_timer(timers[idx]);
+        timers[idx] = new_timer(user, clock.now);
+        user->timer = timers[idx];
+        c->add_timer(timers[idx]);
+        clock.advance();
+        if ((ops & 255) == 255 && over_limit(begin, limit_ns))
+        {
+            ops++;
+            break;
+        }
+    }
+    report(name, "churn", live, ops, now_ns() - begin, target);
+
+    fired = 0;
+    begin = now_ns();
+    c->tick(clock.now + TIMEOUT + 1);
+    elapsed = now_ns() - begin;
+    report(name, "expire", live, fired, elapsed, fired);
+    if (fired != (long long)live || c->size() != 0)
+    {
+        fprintf(stderr, "%s: expired %lld of %zu timers, %d left\n", name, fired, live, c->size());
+        delete c;
+        return false;
+    }
+
+    printf("%-8s %-8s %8zu %21.1f bytes/timer\n", name, "memory", live,
+           live > 0 ? (double)(heap_after - heap_before) / live : 0.0);
+    delete c;
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    int n = argc > 1 ? atoi(argv[1]) : 100000;
+    long long limit_ns = (argc > 2 ? atoll(argv[2]) : 2000) * 1000000LL;
+    // 链表的tick中有DEBUG日志，只做级别判断
+    Log::get_instance()->set_level(LOG_LEVEL_INFO);
+
+    printf("%-8s %-8s %8s %10s %10s\n", "timer", "phase", "timers", "ops", "ns/op");
+    int reached = n;
+    bool ok = run("heap2", make_heap2, n, 0, reached);
+    ok = run("heap4", make_heap4, n, 0, reached) && ok;
+    ok = run("wheel", make_wheel, n, 0, reached) && ok;
+    ok = run("list", make_list, n, limit_ns, reached) && ok;
+    if (reached < n)
+    {
+        printf("# list reached only %d of %d timers within %lld ms, its rows are for n=%d\n", reached, n,
+               limit_ns / 1000000, reached);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <vector>
+#include "server_config.h"
+#include "../threadpool/affinity.h"
+
+// 网站根目录与URL拼接后不能超过http_conn::FILENAME_LEN
+static const size_t DOC_ROOT_MAX = 150;
+
+server_config::server_config()
+    : port(0), conn_et(false), listen_et(false), log_mode("sync"), threads(8), io_threads(4), queue_size(10000),
+      timeout(15), read_budget(0), doc_root("./root"), timer("wheel"), loop_cpu(-1)
+{
+}
+
+static bool parse_int(const char *value, int min, int max, int &out)
+{
+    char *end = NULL;
+    errno = 0;
+    long v = strtol(value, &end, 10);
+    if (errno != 0 || end == value || *end != '\0' || v < min || v > max)
+    {
+        return false;
+    }
+    out = (int)v;
+    return true;
+}
+
+static bool parse_trigger(const char *value, bool &et)
+{
+    if (strcmp(value, "et") == 0 || strcmp(value, "ET") == 0)
+    {
+        et = true;
+        return true;
+    }
+    if (strcmp(value, "lt") == 0 || strcmp(value, "LT") == 0)
+    {
+        et = false;
+        return true;
+    }
+    return false;
+}
+
+bool server_config::set(const char *name, const char *value, std::string &error)
+{
+    bool ok = true;
+    if (strcmp(name, "trigger") == 0)
+        ok = parse_trigger(value, conn_et);
+    else if (strcmp(name, "listen_trigger") == 0)
+        ok = parse_trigger(value, listen_et);
+    else if (strcmp(name, "log") == 0)
+    {
+        ok = strcmp(value, "sync") == 0 || strcmp(value, "async") == 0 || strcmp(value, "defer") == 0;
+        if (ok)
+            log_mode = value;
+    }
+    else if (strcmp(name, "threads") == 0)
+        ok = parse_int(value, 1, 1024, threads);
+    else if (strcmp(name, "io_threads") == 0)
+        ok = parse_int(value, 1, 1024, io_threads);
+    else if (strcmp(name, "queue_size") == 0)
+        ok = parse_int(value, 1, 1 << 24, queue_size);
+    else if (strcmp(name, "timeout") == 0)
+        ok = parse_int(value, 1, 86400, timeout);
+    else if (strcmp(name, "read_budget") == 0)
+        ok = parse_int(value, 0, INT_MAX, read_budget);
+    else if (strcmp(name, "doc_root") == 0)
+    {
+        ok = value[0] != '\0' && strlen(value) < DOC_ROOT_MAX;
+        if (ok)
+        {
+            doc_root = value;
+            // 去掉末尾的'/'，URL总是以'/'开头
+            while (doc_root.size() > 1 && doc_root[doc_root.size() - 1] == '/')
+                doc_root.erase(doc_root.size() - 1);
+        }
+    }
+    else if (strcmp(name, "timer") == 0)
+    {
+        ok = strcmp(value, "list") == 0 || strcmp(value, "heap2") == 0 || strcmp(value, "heap4") == 0 ||
+             strcmp(value, "wheel") == 0;
+        if (ok)
+            timer = value;
+    }
+    else if (strcmp(name, "loop_cpu") == 0)
+        ok = parse_int(value, -1, CPU_SETSIZE - 1, loop_cpu);
+    else if (strcmp(name, "worker_cpus") == 0)
+        worker_cpus = value;
+    else if (strcmp(name, "io_cpus") == 0)
+        io_cpus = value;
+    else
+    {
+        error = std::string("unknown option ") + name;
+        return false;
+    }
+    if (!ok)
+    {
+        error = std::string("invalid value for ") + name + ": " + value;
+    }
+    return ok;
+}
+
+// 去掉首尾空白
+static char *trim(char *s)
+{
+    while (*s == ' ' || *s == '\t')
+        s++;
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+        *--end = '\0';
+    return s;
+}
+
+bool server_config::load(const char *path, std::string &error)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        error = std::string("cannot open ") + path + ": " + strerror(errno);
+        return false;
+    }
+    char line[512];
+    int number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), fp))
+    {
+        number++;
+        char *text = trim(line);
+        if (*text == '\0' || *text == '#')
+            continue;
+        char *eq = strchr(text, '=');
+        if (!eq)
+        {
+            error = "missing '='";
+            ok = false;
+            break;
+        }
+        *eq = '\0';
+        ok = set(trim(text), trim(eq + 1), error);
+    }
+    fclose(fp);
+    if (!ok)
+    {
+        char where[32];
+        snprintf(where, sizeof(where), ":%d: ", number);
+        error = path + (where + error);
+    }
+    return ok;
+}
+
+bool server_config::parse_args(int argc, char *argv[], std::string &error)
+{
+    int positional = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (strcmp(arg, "-f") == 0 || strcmp(arg, "--config") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                error = std::string(arg) + " needs a file";
+                return false;
+            }
+            if (!load(argv[++i], error))
+                return false;
+        }
+        else if (strncmp(arg, "--", 2) == 0)
+        {
+            // --名称=值 或 --名称 值
+            std::string name(arg + 2);
+            std::string value;
+            size_t eq = name.find('=');
+            if (eq != std::string::npos)
+            {
+                value = name.substr(eq + 1);
+                name.erase(eq);
+            }
+            else if (i + 1 < argc)
+            {
+                value = argv[++i];
+            }
+            else
+            {
+                error = std::string(arg) + " needs a value";
+                return false;
+            }
+            for (size_t k = 0; k < name.size(); k++)
+            {
+                if (name[k] == '-')
+                    name[k] = '_';
+            }
+            if (!set(name.c_str(), value.c_str(), error))
+                return false;
+        }
+        else if (positional == 0)
+        {
+            ip = arg;
+            positional++;
+        }
+        else if (positional == 1)
+        {
+            if (!parse_int(arg, 1, 65535, port))
+            {
+                error = std::string("invalid port ") + arg;
+                return false;
+            }
+            positional++;
+        }
+        else
+        {
+            error = std::string("unexpected argument ") + arg;
+            return false;
+        }
+    }
+    if (positional < 2)
+    {
+        error = "ip and port are required";
+        return false;
+    }
+    return validate(error);
+}
+
+bool server_config::validate(std::string &error) const
+{
+    struct stat st;
+    if (stat(doc_root.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        error = "doc_root " + doc_root + " is not a directory";
+        return false;
+    }
+    std::vector<int> cpus;
+    if (!parse_cpu_list(worker_cpus.c_str(), cpus))
+    {
+        error = "invalid worker_cpus " + worker_cpus;
+        return false;
+    }
+    if (!parse_cpu_list(io_cpus.c_str(), cpus))
+    {
+        error = "invalid io_cpus " + io_cpus;
+        return false;
+    }
+    return true;
+}
+
+void server_config::describe(std::string &out) const
+{
+    char buf[768];
+    snprintf(buf, sizeof(buf),
+             "trigger = %s\nlisten_trigger = %s\nlog = %s\nthreads = %d\nio_threads = %d\nqueue_size = %d\n"
+             "timeout = %d\nread_budget = %d\ndoc_root = %s\ntimer = %s\nloop_cpu = %d\nworker_cpus = %s\n"
+             "io_cpus = %s\n",
+             conn_et ? "et" : "lt", listen_et ? "et" : "lt", log_mode.c_str(), threads, io_threads, queue_size,
+             timeout, read_budget, doc_root.c_str(), timer.c_str(), loop_cpu, worker_cpus.c_str(), io_cpus.c_str());
+    out += buf;
+}
+
+void server_config::usage(const char *program)
+{
+    printf("usage: %s [options] ip_address port_number\n"
+           "  -f, --config FILE      read \"name = value\" lines from FILE\n"
+           "  --trigger lt|et        connection socket trigger mode\n"
+           "  --listen-trigger lt|et listen socket trigger mode\n"
+           "  --log sync|async|defer log writing mode\n"
+           "  --threads N            request parsing threads\n"
+           "  --io-threads N         blocking file I/O threads\n"
+           "  --queue-size N         max queued requests per thread pool\n"
+           "  --timeout SECONDS      idle connection timeout\n"
+           "  --read-budget BYTES    max bytes read per wakeup in et mode, 0 reads until EAGAIN\n"
+           "  --doc-root DIR         directory served to clients\n"
+           "  --timer list|heap2|heap4|wheel  timer container\n"
+           "  --loop-cpu N           pin the event loop to cpu N, -1 leaves it unpinned\n"
+           "  --worker-cpus LIST     cpus for request parsing threads, e.g. 2-5 or node:0\n"
+           "  --io-cpus LIST         cpus for file I/O threads\n",
+           program);
+}
@@ -0,0 +1,46 @@
+#ifndef _SERVER_CONFIG_H_
+#define _SERVER_CONFIG_H_
+/*************************************************************
+*服务器的运行期配置：触发模式、日志模式、线程数、队列长度、超时、网站根目录等
+*不需要重新编译即可针对不同的部署调整，默认值由main.cpp中的宏给出
+*命令行：server [--名称=值]... [-f 配置文件] ip port，--名称 值的写法也可以
+*配置文件：每行一个"名称 = 值"，#开头为注释；命令行和配置文件按出现的顺序生效，后面的覆盖前面的
+**************************************************************/
+
+#include <string>
+
+struct server_config
+{
+    std::string ip;
+    int port;
+    bool conn_et;           // 连接socket使用边缘触发
+    bool listen_et;         // 监听socket使用边缘触发
+    std::string log_mode;   // "sync"、"async"或"defer"
+    int threads;            // 解析请求的线程数
+    int io_threads;         // 执行阻塞文件操作的I/O线程数
+    int queue_size;         // 每个线程池请求队列的最大长度
+    int timeout;            // 连接空闲超时(s)
+    int read_budget;        // 边缘触发时一次读事件最多读取的字节数，0为读到EAGAIN或读缓冲区满
+    std::string doc_root;   // 网站的根目录
+    std::string timer;      // 定时器容器，见main.cpp中的TIMER_CONTAINER
+    int loop_cpu;           // 事件循环绑定的CPU，-1为不绑定
+    std::string worker_cpus;    // 解析线程绑定的CPU列表，格式见affinity.h中的parse_cpu_list，空为不绑定
+    std::string io_cpus;        // I/O线程绑定的CPU列表，格式同上
+
+    server_config();
+
+    // 按名称设置一项，失败时error说明原因
+    bool set(const char *name, const char *value, std::string &error);
+    // 读取配置文件
+    bool load(const char *path, std::string &error);
+    // 解析命令行，ip和port为最后两个位置参数
+    bool parse_args(int argc, char *argv[], std::string &error);
+    // 检查各项之间的约束，如doc_root必须是目录、CPU列表必须有效
+    bool validate(std::string &error) const;
+    // 每行一项"名称 = 值"，格式与配置文件相同
+    void describe(std::string &out) const;
+
+    static void usage(const char *program);
+};
+
+#endif
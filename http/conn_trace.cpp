@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <sys/syscall.h>
+#include "conn_trace.h"
+
+int conn_trace::m_fd = -1;
+
+// 事件名，下标为TRACE_EVENT
+static const char *event_names[TRACE_NUMBER] = {"stamp", "epollin", "epollout", "epollhup", "read", "enqueue",
+                                                "modfd", "eagain", "write", "timer_adjust", "close"};
+// 时间点的名字，与http_conn::STAMP对应
+static const char *stamp_names[] = {"accept", "read_begin", "read_end", "dequeue", "parsed", "response", "first_write", "written"};
+static const int STAMP_NAME_NUMBER = sizeof(stamp_names) / sizeof(stamp_names[0]);
+
+static int current_tid()
+{
+    static thread_local int tid = 0;
+    if (!tid)
+    {
+        tid = (int)syscall(SYS_gettid);
+    }
+    return tid;
+}
+
+conn_trace::conn_trace() : m_next(0)
+{
+}
+
+bool conn_trace::open(const char *path)
+{
+    if (m_fd >= 0)
+    {
+        return true;
+    }
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    // 新文件先写入数组的开头
+    if (lseek(fd, 0, SEEK_END) == 0 && ::write(fd, "[\n", 2) != 2)
+    {
+        close(fd);
+        return false;
+    }
+    m_fd = fd;
+    return true;
+}
+
+void conn_trace::record(int event, long long arg, long long now_us)
+{
+    entry &e = m_ring[m_next % RING_SIZE];
+    e.ts = now_us;
+    e.arg = arg;
+    e.tid = current_tid();
+    e.event = event;
+    m_next++;
+}
+
+void conn_trace::clear()
+{
+    m_next = 0;
+}
+
+// 把字符串写成JSON字符串的内容
+static void append_escaped(std::string &out, const char *s)
+{
+    for (; s && *s; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += (char)c;
+        }
+        else if (c >= 0x20)
+        {
+            out += (char)c;
+        }
+    }
+}
+
+void conn_trace::dump(int sockfd, const char *method, const char *url, int status, long long begin_us, long long end_us)
+{
+    if (m_fd < 0)
+    {
+        return;
+    }
+    int pid = (int)getpid();
+    char line[256];
+    std::string out;
+    out.reserve(RING_SIZE * 160 + 512);
+
+    snprintf(line, sizeof(line), "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"fd %d\"}},\n",
+             pid, sockfd, sockfd);
+    out += line;
+    out += "{\"name\":\"";
+    append_escaped(out, method);
+    out += ' ';
+    append_escaped(out, url ? url : "-");
+    snprintf(line, sizeof(line), " %d\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%d,\"tid\":%d},\n",
+             status, begin_us, end_us - begin_us, pid, sockfd);
+    out += line;
+
+    // 环已写满时从最早的一条开始
+    unsigned int first = m_next > (unsigned int)RING_SIZE ? m_next - RING_SIZE : 0;
+    for (unsigned int i = first; i < m_next; i++)
+    {
+        const entry &e = m_ring[i % RING_SIZE];
+        const char *name = event_names[e.event];
+        if (e.event == TRACE_STAMP && e.arg >= 0 && e.arg < STAMP_NAME_NUMBER)
+        {
+            name = stamp_names[e.arg];
+        }
+        snprintf(line, sizeof(line),
+                 "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":%d,\"tid\":%d,\"args\":{\"value\":%lld,\"thread\":%d}},\n",
+                 name, e.ts, pid, sockfd, e.arg, e.tid);
+        out += line;
+    }
+    if (first > 0)
+    {
+        snprintf(line, sizeof(line), "{\"name\":\"ring overflow: %u earlier events lost\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld,\"pid\":%d,\"tid\":%d},\n",
+                 first, begin_us, pid, sockfd);
+        out += line;
+    }
+
+    // O_APPEND下一次write是原子追加，不同连接的记录不会交错；写失败时丢弃这次记录
+    if (::write(m_fd, out.data(), out.size()) < 0)
+    {
+        return;
+    }
+}
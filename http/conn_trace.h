@@ -0,0 +1,57 @@
+#ifndef _CONN_TRACE_H_
+#define _CONN_TRACE_H_
+/*************************************************************
+*连接上的事件记录，用于排查个别请求耗时过长的原因
+*每个连接一个固定大小的环形缓冲区，记录epoll事件、读写、入队、重新注册、EAGAIN、定时器调整等
+*请求耗时超过阈值时，以Chrome trace-event格式追加到文件中，可直接用Perfetto或chrome://tracing打开
+*文件为JSON数组格式且不写结尾的']'，进程被强制结束时已写入的内容仍然可以加载
+**************************************************************/
+
+enum TRACE_EVENT
+{
+    TRACE_STAMP = 0,    // 请求处理的时间点，参数为http_conn::STAMP
+    TRACE_EPOLLIN,      // 事件循环收到可读事件
+    TRACE_EPOLLOUT,     // 事件循环收到可写事件
+    TRACE_EPOLLHUP,     // 事件循环收到挂断或错误事件
+    TRACE_READ,         // recv，参数为读到的字节数
+    TRACE_ENQUEUE,      // 投入线程池，参数为优先级通道
+    TRACE_MODFD,        // 重新注册epoll事件，参数为事件
+    TRACE_EAGAIN,       // writev返回EAGAIN，等待下一次可写
+    TRACE_WRITE,        // writev，参数为写出的字节数
+    TRACE_TIMER_ADJUST, // 延长连接的定时器，参数为新的超时时间
+    TRACE_CLOSE,        // 关闭连接
+    TRACE_NUMBER
+};
+
+class conn_trace
+{
+public:
+    // 每个连接保留的最近事件数
+    static const int RING_SIZE = 64;
+
+    conn_trace();
+
+    // 打开输出文件，进程中只需调用一次
+    static bool open(const char *path);
+
+    void record(int event, long long arg, long long now_us);
+    void clear();
+    // 把环中的事件和一个表示整个请求的区间写入文件，sockfd作为Perfetto中的轨道
+    void dump(int sockfd, const char *method, const char *url, int status, long long begin_us, long long end_us);
+
+private:
+    struct entry
+    {
+        long long ts;   // us
+        long long arg;
+        int tid;
+        int event;
+    };
+
+    entry m_ring[RING_SIZE];
+    unsigned int m_next; // 下一个写入位置，单调递增
+
+    static int m_fd;
+};
+
+#endif
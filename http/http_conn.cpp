@@ -1,13 +1,10 @@
 #include "http_conn.h"
 #include "../log/log.h"
+#include "../log/access_log.h"
+#include "../metrics/metrics.h"
 #include <fstream>
 #include <stdio.h>
-
-// #define connfdET //边缘触发非阻塞
-#define connfdLT //水平触发阻塞
-
-// #define listenfdET //边缘触发非阻塞
-#define listenfdLT //水平触发阻塞
+#include <atomic>
 
 //定义http响应的一些状态信息
 const char *ok_200_title = "OK";
@@ -20,8 +17,77 @@ const char *error_404_form = "The requested file was not found on this server.\n
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
 
-// 网站的根目录
-const char *doc_root = "/home/qqh/server/WebServer/root";
+// 请求方法名，下标为METHOD
+static const char *method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
+
+// 单调时钟的当前时间(us)
+static long long now_us()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+// 统计指标的编号，未注册时为-1，更新操作直接返回
+static const int STATUS_CLASS_NUMBER = 4; // 2xx到5xx
+static int metric_responses[STATUS_CLASS_NUMBER] = {-1, -1, -1, -1};
+static int metric_sent_bytes = -1;
+static int metric_request_duration = -1;
+
+// 请求处理各阶段的耗时直方图，每个阶段为两个时间点之差，任一时间点未到达时不记录
+struct stage_def
+{
+    const char *name;
+    http_conn::STAMP from;
+    http_conn::STAMP to;
+};
+static const stage_def stages[] = {
+    {"webserver_stage_duration_seconds{stage=\"accept\"}", http_conn::STAMP_ACCEPT, http_conn::STAMP_READ_BEGIN},
+    {"webserver_stage_duration_seconds{stage=\"read\"}", http_conn::STAMP_READ_BEGIN, http_conn::STAMP_READ_END},
+    {"webserver_stage_duration_seconds{stage=\"queue\"}", http_conn::STAMP_READ_END, http_conn::STAMP_PROCESS},
+    {"webserver_stage_duration_seconds{stage=\"parse\"}", http_conn::STAMP_PROCESS, http_conn::STAMP_PARSED},
+    {"webserver_stage_duration_seconds{stage=\"file\"}", http_conn::STAMP_PARSED, http_conn::STAMP_RESPONSE},
+    {"webserver_stage_duration_seconds{stage=\"first_write\"}", http_conn::STAMP_RESPONSE, http_conn::STAMP_FIRST_WRITE},
+    {"webserver_stage_duration_seconds{stage=\"write\"}", http_conn::STAMP_FIRST_WRITE, http_conn::STAMP_WRITTEN},
+};
+static const int STAGE_NUMBER = sizeof(stages) / sizeof(stages[0]);
+static int metric_stages[STAGE_NUMBER] = {-1, -1, -1, -1, -1, -1, -1};
+
+// 大对象路径前缀表，匹配的请求进入低优先级通道
+static const int BULK_PREFIX_NUMBER = 16;
+static char bulk_prefixes[BULK_PREFIX_NUMBER][http_conn::FILENAME_LEN];
+static int bulk_prefix_count = 0;
+
+// 响应代价提示表，以URL的哈希为下标，记录该URL上一次的响应是否为大文件或错误
+// 高32位为URL哈希用于校验，低位为1表示代价较高；由工作线程写、主线程读，冲突时只会导致一次误判
+static const int COST_HINT_NUMBER = 4096;
+static std::atomic<unsigned long long> cost_hints[COST_HINT_NUMBER];
+
+// FNV-1a哈希，URL中'?'之后的查询串不参与计算
+static unsigned int url_hash(const char *url)
+{
+    unsigned int hash = 2166136261u;
+    for (; *url && *url != '?'; ++url)
+    {
+        hash ^= (unsigned char)*url;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void record_cost_hint(const char *url, bool expensive)
+{
+    unsigned int hash = url_hash(url);
+    unsigned long long hint = ((unsigned long long)hash << 32) | (expensive ? 1 : 0);
+    cost_hints[hash % COST_HINT_NUMBER].store(hint, std::memory_order_relaxed);
+}
+
+static bool lookup_cost_hint(const char *url)
+{
+    unsigned int hash = url_hash(url);
+    unsigned long long hint = cost_hints[hash % COST_HINT_NUMBER].load(std::memory_order_relaxed);
+    return (hint >> 32) == hash && (hint & 1);
+}
 
 // 设置非阻塞
 int setnonblocking(int fd)
@@ -32,33 +98,23 @@ int setnonblocking(int fd)
     return old_option;
 }
 
-// 向内核事件表注册,ET模式，选择开启EPOLLONESHOT
-int addfd(int epollfd, int fd, bool one_shot)
+// 向内核事件表注册，et选择边缘触发，one_shot选择开启EPOLLONESHOT
+int addfd(int epollfd, int fd, bool one_shot, bool et)
 {
     epoll_event event;
     event.data.fd = fd;
-#ifdef connfdET
-    event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-#endif
-
-#ifdef connfdLT
-    event.events = EPOLLIN | EPOLLRDHUP;
-#endif
-
-#ifdef listenfdET
-    event.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-#endif
-
-#ifdef listenfdLT
     event.events = EPOLLIN | EPOLLRDHUP;
-#endif
-
+    if (et)
+    {
+        event.events |= EPOLLET;
+    }
     if (one_shot)
     {
         event.events |= EPOLLONESHOT;
     }
-    epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
+    int ret = epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
     setnonblocking(fd);
+    return ret;
 }
 
 // 从内核事件表移除fd
@@ -74,26 +130,148 @@ void modfd(int epollfd, int fd, int ev)
     epoll_event event;
     event.data.fd = fd;
 
-#ifdef connfdET
-    event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
-#endif
-
-#ifdef connfdLT
     event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
-#endif
+    if (http_conn::m_et)
+    {
+        event.events |= EPOLLET;
+    }
 
     epoll_ctl(epollfd, EPOLL_CTL_MOD, fd, &event);
 }
 
 // 头文件中声明的静态变量初始化
-int http_conn::m_user_count = 0;
+threadpool<http_conn> *http_conn::m_io_pool = NULL;
+std::atomic<int> http_conn::m_user_count(0);
 int http_conn::m_epollfd = -1;
+completion_queue *http_conn::m_completion = NULL;
+http_conn::CLASSIFIER http_conn::m_classifier = http_conn::default_classifier;
+long http_conn::m_large_file_size = 64 * 1024;
+const char *http_conn::m_metrics_path = NULL;
+long long http_conn::m_trace_threshold_us = 0;
+bool http_conn::m_et = false;
+int http_conn::m_read_budget = 0;
+const char *http_conn::m_doc_root = "./root";
+
+static long long sample_user_count(void *)
+{
+    return http_conn::m_user_count.load(std::memory_order_relaxed);
+}
+
+void http_conn::register_metrics()
+{
+    metrics *m = metrics::get_instance();
+    m->add_sampled("webserver_connections", "Open client connections.", METRIC_GAUGE, sample_user_count, NULL);
+    const char *names[STATUS_CLASS_NUMBER] = {"webserver_responses_total{code=\"2xx\"}", "webserver_responses_total{code=\"3xx\"}",
+                                              "webserver_responses_total{code=\"4xx\"}", "webserver_responses_total{code=\"5xx\"}"};
+    for (int i = 0; i < STATUS_CLASS_NUMBER; i++)
+    {
+        metric_responses[i] = m->add_counter(names[i], "HTTP responses by status class.");
+    }
+    metric_sent_bytes = m->add_counter("webserver_sent_bytes_total", "Bytes written to client sockets.");
+    metric_request_duration = m->add_histogram("webserver_request_duration_seconds",
+                                               "Time from the first byte of a request to the last byte of its response.");
+    for (int i = 0; i < STAGE_NUMBER; i++)
+    {
+        metric_stages[i] = m->add_histogram(stages[i].name, "Time spent in each stage of request handling.");
+    }
+}
+
+bool http_conn::add_bulk_prefix(const char *prefix)
+{
+    if (bulk_prefix_count >= BULK_PREFIX_NUMBER || strlen(prefix) >= FILENAME_LEN)
+    {
+        return false;
+    }
+    strcpy(bulk_prefixes[bulk_prefix_count++], prefix);
+    return true;
+}
+
+http_conn::PRIORITY http_conn::default_classifier(METHOD method, const char *url)
+{
+    if (method != GET)
+    {
+        return PRIORITY_LOW;
+    }
+    for (int i = 0; i < bulk_prefix_count; i++)
+    {
+        if (strncmp(url, bulk_prefixes[i], strlen(bulk_prefixes[i])) == 0)
+        {
+            return PRIORITY_LOW;
+        }
+    }
+    if (lookup_cost_hint(url))
+    {
+        return PRIORITY_LOW;
+    }
+    return PRIORITY_HIGH;
+}
+
+// 只读地扫描读缓冲区中的请求行，取出方法和URL交给分类钩子
+// 请求行由工作线程正式解析，这里不修改缓冲区；请求行尚未读完整时按高优先级处理
+http_conn::PRIORITY http_conn::classify()
+{
+    // 请求行已经在之前的任务中解析过，沿用之前的结果
+    if (m_check_state != CHECK_STATE_REQUESTLINE)
+    {
+        return m_priority;
+    }
+
+    const char *line = m_read_buf + m_start_line;
+    const char *end = (const char *)memchr(line, '\n', m_read_idx - m_start_line);
+    if (!end)
+    {
+        return m_priority = PRIORITY_HIGH;
+    }
+
+    int method_len = strcspn(line, " \t");
+    METHOD method = PATCH;
+    bool known = false;
+    for (int i = 0; i <= PATCH; i++)
+    {
+        if ((int)strlen(method_names[i]) == method_len && strncasecmp(line, method_names[i], method_len) == 0)
+        {
+            method = (METHOD)i;
+            known = true;
+            break;
+        }
+    }
+    if (!known)
+    {
+        return m_priority = PRIORITY_LOW;
+    }
+
+    const char *url = line + method_len;
+    url += strspn(url, " \t");
+    if (strncasecmp(url, "http://", 7) == 0)
+    {
+        url = strchr(url + 7, '/');
+    }
+    else if (strncasecmp(url, "https://", 8) == 0)
+    {
+        url = strchr(url + 8, '/');
+    }
+    if (!url || url > end)
+    {
+        return m_priority = PRIORITY_LOW;
+    }
+    char path[FILENAME_LEN];
+    int path_len = strcspn(url, " \t\r\n");
+    if (path_len >= FILENAME_LEN)
+    {
+        path_len = FILENAME_LEN - 1;
+    }
+    memcpy(path, url, path_len);
+    path[path_len] = '\0';
+
+    return m_priority = m_classifier(method, path);
+}
 
 // 关闭连接，关闭一个连接，同时用户总量减一
 void http_conn::close_conn(bool real_close)
 {
     if (real_close && (m_sockfd != -1)) // m_sockfd当前连接的fd
     {
+        trace(TRACE_CLOSE);
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--;
@@ -105,15 +283,31 @@ void http_conn::init(int sockfd, const sockaddr_in &addr)
 {
     m_sockfd = sockfd;
     m_address = addr;
+    m_generation++;
 
     // 为了避免TIME_WAIT状态，仅用于调试
     int reuse = 1;
     setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 
-    addfd(m_epollfd, sockfd, true);
+    socklen_t cpu_len = sizeof(m_incoming_cpu);
+    if (getsockopt(m_sockfd, SOL_SOCKET, SO_INCOMING_CPU, &m_incoming_cpu, &cpu_len) != 0)
+    {
+        m_incoming_cpu = -1;
+    }
+
+    m_bytes_read = 0;
+    m_bytes_written = 0;
+    m_last_active = now_us();
+
+    addfd(m_epollfd, sockfd, true, m_et);
     m_user_count++;
 
     init();
+    if (m_trace)
+    {
+        m_trace->clear();
+    }
+    stamp(STAMP_ACCEPT);
 }
 
 //初始化新接受的连接
@@ -122,6 +316,7 @@ void http_conn::init()
 {
     m_check_state = CHECK_STATE_REQUESTLINE;
     m_linger = false;
+    m_priority = PRIORITY_HIGH;
     // bytes_to_send = 0;
 
     m_method = GET;
@@ -130,8 +325,13 @@ void http_conn::init()
     m_content_length = 0;
     m_host = 0;
     m_start_line = 0;
+    m_checked_idx = 0;
     m_read_idx = 0;
+    m_file_address = 0;
     m_write_idx = 0;
+    m_status = 0;
+    m_response_bytes = 0;
+    memset(m_stamps, 0, sizeof(m_stamps));
     memset(m_read_buf, '\0', READ_BUFFER_SIZE);
     memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
     memset(m_real_file, '\0', FILENAME_LEN);
@@ -178,6 +378,8 @@ http_conn::LINE_STATUS http_conn::parse_line()
 // 循环读取客户数据，知道无数据可读或对方关闭连接
 // 非阻塞ET工作模式下，需要一次性将数据读完
 // 由主线程的任务类调用，工作队列中有读事件时，根据读的结果判断是否吧任务加入进程池
+// 边缘触发时循环读取，直到EAGAIN、读缓冲区满或本次读取的字节数达到m_read_budget；
+// 后两种情况下socket中可能还有数据，处理完请求后modfd重新注册EPOLLIN时内核会再次报告可读
 bool http_conn::read()
 {
     if (m_read_idx >= READ_BUFFER_SIZE)
@@ -187,10 +389,33 @@ bool http_conn::read()
 
     int byte_read = 0;
 
-#ifdef connnfdET
-    while (true)
+    if (!m_et)
     {
         byte_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+        trace(TRACE_READ, byte_read);
+
+        if (byte_read <= 0)
+        {
+            return false;
+        }
+        m_read_idx += byte_read;
+        m_bytes_read += byte_read;
+        stamp(STAMP_READ_END);
+        m_last_active = m_stamps[STAMP_READ_END];
+        return true;
+    }
+
+    int budget = m_read_budget > 0 ? m_read_budget : READ_BUFFER_SIZE;
+    int total = 0;
+    while (total < budget && m_read_idx < READ_BUFFER_SIZE)
+    {
+        int len = READ_BUFFER_SIZE - m_read_idx;
+        if (len > budget - total)
+        {
+            len = budget - total;
+        }
+        byte_read = recv(m_sockfd, m_read_buf + m_read_idx, len, 0);
+        trace(TRACE_READ, byte_read);
         if (byte_read == -1) // 非阻塞IO报错和事件未触发都是返回-1，需要进一步根据errno区分
         {
             if (errno == EAGAIN || errno == EWOULDBLOCK)
@@ -201,23 +426,19 @@ bool http_conn::read()
         }
         else if (byte_read == 0)
         {
-            return false; // 无数据可读或者对方关闭了连接
+            return false; // 对方关闭了连接
         }
         m_read_idx += byte_read;
+        m_bytes_read += byte_read;
+        total += byte_read;
     }
-    return true;
-#endif
-
-#ifdef connfdLT
-    byte_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-
-    if (byte_read <= 0)
+    if (total == 0)
     {
-        return false;
+        return false; // 被唤醒时没有读到任何数据
     }
-    m_read_idx += byte_read;
+    stamp(STAMP_READ_END);
+    m_last_active = m_stamps[STAMP_READ_END];
     return true;
-#endif
 }
 
 // 解析HTTP请求行，获得请求方法，目标URL，以及HTTP版本号
@@ -248,9 +469,9 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char *text)
     }
     *m_version++ = '\0';
     m_version += strspn(m_version, " \t");
-    if (strcasecmp(m_version, "HTTP/1.1") != 0 || (strcasecmp(m_version, "HTTP/1.0") != 0))
+    if (strcasecmp(m_version, "HTTP/1.1") != 0 && strcasecmp(m_version, "HTTP/1.0") != 0)
     {
-        return BAD_REQUEST; // 此处只支持HTTP1.1版本的协议
+        return BAD_REQUEST; // 此处只支持HTTP1.0和HTTP1.1版本的协议
     }
     if (strncasecmp(m_url, "http://", 7) == 0)
     {
@@ -316,8 +537,7 @@ http_conn::HTTP_CODE http_conn::parse_headers(char *text)
     else
     {
         // printf("opp! unknow header %s\n", text);
-        LOG_INFO("oop!unknow header: %s", text);
-        Log::get_instance()->flush();
+        LOG_DEBUG("oop!unknow header: %s", text);
     }
     return NO_REQUEST;
 }
@@ -344,8 +564,7 @@ http_conn::HTTP_CODE http_conn::process_read()
         text = get_line(); // 读缓冲区的当前起点位置
         m_start_line = m_checked_idx;
         // printf("got 1 http line: %s\n", text);
-        LOG_INFO("%s", text);
-        Log::get_instance()->flush();
+        LOG_DEBUG("%s", text);
         switch (m_check_state)
         {
             case CHECK_STATE_REQUESTLINE:
@@ -366,7 +585,7 @@ http_conn::HTTP_CODE http_conn::process_read()
                 }
                 else if (ret == GET_REQUEST)
                 {
-                    return do_request(); // 获取了完整的http请求后，分析请求中的文件，并将之映射到m_file_address处
+                    return GET_REQUEST; // 获取了完整的http请求，由process()调用do_request()分析请求中的文件
                 }
                 break;
             }
@@ -375,7 +594,7 @@ http_conn::HTTP_CODE http_conn::process_read()
                 ret = parse_content(text);
                 if (ret == GET_REQUEST)
                 {
-                    return do_request();
+                    return GET_REQUEST;
                 }
                 line_status = LINE_OPEN;
                 break;
@@ -393,8 +612,8 @@ http_conn::HTTP_CODE http_conn::process_read()
 http_conn::HTTP_CODE http_conn::do_request()
 {
     // 组成实际访问文件的路径
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
+    strcpy(m_real_file, m_doc_root);
+    int len = strlen(m_doc_root);
     strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
     //通过stat获取请求资源文件信息，成功则将信息更新到m_file_stat结构体
     //失败返回NO_RESOURCE状态，表示资源不存在
@@ -412,10 +631,24 @@ http_conn::HTTP_CODE http_conn::do_request()
     {
         return BAD_REQUEST;
     }
+    //空文件无法mmap，由process_write返回空白html
+    if (m_file_stat.st_size == 0)
+    {
+        return FILE_REQUEST;
+    }
     //以只读方式获取文件描述符，通过mmap将该文件映射到内存中
     int fd = open(m_real_file, O_RDONLY);
+    if (fd < 0)
+    {
+        return FORBIDDEN_REQUEST;
+    }
     m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
+    if (m_file_address == MAP_FAILED)
+    {
+        m_file_address = 0;
+        return INTERNAL_ERROR;
+    }
     //表示请求文件存在，且可以访问
     return FILE_REQUEST;
 }
@@ -427,6 +660,10 @@ void http_conn::unmap()
         munmap(m_file_address, m_file_stat.st_size);
         m_file_address = 0;
     }
+    if (!m_body.empty())
+    {
+        std::string().swap(m_body);
+    }
 }
 
 // 写HTTP响应
@@ -440,6 +677,7 @@ bool http_conn::write()
     //表示响应报文为空，一般不会出现这种情况
     if (bytes_to_send == 0)
     {
+        trace(TRACE_MODFD, EPOLLIN);
         modfd(m_epollfd, m_sockfd, EPOLLIN);
         init();
         return true;
@@ -449,6 +687,7 @@ bool http_conn::write()
     {
         //将响应报文的状态行、消息头、空行和响应正文发送给浏览器端
         temp = writev(m_sockfd, m_iv, m_iv_count);
+        trace(TRACE_WRITE, temp);
 
         // 发送异常
         if (temp <= -1)
@@ -472,28 +711,42 @@ bool http_conn::write()
                 //     m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
                 // }
                 //重新注册写事件
+                trace(TRACE_EAGAIN);
+                trace(TRACE_MODFD, EPOLLOUT);
                 modfd(m_epollfd, m_sockfd, EPOLLOUT);
                 return true;
             }
             //如果发送失败，但不是缓冲区问题，取消映射
             unmap();
+            log_access();
             return false;   // 写入失败
         }
         //正常发送，temp为发送的字节数
+        if (!m_stamps[STAMP_FIRST_WRITE])
+        {
+            stamp(STAMP_FIRST_WRITE);
+        }
+        metrics::get_instance()->add(metric_sent_bytes, temp);
+        m_bytes_written += temp;
+        m_last_active = now_us();
         bytes_to_send -= temp;
         bytes_have_send += temp;
         if (bytes_to_send <= bytes_have_send)   // 全部待发送缓冲数据都已经发送了
         {
             // 响应发送成功，根据HTTP请求中的Connection字段决定是否立即关闭
             unmap();
+            stamp(STAMP_WRITTEN);
+            log_access();
             if (m_linger)
             {
                 init();
+                trace(TRACE_MODFD, EPOLLIN);
                 modfd(m_epollfd, m_sockfd, EPOLLIN);
                 return false;
             }
             else
             {
+                trace(TRACE_MODFD, EPOLLIN);
                 modfd(m_epollfd, m_sockfd, EPOLLIN);
                 return true;
             }
@@ -522,14 +775,14 @@ bool http_conn::add_response(const char* format, ...)
     m_write_idx += len;
     //清空可变参列表
     va_end(arg_list);
-    LOG_INFO("request:%s", m_write_buf);
-    Log::get_instance()->flush();
+    LOG_DEBUG("request:%s", m_write_buf);
     return true;
 }
 
 // 添加状态行
 bool http_conn::add_status_line(int status, const char *title)
 {
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
 
@@ -627,6 +880,7 @@ bool http_conn::process_write( HTTP_CODE ret )
                 m_iv[ 1 ].iov_base = m_file_address;
                 m_iv[ 1 ].iov_len = m_file_stat.st_size;
                 m_iv_count = 2;
+                m_response_bytes = m_write_idx + m_file_stat.st_size;
                 return true;
             }
             else
@@ -639,6 +893,26 @@ bool http_conn::process_write( HTTP_CODE ret )
                     return false;
                 }
             }
+            break;
+        }
+        //统计指标等内存中的正文，200
+        case MEMORY_REQUEST:
+        {
+            add_status_line( 200, ok_200_title );
+            add_content_length( m_body.size() );
+            add_response( "Content-Type: %s\r\n", m_body_type );
+            add_linger();
+            if ( ! add_blank_line() )
+            {
+                return false;
+            }
+            m_iv[ 0 ].iov_base = m_write_buf;
+            m_iv[ 0 ].iov_len = m_write_idx;
+            m_iv[ 1 ].iov_base = &m_body[ 0 ];
+            m_iv[ 1 ].iov_len = m_body.size();
+            m_iv_count = 2;
+            m_response_bytes = m_write_idx + m_body.size();
+            return true;
         }
         default:
         {
@@ -649,23 +923,261 @@ bool http_conn::process_write( HTTP_CODE ret )
     m_iv[ 0 ].iov_base = m_write_buf;
     m_iv[ 0 ].iov_len = m_write_idx;
     m_iv_count = 1;
+    m_response_bytes = m_write_idx;
     return true;
 }
 
 void http_conn::process()
 {
+    stamp(STAMP_PROCESS);
     HTTP_CODE read_ret  = process_read();
+    stamp(STAMP_PARSED);
     if (read_ret == NO_REQUEST)
     {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        // 请求还不完整，回到读取阶段，下次读完后重新记录这几个时间点
+        m_stamps[STAMP_READ_END] = m_stamps[STAMP_PROCESS] = m_stamps[STAMP_PARSED] = 0;
+        complete(EPOLLIN);
         return ;
     }
 
+    // 请求解析完毕，stat/open/mmap可能因冷文件或慢磁盘阻塞，交给I/O线程池执行，释放当前的解析线程
+    // I/O线程池未配置或队列已满时，在当前线程中直接执行
+    if (read_ret == GET_REQUEST && m_metrics_path && strcmp(m_url, m_metrics_path) == 0)
+    {
+        read_ret = do_metrics();
+    }
+    else if (read_ret == GET_REQUEST)
+    {
+        http_conn *conn = this;
+        if (m_io_pool && m_io_pool->submit([conn] { conn->process_file(); }))
+        {
+            return;
+        }
+        read_ret = do_request();
+    }
+
+    process_response(read_ret);
+}
+
+// I/O线程池中执行：访问文件系统并生成应答
+void http_conn::process_file()
+{
+    threadpool<http_conn>::set_current(this);
+    process_response(do_request());
+}
+
+// 根据请求的处理结果填充应答，并交回事件循环发送
+void http_conn::process_response(HTTP_CODE read_ret)
+{
+    // 记录本次响应的代价，供之后同一URL的请求分类使用
+    if (m_url)
+    {
+        bool expensive = (read_ret != FILE_REQUEST) || (m_file_stat.st_size > m_large_file_size);
+        record_cost_hint(m_url, expensive);
+    }
+
     bool write_ret = process_write(read_ret);
+    stamp(STAMP_RESPONSE);
     if (!write_ret)
     {
-        close_conn();
+        log_access();
+        complete(0);
+        return;
+    }
+
+    complete(EPOLLOUT);
+}
+
+http_conn::HTTP_CODE http_conn::do_metrics()
+{
+    if (m_method != GET)
+    {
+        return BAD_REQUEST;
+    }
+    m_body.clear();
+    metrics::get_instance()->render(m_body);
+    m_body_type = "text/plain; version=0.0.4";
+    return MEMORY_REQUEST;
+}
+
+void http_conn::stamp(STAMP which)
+{
+    long long now = now_us();
+    if (which == STAMP_READ_END && !m_stamps[STAMP_READ_BEGIN])
+    {
+        m_stamps[STAMP_READ_BEGIN] = now;
+    }
+    m_stamps[which] = now;
+    trace(TRACE_STAMP, which);
+}
+
+void http_conn::trace_event(TRACE_EVENT event, long long arg)
+{
+    if (!m_trace)
+    {
+        m_trace = new conn_trace;
+    }
+    m_trace->record(event, arg, now_us());
+}
+
+void http_conn::log_access()
+{
+    if (!m_stamps[STAMP_WRITTEN])
+    {
+        stamp(STAMP_WRITTEN);
     }
+    // 未到达的阶段耗时记为0
+    long long *t = m_stamps;
+    long long total = t[STAMP_READ_BEGIN] ? t[STAMP_WRITTEN] - t[STAMP_READ_BEGIN] : 0;
+    int status = m_status ? m_status : 500;
 
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    metrics *m = metrics::get_instance();
+    int status_class = status / 100 - 2;
+    if (status_class >= 0 && status_class < STATUS_CLASS_NUMBER)
+    {
+        m->add(metric_responses[status_class]);
+    }
+    m->observe(metric_request_duration, total);
+    for (int i = 0; i < STAGE_NUMBER; i++)
+    {
+        if (t[stages[i].from] && t[stages[i].to])
+        {
+            m->observe(metric_stages[i], t[stages[i].to] - t[stages[i].from]);
+        }
+    }
+
+    // 慢请求输出连接上的事件记录，之后清空，下一个请求重新记录
+    if (m_trace)
+    {
+        if (m_trace_threshold_us > 0 && total >= m_trace_threshold_us)
+        {
+            m_trace->dump(m_sockfd, method_names[m_method], m_url, status, t[STAMP_READ_BEGIN], t[STAMP_WRITTEN]);
+        }
+        m_trace->clear();
+    }
+
+    if (!Log::get_instance()->access_enabled() || !access_log::should_log(status, total))
+    {
+        return;
+    }
+
+    access_record rec;
+    gettimeofday(&rec.end, NULL);
+    rec.client = m_address;
+    rec.method = method_names[m_method];
+    rec.path = m_url;
+    rec.status = status;
+    rec.bytes = m_response_bytes;
+    rec.total_us = total;
+    rec.stage_us[ACCESS_STAGE_READ] = t[STAMP_READ_BEGIN] ? t[STAMP_READ_END] - t[STAMP_READ_BEGIN] : 0;
+    rec.stage_us[ACCESS_STAGE_QUEUE] = t[STAMP_PROCESS] ? t[STAMP_PROCESS] - t[STAMP_READ_END] : 0;
+    rec.stage_us[ACCESS_STAGE_PARSE] = t[STAMP_PARSED] ? t[STAMP_PARSED] - t[STAMP_PROCESS] : 0;
+    rec.stage_us[ACCESS_STAGE_FILE] = t[STAMP_RESPONSE] ? t[STAMP_RESPONSE] - t[STAMP_PARSED] : 0;
+    rec.stage_us[ACCESS_STAGE_WRITE] = t[STAMP_RESPONSE] ? t[STAMP_WRITTEN] - t[STAMP_RESPONSE] : 0;
+    access_log::write(rec);
+}
+
+// m_url指向读缓冲区，缓冲区不会释放，但在其他线程中读取时内容可能已被下一个请求覆盖
+const char *http_conn::current_url(int &length)
+{
+    const char *url = m_url;
+    length = 0;
+    if (url >= m_read_buf && url < m_read_buf + READ_BUFFER_SIZE)
+    {
+        length = (int)strnlen(url, m_read_buf + READ_BUFFER_SIZE - url);
+    }
+    return length ? url : "";
+}
+
+void http_conn::describe(char *buf, int len)
+{
+    char ip[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &m_address.sin_addr, ip, sizeof(ip));
+    int url_length;
+    const char *url = current_url(url_length);
+    snprintf(buf, len, "fd=%d peer=%s:%d url=%.*s", m_sockfd, ip, ntohs(m_address.sin_port), url_length, url);
+}
+
+long long http_conn::now()
+{
+    return now_us();
+}
+
+void http_conn::cost_hint_usage(int &used, int &capacity)
+{
+    used = 0;
+    for (int i = 0; i < COST_HINT_NUMBER; i++)
+    {
+        used += cost_hints[i].load(std::memory_order_relaxed) != 0;
+    }
+    capacity = COST_HINT_NUMBER;
+}
+
+void http_conn::append_state(std::string &out, long long now_us)
+{
+    static const char *state_names[] = {"REQUESTLINE", "HEADER", "CONTENT"};
+    // 最近到达的时间点对应的处理阶段
+    static const char *phase_names[] = {"idle", "reading", "queued", "parsing", "file", "responding", "writing", "written"};
+
+    int sockfd = m_sockfd;
+    if (sockfd == -1)
+    {
+        return;
+    }
+    int phase = 0;
+    for (int i = STAMP_NUMBER - 1; i > 0; i--)
+    {
+        if (m_stamps[i])
+        {
+            phase = i;
+            break;
+        }
+    }
+    int state = m_check_state;
+    char ip[INET_ADDRSTRLEN] = "";
+    inet_ntop(AF_INET, &m_address.sin_addr, ip, sizeof(ip));
+    int url_length;
+    const char *url = current_url(url_length);
+    char line[512];
+    int n = snprintf(line, sizeof(line), "fd=%d peer=%s:%d state=%s phase=%s read=%lld written=%lld idle_ms=%lld url=%.*s\n",
+                     sockfd, ip, ntohs(m_address.sin_port),
+                     state >= 0 && state <= CHECK_STATE_CONTENT ? state_names[state] : "?", phase_names[phase],
+                     m_bytes_read, m_bytes_written, (now_us - m_last_active) / 1000, url_length, url);
+    out.append(line, n < (int)sizeof(line) ? n : (int)sizeof(line) - 1);
+}
+
+void http_conn::complete(int ev)
+{
+    if (!m_completion)
+    {
+        if (ev)
+        {
+            trace(TRACE_MODFD, ev);
+            modfd(m_epollfd, m_sockfd, ev);
+        }
+        else
+        {
+            close_conn();
+        }
+        return;
+    }
+
+    http_conn *conn = this;
+    unsigned int generation = m_generation;
+    m_completion->post([conn, generation, ev] {
+        // 连接在处理期间已被关闭，且文件描述符被新连接复用
+        if (conn->m_generation != generation)
+        {
+            return;
+        }
+        if (ev)
+        {
+            conn->trace(TRACE_MODFD, ev);
+            modfd(m_epollfd, conn->m_sockfd, ev);
+        }
+        else
+        {
+            conn->close_conn();
+        }
+    });
 }
\ No newline at end of file
@@ -20,7 +20,12 @@
 #include <errno.h>
 #include <sys/wait.h>
 #include <sys/uio.h>
+#include <atomic>
+#include <string>
 #include "../lock/locker.h"
+#include "../threadpool/completion_queue.h"
+#include "../threadpool/threadpool.h"
+#include "conn_trace.h"
 
 /**
  * 线程池的模板参数类
@@ -28,6 +33,9 @@
 */
 class http_conn
 {
+    // 解析器基准测试直接驱动process_read
+    friend class parser_bench;
+
 public:
     // 文件名的最大长度
     static constexpr int FILENAME_LEN = 200;
@@ -65,7 +73,8 @@ public:
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
         INTERNAL_ERROR,
-        CLOSED_CONNECTION
+        CLOSED_CONNECTION,
+        MEMORY_REQUEST // 应答正文在内存中(m_body)，如统计指标
     };
     // 行的读取状态
     enum LINE_STATUS
@@ -74,10 +83,32 @@ public:
         LINE_BAD,
         LINE_OPEN
     };
+    // 请求的优先级，对应线程池中的优先级通道
+    enum PRIORITY
+    {
+        PRIORITY_HIGH = 0, // 小对象、命中过的轻量请求
+        PRIORITY_LOW,      // 大文件、错误响应等代价较高的请求
+        PRIORITY_NUMBER
+    };
+    // 分类钩子，根据请求方法和URL判断请求优先级
+    typedef PRIORITY (*CLASSIFIER)(METHOD method, const char *url);
+    // 一个请求在各处理阶段的时间点，用于访问日志和统计指标中的各阶段耗时
+    enum STAMP
+    {
+        STAMP_ACCEPT = 0,     // 接受连接，只有连接上的第一个请求有
+        STAMP_READ_BEGIN,     // 读到请求的第一个字节
+        STAMP_READ_END,       // 最后一次读完，随后投入线程池
+        STAMP_PROCESS,        // 工作线程从队列中取出开始处理
+        STAMP_PARSED,         // 请求解析完毕
+        STAMP_RESPONSE,       // 文件访问完毕、应答生成完毕，交回事件循环
+        STAMP_FIRST_WRITE,    // 第一次writev成功
+        STAMP_WRITTEN,        // 应答发送完毕
+        STAMP_NUMBER
+    };
 
 public:
-    http_conn() {};
-    ~http_conn() {};
+    http_conn() : m_sockfd(-1), m_trace(NULL), m_body_type("text/plain") {};
+    ~http_conn() { delete m_trace; };
 
 public:
     // 初始化新接受的链接
@@ -95,6 +126,41 @@ public:
     {
         return &m_address;
     }
+    // 把连接的描述符、对端地址和当前URL写入buf，供看门狗等在其他线程中报告，读到的内容可能不一致
+    void describe(char *buf, int len);
+    // 连接是否打开
+    bool is_open() const
+    {
+        return m_sockfd != -1;
+    }
+    // 追加一行连接状态：描述符、对端地址、主状态机状态、处理阶段、收发字节数、空闲时间(ms)和URL
+    // 供管理接口在其他线程中调用，读到的内容可能不一致
+    void append_state(std::string &out, long long now_us);
+    // 现在的单调时钟时间(us)，与append_state的now_us对应
+    static long long now();
+    // 响应代价提示表中已使用的项数和总项数
+    static void cost_hint_usage(int &used, int &capacity);
+    // 返回处理该连接网卡队列的CPU，未知时为-1
+    int get_incoming_cpu() const
+    {
+        return m_incoming_cpu;
+    }
+    // 记录一个连接事件，未开启事件记录时直接返回
+    void trace(TRACE_EVENT event, long long arg = 0)
+    {
+        if (m_trace_threshold_us > 0)
+        {
+            trace_event(event, arg);
+        }
+    }
+    // 请求行读入后、投入线程池前由主线程调用，判断请求应进入的优先级通道
+    PRIORITY classify();
+    // 默认分类规则：非GET请求、匹配大对象前缀的路径、以往响应较大或出错的路径进入低优先级通道
+    static PRIORITY default_classifier(METHOD method, const char *url);
+    // 添加一个大对象路径前缀，如"/download/"
+    static bool add_bulk_prefix(const char *prefix);
+    // 注册连接和请求相关的统计指标，需在工作线程启动前调用
+    static void register_metrics();
 
 private:
     // 初始化连接，初始化相关参数
@@ -103,6 +169,22 @@ private:
     HTTP_CODE process_read(); // 主状态机入口
     // 填充HTTP应答
     bool process_write(HTTP_CODE ret);
+    // 在I/O线程池中访问请求的文件并生成应答
+    void process_file();
+    // 根据请求的处理结果填充应答，并交回事件循环发送
+    void process_response(HTTP_CODE read_ret);
+    // 工作线程处理结束后，由事件循环线程重新注册ev事件，ev为0时关闭连接
+    void complete(int ev);
+    // 记录当前时间点
+    void stamp(STAMP which);
+    // 请求结束时更新统计指标，并按采样规则写一条访问日志
+    void log_access();
+    // 生成统计指标的应答正文
+    HTTP_CODE do_metrics();
+    // 当前请求的URL及其长度，不在读缓冲区内时返回空串
+    const char *current_url(int &length);
+    // 把事件写入本连接的环形缓冲区，第一次使用时分配
+    void trace_event(TRACE_EVENT event, long long arg);
 
     // 以下一组函数用于被process_read调用，以分析HTTP请求
     HTTP_CODE parse_request_line(char *text);
@@ -126,13 +208,35 @@ private:
 public:
     // 所有socket上的事件都被注册到epoll内核事件表上，所以设置为静态变量
     static int m_epollfd;
-    // 统计用户数量
-    static int m_user_count;
+    // 执行stat/open/mmap等阻塞文件操作的I/O线程池，与解析请求的线程池分开设置大小；为NULL时在解析线程中执行
+    static threadpool<http_conn> *m_io_pool;
+    // 统计用户数量，主线程和工作线程都会修改
+    static std::atomic<int> m_user_count;
+    // 事件循环的完成队列，工作线程通过它把epoll操作交回事件循环线程；为NULL时直接在工作线程中操作
+    static completion_queue *m_completion;
+    // 请求分类钩子，默认为default_classifier
+    static CLASSIFIER m_classifier;
+    // 超过该大小的文件视为大对象
+    static long m_large_file_size;
+    // 返回统计指标的URL，NULL时不提供
+    static const char *m_metrics_path;
+    // 请求耗时达到该值(us)时输出连接上的事件记录，0为不记录；需在接受连接前设置
+    static long long m_trace_threshold_us;
+    // 连接socket使用边缘触发，需在接受连接前设置
+    static bool m_et;
+    // 边缘触发时一次读事件最多读取的字节数，0为读到EAGAIN或读缓冲区满
+    static int m_read_budget;
+    // 网站的根目录
+    static const char *m_doc_root;
 
 private:
     // 该HTTP连接中连接的socket文件描述符和对方的socket地址
     int m_sockfd;
     sockaddr_in m_address;
+    // 内核处理该连接接收队列的CPU(SO_INCOMING_CPU)
+    int m_incoming_cpu;
+    // 连接的代数，每次接受新连接时加一，用于丢弃投递给已关闭连接的完成任务
+    unsigned int m_generation;
 
     // 读缓冲区
     char m_read_buf[READ_BUFFER_SIZE];
@@ -163,11 +267,28 @@ private:
     int m_content_length;
     // HTTP请求是否要求保持连接
     bool m_linger;
+    // 当前请求的优先级
+    PRIORITY m_priority;
+    // 当前请求各阶段的时间点(us)，0表示尚未到达
+    long long m_stamps[STAMP_NUMBER];
+    // 应答的状态码和总字节数
+    int m_status;
+    long long m_response_bytes;
+    // 连接上累计收发的字节数和最近一次收发数据的时间(us)
+    long long m_bytes_read;
+    long long m_bytes_written;
+    long long m_last_active;
 
     // 客户请求的目标文件被mmap到内存中的起始位置
     char *m_file_address;
     // 目标文件的状态
     struct stat m_file_stat;
+    // 连接上最近的事件，开启事件记录后才分配
+    conn_trace *m_trace;
+    // 内存中的应答正文，发送完后释放
+    std::string m_body;
+    // 内存中应答正文的Content-Type
+    const char *m_body_type;
     // 采用writev来执行写操作
     struct iovec m_iv[2];
     int m_iv_count;
@@ -4,6 +4,7 @@
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
+#include <time.h>
 
 /**
  * 封装信号量的类
@@ -51,6 +52,24 @@ public:
         return sem_wait(&m_sem) == 0;
     }
 
+    /**
+     * 等待信号量，最多等待ms毫秒
+     * 超时或被信号中断返回false
+    */
+    bool timedwait(int ms)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += ms / 1000;
+        t.tv_nsec += (long)(ms % 1000) * 1000000;
+        if (t.tv_nsec >= 1000000000)
+        {
+            t.tv_sec++;
+            t.tv_nsec -= 1000000000;
+        }
+        return sem_timedwait(&m_sem, &t) == 0;
+    }
+
     /**
      * 增加信号量
      * 信号量的值加一
@@ -105,11 +124,11 @@ public:
 
 /**
  * 封装条件变量类
+ * 等待时使用调用者已经持有的互斥锁，与检查条件时用的是同一把锁，唤醒不会丢失
 */
 class cond
 {
 private:
-    pthread_mutex_t m_mutex;
     pthread_cond_t m_cond;
 
 public:
@@ -118,41 +137,41 @@ public:
     */
     cond()
     {
-        if (pthread_mutex_init(&m_mutex, NULL) != 0)
-        {
-            throw std::exception();
-        }
         if (pthread_cond_init(&m_cond, NULL) != 0)
         {
-            // 构造函数出现问题，立即释放已经成功分配的资源
-            pthread_mutex_destroy(&m_mutex);
             throw std::exception();
         }
     }
     ~cond()
     {
-    pthread_mutex_destroy(&m_mutex);
-    pthread_cond_destroy(&m_cond);
+        pthread_cond_destroy(&m_cond);
     }
 
-    // 等待条件变量
-    bool wait()
+    // 等待条件变量，调用前需持有m_mutex，返回时仍持有
+    bool wait(pthread_mutex_t *m_mutex)
     {
-        int res = 0;
-        pthread_mutex_lock(&m_mutex);
-        res = pthread_cond_wait(&m_cond, &m_mutex);
-        pthread_mutex_unlock(&m_mutex);
-        return res == 0;
+        return pthread_cond_wait(&m_cond, m_mutex) == 0;
     }
+    // 等待到绝对时间t(CLOCK_REALTIME)为止，调用前需持有m_mutex，超时返回false
     bool timewait(pthread_mutex_t *m_mutex, struct timespec t)
     {
-        int ret = 0;
-        pthread_mutex_lock(m_mutex);
-        ret = pthread_cond_timedwait(&m_cond, m_mutex, &t);
-        pthread_mutex_unlock(m_mutex);
-        return ret == 0;
+        return pthread_cond_timedwait(&m_cond, m_mutex, &t) == 0;
+    }
+    // 等待ms毫秒，调用前需持有m_mutex，超时返回false
+    bool timewait(pthread_mutex_t *m_mutex, int ms)
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += ms / 1000;
+        t.tv_nsec += (long)(ms % 1000) * 1000000;
+        if (t.tv_nsec >= 1000000000)
+        {
+            t.tv_sec++;
+            t.tv_nsec -= 1000000000;
+        }
+        return timewait(m_mutex, t);
     }
-    // 唤醒等待条件变量的线程
+    // 唤醒一个等待条件变量的线程
     bool signal()
     {
         return pthread_cond_signal(&m_cond) == 0;
@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "access_log.h"
+#include "log.h"
+
+int access_log::m_format = ACCESS_FORMAT_JSON;
+int access_log::m_sample_every = 1;
+long long access_log::m_slow_us = 0;
+
+//一条访问日志的最大长度
+static const int ACCESS_LINE_SIZE = 1024;
+
+static const char *stage_names[ACCESS_STAGE_NUMBER] = {"read_us", "queue_us", "parse_us", "file_us", "write_us"};
+
+//每个线程各自计数，采样时不需要同步
+static thread_local unsigned int sample_counter = 0;
+
+//把路径写成JSON字符串的内容，转义引号、反斜杠和控制字符，返回写入的长度
+static int json_escape(char *out, int size, const char *s)
+{
+    int n = 0;
+    for (; *s && n < size - 7; s++)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+        {
+            out[n++] = '\\';
+            out[n++] = c;
+        }
+        else if (c < 0x20)
+        {
+            n += snprintf(out + n, size - n, "\\u%04x", c);
+        }
+        else
+        {
+            out[n++] = c;
+        }
+    }
+    out[n] = '\0';
+    return n;
+}
+
+void access_log::configure(int format, int sample_every, int slow_ms)
+{
+    m_format = format;
+    m_sample_every = sample_every;
+    m_slow_us = (long long)slow_ms * 1000;
+}
+
+bool access_log::should_log(int status, long long total_us)
+{
+    if (status >= 400 || (m_slow_us > 0 && total_us >= m_slow_us))
+    {
+        return true;
+    }
+    if (m_sample_every <= 0)
+    {
+        return false;
+    }
+    return ++sample_counter % (unsigned int)m_sample_every == 0;
+}
+
+void access_log::write(const access_record &rec)
+{
+    char line[ACCESS_LINE_SIZE];
+    char client[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &rec.client.sin_addr, client, sizeof(client));
+    const char *path = rec.path ? rec.path : "-";
+    int n = 0;
+
+    if (m_format == ACCESS_FORMAT_CLF)
+    {
+        char date[40];
+        struct tm my_tm;
+        time_t t = rec.end.tv_sec;
+        localtime_r(&t, &my_tm);
+        strftime(date, sizeof(date), "%d/%b/%Y:%H:%M:%S %z", &my_tm);
+        n = snprintf(line, sizeof(line), "%s - - [%s] \"%s %.512s\" %d %lld",
+                     client, date, rec.method, path, rec.status, rec.bytes);
+        for (int i = 0; i < ACCESS_STAGE_NUMBER && n < ACCESS_LINE_SIZE; i++)
+        {
+            n += snprintf(line + n, sizeof(line) - n, " %lld", rec.stage_us[i]);
+        }
+        if (n < ACCESS_LINE_SIZE)
+        {
+            n += snprintf(line + n, sizeof(line) - n, " %lld\n", rec.total_us);
+        }
+    }
+    else
+    {
+        char escaped[600];
+        json_escape(escaped, sizeof(escaped), path);
+        n = snprintf(line, sizeof(line),
+                     "{\"ts\":%ld.%06ld,\"client\":\"%s:%d\",\"method\":\"%s\",\"path\":\"%s\",\"status\":%d,\"bytes\":%lld",
+                     (long)rec.end.tv_sec, (long)rec.end.tv_usec, client, ntohs(rec.client.sin_port),
+                     rec.method, escaped, rec.status, rec.bytes);
+        for (int i = 0; i < ACCESS_STAGE_NUMBER && n < ACCESS_LINE_SIZE; i++)
+        {
+            n += snprintf(line + n, sizeof(line) - n, ",\"%s\":%lld", stage_names[i], rec.stage_us[i]);
+        }
+        if (n < ACCESS_LINE_SIZE)
+        {
+            n += snprintf(line + n, sizeof(line) - n, ",\"total_us\":%lld}\n", rec.total_us);
+        }
+    }
+
+    //被截断的记录仍以换行结尾
+    if (n >= ACCESS_LINE_SIZE)
+    {
+        n = ACCESS_LINE_SIZE - 1;
+        line[n - 1] = '\n';
+    }
+    Log::get_instance()->write_access(line, n);
+}
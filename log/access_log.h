@@ -0,0 +1,61 @@
+#ifndef _ACCESS_LOG_H_
+#define _ACCESS_LOG_H_
+/*************************************************************
+*访问日志：每个请求一条紧凑的记录，包括客户端、方法、路径、状态码、字节数和各阶段耗时
+*经由异步日志写入单独的访问日志文件，格式为每行一个JSON对象或CLF加上各阶段耗时
+*按比例采样，出错和慢请求总是记录
+**************************************************************/
+
+#include <sys/time.h>
+#include <netinet/in.h>
+
+//记录的各阶段耗时
+enum ACCESS_STAGE
+{
+    ACCESS_STAGE_READ = 0, //从读到请求的第一个字节到读完
+    ACCESS_STAGE_QUEUE,    //在线程池中排队
+    ACCESS_STAGE_PARSE,    //解析请求
+    ACCESS_STAGE_FILE,     //访问文件并生成应答，包括在I/O线程池中排队
+    ACCESS_STAGE_WRITE,    //交回事件循环到发送完毕
+    ACCESS_STAGE_NUMBER
+};
+
+//访问日志的格式
+enum ACCESS_FORMAT
+{
+    ACCESS_FORMAT_JSON = 0, //每行一个JSON对象
+    ACCESS_FORMAT_CLF       //Common Log Format，行尾追加各阶段耗时
+};
+
+struct access_record
+{
+    struct timeval end;       //请求结束的时间
+    struct sockaddr_in client;
+    const char *method;
+    const char *path;         //为NULL时记为"-"
+    int status;
+    long long bytes;          //应答的字节数
+    long long total_us;       //从读到请求的第一个字节到发送完毕
+    long long stage_us[ACCESS_STAGE_NUMBER];
+};
+
+class access_log
+{
+public:
+    //format为ACCESS_FORMAT；每sample_every个正常请求记录一条，0表示不记录正常请求；
+    //状态码不小于400或耗时不少于slow_ms毫秒的请求总是记录
+    static void configure(int format, int sample_every, int slow_ms);
+
+    //按采样规则判断这个请求是否需要记录
+    static bool should_log(int status, long long total_us);
+
+    //格式化一条记录并写入访问日志
+    static void write(const access_record &rec);
+
+private:
+    static int m_format;
+    static int m_sample_every;
+    static long long m_slow_us;
+};
+
+#endif
@@ -1,8 +1,10 @@
 #ifndef _BLOCK_QUEUE_H_
 #define _BLOCK_QUEUE_H_
 /*************************************************************
-*循环数组实现的阻塞队列，m_back = (m_back + 1) % m_max_size;  
+*循环数组实现的阻塞队列，m_back = (m_back + 1) % m_max_size;
 *线程安全，每个操作前都要先加互斥锁，操作完后，再解锁
+*等待条件变量时使用同一把互斥锁，每放入一个元素只唤醒一个等待者
+*无锁的多生产者版本见mpsc_queue.h
 **************************************************************/
 
 #include <iostream>
@@ -15,9 +17,11 @@ template <typename T>
 class block_queue
 {
 private:
-    locker *m_mutex;     // 封装的互斥锁
-    cond *m_cond;        // 封装的条件变量
-    
+    locker m_mutex;     // 封装的互斥锁
+    cond m_cond;        // 队列非空时通知消费者
+    int m_waiters;      // 正在等待的消费者数，没有等待者时push不需要唤醒
+    bool m_closed;      // 关闭后pop不再等待
+
     T *m_array;         // 循环数组实现阻塞队列
     int m_size;         // 队列的长度
     int m_max_size;     // 队列的最大长度
@@ -39,171 +43,171 @@ public:
         m_size = 0;
         m_front = -1;
         m_back = -1;
-
-        // 创建互斥锁和条件变量
-        m_mutex = new locker();
-        m_cond = new cond();
+        m_waiters = 0;
+        m_closed = false;
     }
 
+    block_queue(const block_queue &) = delete;
+    block_queue &operator=(const block_queue &) = delete;
+
     // 清空队列
     void clear()
     {
-        m_mutex->lock();
+        m_mutex.lock();
         m_size = 0;
         m_front = -1;
         m_back = -1;
-        m_mutex->unlock();
+        m_mutex.unlock();
     }
 
     // 析构函数，释放资源
     ~block_queue()
     {
-        m_mutex->lock();
-        if (m_array) delete[] m_array;
-        m_mutex->unlock();
+        delete[] m_array;
+    }
+
+    // 关闭队列，唤醒所有等待的消费者，之后pop在队列为空时立即返回false
+    void close()
+    {
+        m_mutex.lock();
+        m_closed = true;
+        m_cond.broadcast();
+        m_mutex.unlock();
     }
 
     // 判断队列是否满了
     bool full()
     {
-        m_mutex->lock();
-        if (m_size >= m_max_size)
-        {
-            m_mutex->unlock();
-            return true;
-        }
-        m_mutex->unlock();
-        return false;
+        m_mutex.lock();
+        bool ret = m_size >= m_max_size;
+        m_mutex.unlock();
+        return ret;
     }
 
     //返回队首元素
-    bool front(T &value) 
+    bool front(T &value)
     {
-        m_mutex->lock();
+        m_mutex.lock();
         if (0 == m_size)
         {
-            m_mutex->unlock();
+            m_mutex.unlock();
             return false;
         }
-        value = m_array[m_front];
-        m_mutex->unlock();
+        value = m_array[(m_front + 1) % m_max_size];
+        m_mutex.unlock();
         return true;
     }
     //返回队尾元素
-    bool back(T &value) 
+    bool back(T &value)
     {
-        m_mutex->lock();
+        m_mutex.lock();
         if (0 == m_size)
         {
-            m_mutex->unlock();
+            m_mutex.unlock();
             return false;
         }
         value = m_array[m_back];
-        m_mutex->unlock();
+        m_mutex.unlock();
         return true;
     }
 
-    int size() 
+    int size()
     {
-        int tmp = 0;
-
-        m_mutex->lock();
-        tmp = m_size;
-
-        m_mutex->unlock();
+        m_mutex.lock();
+        int tmp = m_size;
+        m_mutex.unlock();
         return tmp;
     }
 
     int max_size()
     {
-        int tmp = 0;
-
-        m_mutex->lock();
-        tmp = m_max_size;
-
-        m_mutex->unlock();
-        return tmp;
+        return m_max_size;
     }
 
-    //往队列添加元素，需要将所有使用队列的线程先唤醒
-    //当有元素push进队列,相当于生产者生产了一个元素
-    //若当前没有线程等待条件变量,则唤醒无意义
+    //往队列添加元素，队列已满时返回false
+    //一个元素只能被一个消费者取走，所以只唤醒一个等待者，且只在有等待者时唤醒
     bool push(const T &item)
     {
-
-        m_mutex->lock();
+        m_mutex.lock();
         if (m_size >= m_max_size)
         {
-
-            m_cond->broadcast();
-            m_mutex->unlock();
+            m_mutex.unlock();
             return false;
         }
 
         m_back = (m_back + 1) % m_max_size;
         m_array[m_back] = item;
-
         m_size++;
 
-        m_cond->broadcast();
-        m_mutex->unlock();
+        if (m_waiters > 0)
+        {
+            m_cond.signal();
+        }
+        m_mutex.unlock();
         return true;
     }
+
     //pop时,如果当前队列没有元素,将会等待条件变量
     bool pop(T &item)
     {
-
-        m_mutex->lock();
+        m_mutex.lock();
         while (m_size <= 0)
         {
-            
-            if ( !m_cond->wait() )
+            if (m_closed)
             {
-                m_mutex->unlock();
+                m_mutex.unlock();
                 return false;
             }
+            m_waiters++;
+            m_cond.wait(m_mutex.get());
+            m_waiters--;
         }
 
         m_front = (m_front + 1) % m_max_size;
         item = m_array[m_front];
         m_size--;
-        m_mutex->unlock();
+        m_mutex.unlock();
         return true;
     }
 
-    //增加了超时处理
+    //增加了超时处理，最多等待ms_timeout毫秒
     bool pop(T &item, int ms_timeout)
     {
+        //计算绝对超时时间，虚假唤醒后继续等待到同一时刻
         struct timespec t = {0, 0};
-        struct timeval now = {0, 0};
-        gettimeofday(&now, NULL);
-        m_mutex->lock();
-        if (m_size <= 0)
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += ms_timeout / 1000;
+        t.tv_nsec += (long)(ms_timeout % 1000) * 1000000;
+        if (t.tv_nsec >= 1000000000)
         {
-            t.tv_sec = now.tv_sec + ms_timeout / 1000;
-            t.tv_nsec = (ms_timeout % 1000) * 1000;
-            if (!m_cond->timewait(m_mutex->get(), t))
-            {
-                m_mutex->unlock();
-                return false;
-            }
+            t.tv_sec++;
+            t.tv_nsec -= 1000000000;
         }
 
-        if (m_size <= 0)
+        m_mutex.lock();
+        while (m_size <= 0)
         {
-            m_mutex->unlock();
-            return false;
+            if (m_closed)
+            {
+                m_mutex.unlock();
+                return false;
+            }
+            m_waiters++;
+            bool signaled = m_cond.timewait(m_mutex.get(), t);
+            m_waiters--;
+            if (!signaled && m_size <= 0)
+            {
+                m_mutex.unlock();
+                return false;
+            }
         }
 
         m_front = (m_front + 1) % m_max_size;
         item = m_array[m_front];
         m_size--;
-        m_mutex->unlock();
+        m_mutex.unlock();
         return true;
     }
 };
 
-
-
-
-#endif
\ No newline at end of file
+#endif
@@ -5,184 +5,718 @@
 #include <stdarg.h>
 #include "log.h"
 #include <pthread.h>
+
+//后台写线程在没有被唤醒时，最多每隔WRITER_INTERVAL毫秒取一次日志
+static const int WRITER_INTERVAL = 100;
+//后台写线程批量缓冲区的最小大小
+static const size_t MIN_BATCH_SIZE = 4 * 1024 * 1024;
+//每个线程缓冲区的最小大小
+static const size_t MIN_RING_SIZE = 64 * 1024;
+//同步模式下缓冲日志的大小
+static const size_t SYNC_BATCH_SIZE = 64 * 1024;
+//LOG_OVERFLOW_BLOCK策略下等待后台写线程腾出空间的间隔(ns)
+static const long BLOCK_WAIT_NS = 50 * 1000;
+//后台写线程每隔OVERFLOW_REPORT_INTERVAL毫秒，在有日志被丢弃时写一条统计
+static const long long OVERFLOW_REPORT_INTERVAL = 1000;
+//延迟格式化模式下最多可登记的格式串数
+static const int MAX_FORMATS = 4096;
+
+//每个线程私有的日志状态，写日志的路径上只访问这里的数据，不需要加锁
+struct thread_log_state
+{
+    log_ring *rings[LOG_CHANNEL_NUMBER]; //异步模式下本线程在各个通道上的缓冲区，线程退出时交给后台写线程回收
+    char *line;          //格式化一行日志或组装一条记录用的缓冲区
+    char *text;          //缓冲区满、退回同步写时还原文本用的缓冲区
+    time_t cached_sec;   //date对应的秒数
+    char date[32];       //缓存的"年-月-日 时:分:秒"，每秒只调用一次localtime_r
+
+    ~thread_log_state()
+    {
+        for (int i = 0; i < LOG_CHANNEL_NUMBER; i++)
+        {
+            if (rings[i])
+            {
+                rings[i]->close();
+            }
+        }
+        delete[] line;
+        delete[] text;
+    }
+};
+
+static thread_local thread_log_state tls_state = {{NULL}, NULL, NULL, -1, {0}};
+
+static long long to_ms(const struct timeval &tv)
+{
+    return (long long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+//把"路径/文件名"拆成路径(带结尾的/，没有时为空)和文件名
+static void split_path(const char *file_name, char *dir_name, size_t dir_size, char *log_name, size_t name_size)
+{
+    //从后往前找到日志文件名第一个/的位置
+    const char *p = strrchr(file_name, '/');
+    dir_name[0] = '\0';
+    if (p == NULL)
+    {
+        snprintf(log_name, name_size, "%s", file_name);
+    }
+    else
+    {
+        //p - file_name + 1是文件所在路径文件夹的长度，dirname相当于./
+        snprintf(log_name, name_size, "%s", p + 1);
+        snprintf(dir_name, dir_size, "%.*s", (int)(p - file_name + 1), file_name);
+    }
+}
+
 Log::Log()
 {
-    m_count = 0;
+    m_log_buf_size = 0;
     m_is_async = false;
+    m_access_enabled = false;
+    m_overflow = LOG_OVERFLOW_SYNC;
+    m_dropped = 0;
+    m_sync_writes = 0;
+    m_blocked = 0;
+    m_reported_dropped = 0;
+    m_reported_sync_writes = 0;
+    m_reported_blocked = 0;
+    m_last_report = 0;
+    m_batch = NULL;
+    m_batch_size = 0;
+    m_ring_size = 0;
+    m_stop = false;
+    m_is_deferred = false;
+    m_staging = NULL;
+    m_formats = NULL;
+    m_format_count = 0;
+    m_level = LOG_LEVEL_DEBUG;
+    m_flush_interval = 0;
+    m_flush_size = 0;
+    m_flush_on_error = true;
+    m_last_flush = 0;
+    m_unflushed = 0;
 }
 
 Log::~Log()
 {
-    if (m_fp != NULL)
+    //通知后台写线程取完剩余的日志后退出
+    if (m_is_async)
     {
-        fclose(m_fp);
+        m_stop = true;
+        m_writer_sem.post();
+        pthread_join(m_writer, NULL);
     }
+    else if (m_unflushed > 0)
+    {
+        write_batch(m_batch, m_unflushed);
+    }
+    m_file.close();
+    m_access_file.close();
+    for (size_t i = 0; i < m_rings.size(); i++)
+    {
+        delete m_rings[i].ring;
+    }
+    delete[] m_batch;
+    delete[] m_staging;
+    delete[] m_formats;
 }
 
-//异步需要设置阻塞队列的长度，同步不需要设置
-bool Log::init(const char *file_name, int log_buf_size, int split_lines, int max_queue_size)
+//异步需要设置缓冲区的长度，同步不需要设置
+bool Log::init(const char *file_name, int log_buf_size, long long split_size, int max_queue_size, bool deferred)
 {
+    //输出内容的长度
+    m_log_buf_size = log_buf_size;
+
+    char dir_name[128];
+    char log_name[128];
+    split_path(file_name, dir_name, sizeof(dir_name), log_name, sizeof(log_name));
+
+    //日志文件名为 路径 + 年_月_日_ + 文件名，超过split_size字节后加后缀
+    if (!m_file.open(dir_name, log_name, split_size))
+    {
+        return false;
+    }
+
     //如果设置了max_queue_size,则设置为异步
     if (max_queue_size >= 1)
     {
+        //每个线程的缓冲区至少能放下max_queue_size条最长的日志
+        m_ring_size = (size_t)max_queue_size * (m_log_buf_size + sizeof(log_record));
+        if (m_ring_size < MIN_RING_SIZE)
+        {
+            m_ring_size = MIN_RING_SIZE;
+        }
+        //普通异步模式下后台写线程直接用writev写出线程缓冲区中的数据，不需要批量缓冲区
+        //延迟格式化时，后台写线程先把记录取到m_staging中，再逐条还原成文本放入m_batch
+        if (deferred)
+        {
+            m_batch_size = MIN_BATCH_SIZE;
+            m_batch = new char[m_batch_size];
+            m_staging = new char[m_ring_size];
+            m_formats = new const char *[MAX_FORMATS];
+            m_is_deferred = true;
+        }
+
         //设置写入方式flag为异步输入
         m_is_async = true;
-
-        //创建并设置阻塞队列长度
-        m_log_queue = new block_queue<std::string>(max_queue_size);
-        pthread_t tid;
         //flush_log_thread为回调函数,这里表示创建线程异步写日志
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
+        if (pthread_create(&m_writer, NULL, flush_log_thread, NULL) != 0)
+        {
+            m_is_async = false;
+            return false;
+        }
+        return true;
     }
-    //输出内容的长度
-    m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', m_log_buf_size);
 
-    //日志的最大行数
-    m_split_lines = split_lines;
+    //同步模式下日志先缓冲在m_batch中，按刷新策略写入文件
+    m_batch_size = SYNC_BATCH_SIZE > (size_t)m_log_buf_size ? SYNC_BATCH_SIZE : (size_t)m_log_buf_size;
+    m_batch = new char[m_batch_size];
+    return true;
+}
 
-    // 获取系统时间
-    time_t t = time(NULL);
-    // struct tm结构体定义在time.h中
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
+int Log::format_prefix(char *buf, int level, const struct timeval &now)
+{
+    static const char *prefixes[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+    const char *s = (level >= 0 && level <= 3) ? prefixes[level] : "[info]:";
 
-    //从后往前找到日志文件名第一个/的位置
-    const char *p = strrchr(file_name, '/');
-    char log_full_name[256] = {0};
+    //同一秒内的日志复用已经格式化好的日期，localtime_r在glibc中需要加锁
+    thread_log_state &state = tls_state;
+    if (state.cached_sec != now.tv_sec)
+    {
+        struct tm my_tm;
+        time_t t = now.tv_sec;
+        localtime_r(&t, &my_tm);
+        snprintf(state.date, sizeof(state.date), "%d-%02d-%02d %02d:%02d:%02d",
+                 my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
+                 my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec);
+        state.cached_sec = now.tv_sec;
+    }
 
-    //相当于自定义日志名
-    //若输入的文件名没有/，则直接将时间+文件名作为日志名
-    if (p == NULL)
+    //写入的具体时间内容格式：时间 + 内容
+    //时间格式化，snprintf成功返回写字符的总数，其中不包括结尾的null字符
+    return snprintf(buf, 48, "%s.%06ld %s ", state.date, (long)now.tv_usec, s);
+}
+
+int Log::format_line(char *buf, int size, int level, const struct timeval &now, const char *format, va_list valst)
+{
+    int n = format_prefix(buf, level, now);
+    //内容格式化，用于向字符串中打印数据、数据格式用户自定义，
+    // 返回写入到字符数组str中的字符个数(不包含终止符)，超出缓冲区的部分被截断，并为换行符预留位置
+    int m = vsnprintf(buf + n, size - n - 1, format, valst);
+    if (m < 0)
     {
-        snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, file_name);
+        m = 0;
     }
-    else
+    else if (m > size - n - 2)
     {
-        //将/的位置向后移动一个位置，然后复制到logname中
-        //p - file_name + 1是文件所在路径文件夹的长度
-        //dirname相当于./
-        strcpy(log_name, p + 1);
-        strncpy(dir_name, file_name, p - file_name + 1);
+        m = size - n - 2;
+    }
+    buf[n + m] = '\n';
+    buf[n + m + 1] = '\0';
+    return n + m + 1;
+}
 
-        //后面的参数跟format有关
-        snprintf(log_full_name, 255, "%s%d_%02d_%02d_%s", dir_name, my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, log_name);
+int Log::render_record(char *buf, const log_record &rec, const char *args, const char *args_end)
+{
+    struct timeval now;
+    now.tv_sec = rec.sec;
+    now.tv_usec = rec.usec;
+    int n = format_prefix(buf, rec.level, now);
+    //与format_line相同，为换行符预留位置
+    //格式串在记录写入线程缓冲区之前登记，经由线程缓冲区的release/acquire对后台写线程可见
+    const char *format = rec.fmt_id < (uint32_t)MAX_FORMATS ? m_formats[rec.fmt_id] : "";
+    int m = format_deferred(buf + n, m_log_buf_size - n - 1, format, args, args_end);
+    buf[n + m] = '\n';
+    buf[n + m + 1] = '\0';
+    return n + m + 1;
+}
+
+int Log::register_format(const char *format)
+{
+    int id = -1;
+    m_ring_mutex.lock();
+    if (m_formats && m_format_count < MAX_FORMATS)
+    {
+        id = m_format_count;
+        m_formats[m_format_count++] = format;
     }
+    m_ring_mutex.unlock();
+    return id;
+}
 
-    m_today = my_tm.tm_mday;
+char *Log::thread_record_buffer()
+{
+    thread_log_state &state = tls_state;
+    if (!state.line)
+    {
+        state.line = new char[m_log_buf_size + sizeof(log_record)];
+    }
+    return state.line;
+}
 
-    m_fp = fopen(log_full_name, "a");
-    if (m_fp == NULL)
+log_ring *Log::thread_ring(int channel)
+{
+    thread_log_state &state = tls_state;
+    if (!state.rings[channel])
     {
-        return false;
+        state.rings[channel] = new log_ring(m_ring_size);
+        ring_slot slot = {state.rings[channel], channel, 0, false};
+        m_ring_mutex.lock();
+        m_rings.push_back(slot);
+        m_ring_mutex.unlock();
     }
+    return state.rings[channel];
+}
 
+bool Log::init_access(const char *file_name, long long split_size)
+{
+    char dir_name[128];
+    char log_name[128];
+    split_path(file_name, dir_name, sizeof(dir_name), log_name, sizeof(log_name));
+    if (!m_access_file.open(dir_name, log_name, split_size))
+    {
+        return false;
+    }
+    m_access_enabled = true;
     return true;
 }
 
+void Log::write_access(const char *data, size_t len)
+{
+    if (!m_access_enabled)
+    {
+        return;
+    }
+    //访问日志按INFO级别参与溢出策略
+    if (m_is_async && push_ring(thread_ring(LOG_CHANNEL_ACCESS), data, len, LOG_LEVEL_INFO))
+    {
+        return;
+    }
+    //同步模式或按溢出策略退回到同步写，直接写入文件
+    m_mutex.lock();
+    m_access_file.write(data, len);
+    m_mutex.unlock();
+}
+
 void Log::write_log(int level, const char *format, ...)
 {
     struct timeval now = {0, 0};
     gettimeofday(&now, NULL);
-    time_t t = now.tv_sec;
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
-    char s[16] = {0};
-    // 日志分级
-    switch (level)
-    {
-    case 0:
-        strcpy(s, "[debug]:");
-        break;
-    case 1:
-        strcpy(s, "[info]:");
-        break;
-    case 2:
-        strcpy(s, "[warn]:");
-        break;
-    case 3:
-        strcpy(s, "[erro]:");
-        break;
-    default:
-        strcpy(s, "[info]:");
-        break;
-    }
-    //写入一个log，对m_count++, m_split_lines最大行数
+
+    va_list valst;
+    //将传入的format参数赋值给valst，便于格式化输出
+    va_start(valst, format);
+
+    //若m_is_async为true表示异步，默认为同步
+    //若异步,则在本线程的缓冲区中格式化后写入本线程的环形缓冲区，全程不加锁
+    if (m_is_async)
+    {
+        char *buf = thread_record_buffer();
+        //延迟格式化模式下缓冲区中的每条记录都带有头部，已格式化的文本作为LOG_RECORD_TEXT记录
+        size_t header = m_is_deferred ? sizeof(log_record) : 0;
+        int len = format_line(buf + header, m_log_buf_size, level, now, format, valst);
+        va_end(valst);
+
+        if (m_is_deferred)
+        {
+            log_record rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.len = (uint32_t)(header + len);
+            rec.type = LOG_RECORD_TEXT;
+            rec.level = (uint16_t)level;
+            memcpy(buf, &rec, sizeof(rec));
+        }
+        push_record(buf, header + len, level);
+        return;
+    }
+
+    //同步模式，加锁后直接格式化到m_batch中，放不下一条最长的日志时先写出
     m_mutex.lock();
-    m_count++;  // 现有行数
-
-    //日志不是今天或写入的日志行数是最大行的倍数
-    //m_split_lines为最大行数
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) //everyday log
-    {
-        
-        char new_log[256] = {0};
-        fflush(m_fp);
-        fclose(m_fp);
-        char tail[16] = {0};
-       
-        //格式化日志名中的时间部分
-        snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-
-        //如果是时间不是今天,则创建今天的日志，更新m_today和m_count
-        if (m_today != my_tm.tm_mday)
+    if (m_batch_size - m_unflushed < (size_t)m_log_buf_size)
+    {
+        write_batch(m_batch, m_unflushed);
+        m_unflushed = 0;
+    }
+    m_unflushed += format_line(m_batch + m_unflushed, m_log_buf_size, level, now, format, valst);
+    flush_if_needed(m_flush_on_error && level >= LOG_LEVEL_ERROR, now);
+    m_mutex.unlock();
+
+    va_end(valst);
+}
+
+bool Log::push_ring(log_ring *ring, const char *data, size_t len, int level)
+{
+    int policy = m_overflow.load(std::memory_order_relaxed);
+    //按级别分档：DEBUG只能用缓冲区的一半，INFO四分之三，WARN全部，ERROR在缓冲区满时同步写
+    if (policy == LOG_OVERFLOW_DROP_LEVEL && level < LOG_LEVEL_WARN &&
+        ring->size() + len > ring->capacity() / 4 * (level + 2))
+    {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        m_writer_sem.post();
+        return true;
+    }
+
+    bool blocked = false;
+    for (;;)
+    {
+        size_t used = 0;
+        if (ring->push(data, len, &used))
         {
-            snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
-            m_today = my_tm.tm_mday;
-            m_count = 0;
+            //ERROR级别的日志立即唤醒后台写线程写出并刷新
+            //缓冲区用量刚刚超过一半时提前唤醒后台写线程，其余情况等待定时唤醒
+            size_t half = ring->capacity() / 2;
+            if ((m_flush_on_error && level >= LOG_LEVEL_ERROR) || (used >= half && used - len < half))
+            {
+                m_writer_sem.post();
+            }
+            return true;
         }
-        else
+
+        m_writer_sem.post();
+        switch (policy)
         {
-            //超过了最大行，在之前的日志名基础上加后缀, m_count/m_split_lines
-            snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
+        case LOG_OVERFLOW_BLOCK:
+            //后台写线程已经退出时不再等待
+            if (m_stop.load(std::memory_order_relaxed))
+            {
+                break;
+            }
+            if (!blocked)
+            {
+                blocked = true;
+                m_blocked.fetch_add(1, std::memory_order_relaxed);
+            }
+            {
+                struct timespec t = {0, BLOCK_WAIT_NS};
+                nanosleep(&t, NULL);
+            }
+            continue;
+        case LOG_OVERFLOW_DROP_NEWEST:
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        case LOG_OVERFLOW_DROP_LEVEL:
+            if (level < LOG_LEVEL_ERROR)
+            {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            break;
+        default:
+            break;
         }
-        m_fp = fopen(new_log, "a");
+        m_sync_writes.fetch_add(1, std::memory_order_relaxed);
+        return false;
     }
- 
+}
+
+void Log::push_record(const char *data, size_t len, int level)
+{
+    if (push_ring(thread_ring(LOG_CHANNEL_MAIN), data, len, level))
+    {
+        return;
+    }
+
+    //按溢出策略退回到同步写
+    if (!m_is_deferred)
+    {
+        m_mutex.lock();
+        write_batch(data, len);
+        m_mutex.unlock();
+        return;
+    }
+
+    thread_log_state &state = tls_state;
+    if (!state.text)
+    {
+        state.text = new char[m_log_buf_size];
+    }
+    log_record rec;
+    memcpy(&rec, data, sizeof(rec));
+    const char *payload = data + sizeof(log_record);
+    int text_len = 0;
+    if (rec.type == LOG_RECORD_TEXT)
+    {
+        m_mutex.lock();
+        write_batch(payload, len - sizeof(log_record));
+        m_mutex.unlock();
+        return;
+    }
+    text_len = render_record(state.text, rec, payload, data + len);
+    m_mutex.lock();
+    write_batch(state.text, text_len);
     m_mutex.unlock();
+}
 
-    va_list valst;
-    //将传入的format参数赋值给valst，便于格式化输出
-    va_start(valst, format);
+void Log::write_batch(const char *data, size_t len)
+{
+    m_file.write(data, len);
+}
 
-    std::string log_str;
+void Log::flush_if_needed(bool force, const struct timeval &now)
+{
+    long long now_ms = to_ms(now);
+    if (m_unflushed > 0 &&
+        (force ||
+         (m_flush_size > 0 && m_unflushed >= (size_t)m_flush_size) ||
+         (m_flush_interval >= 0 && now_ms - m_last_flush >= m_flush_interval)))
+    {
+        write_batch(m_batch, m_unflushed);
+        m_unflushed = 0;
+        m_last_flush = now_ms;
+    }
+    m_file.sync(now_ms);
+}
+
+void Log::set_flush_policy(int interval_ms, int size, bool on_error)
+{
     m_mutex.lock();
+    m_flush_interval = interval_ms;
+    m_flush_size = size;
+    m_flush_on_error = on_error;
+    m_mutex.unlock();
+}
 
-    //写入的具体时间内容格式：时间 + 内容
-    //时间格式化，snprintf成功返回写字符的总数，其中不包括结尾的null字符
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-    //内容格式化，用于向字符串中打印数据、数据格式用户自定义，
-    // 返回写入到字符数组str中的字符个数(不包含终止符)
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
+void Log::set_fsync_policy(int policy, int interval_ms)
+{
+    m_mutex.lock();
+    m_file.set_fsync_policy(policy, interval_ms);
+    m_access_file.set_fsync_policy(policy, interval_ms);
+    m_mutex.unlock();
+}
+
+void Log::set_overflow_policy(int policy)
+{
+    m_overflow.store(policy, std::memory_order_relaxed);
+}
+
+int Log::format_overflow_report(char *buf, int size, const struct timeval &now)
+{
+    //退出前的最后一次总是检查
+    long long now_ms = to_ms(now);
+    if (!m_stop.load() && now_ms - m_last_report < OVERFLOW_REPORT_INTERVAL)
+    {
+        return 0;
+    }
+    m_last_report = now_ms;
+
+    unsigned long long dropped = m_dropped.load(std::memory_order_relaxed);
+    unsigned long long sync_writes = m_sync_writes.load(std::memory_order_relaxed);
+    unsigned long long blocked = m_blocked.load(std::memory_order_relaxed);
+    if (dropped == m_reported_dropped && sync_writes == m_reported_sync_writes && blocked == m_reported_blocked)
+    {
+        return 0;
+    }
+    int n = format_prefix(buf, LOG_LEVEL_WARN, now);
+    n += snprintf(buf + n, size - n, "log overflow: %llu lines dropped, %llu sync writes, %llu blocked writes\n",
+                  dropped - m_reported_dropped, sync_writes - m_reported_sync_writes, blocked - m_reported_blocked);
+    m_reported_dropped = dropped;
+    m_reported_sync_writes = sync_writes;
+    m_reported_blocked = blocked;
+    return n < size ? n : size - 1;
+}
 
+bool Log::set_archive_policy(bool compress, int max_age_days, long long max_total_size, long long rate,
+                             bool scan_existing)
+{
+    m_mutex.lock();
+    m_file.set_rotate_callback(rotate_callback, this);
+    bool ret = m_archiver.start(m_file.dir_name(), m_file.log_name(), m_file.path(),
+                                compress, max_age_days, max_total_size, rate, scan_existing);
+    if (m_access_enabled)
+    {
+        m_access_file.set_rotate_callback(access_rotate_callback, this);
+        ret = m_access_archiver.start(m_access_file.dir_name(), m_access_file.log_name(), m_access_file.path(),
+                                      compress, max_age_days, max_total_size, rate, scan_existing) && ret;
+    }
     m_mutex.unlock();
+    return ret;
+}
 
-    //若m_is_async为true表示异步，默认为同步
-    //若异步,则将日志信息加入阻塞队列,同步则加锁向文件中写
-    if (m_is_async && !m_log_queue->full())
+void Log::rotate_callback(const char *closed_path, const char *current_path, void *arg)
+{
+    ((Log *)arg)->m_archiver.on_rotate(closed_path, current_path);
+}
+
+void Log::access_rotate_callback(const char *closed_path, const char *current_path, void *arg)
+{
+    ((Log *)arg)->m_access_archiver.on_rotate(closed_path, current_path);
+}
+
+void Log::drain_rings()
+{
+    m_ring_mutex.lock();
+    m_snapshot = m_rings;
+    m_ring_mutex.unlock();
+
+    size_t used = 0;
+    for (int i = 0; i < LOG_CHANNEL_NUMBER; i++)
     {
-        m_log_queue->push(log_str);
+        m_iov[i].clear();
     }
-    else
+    for (size_t i = 0; i < m_snapshot.size(); i++)
     {
-        m_mutex.lock();
-        fputs(log_str.c_str(), m_fp);
-        m_mutex.unlock();
+        ring_slot &slot = m_snapshot[i];
+        //先确认线程是否已经退出，再取数据，这样取完之后缓冲区中不会再有新数据
+        slot.closed = slot.ring->closed();
+
+        //访问日志总是已经格式化好的文本
+        if (m_is_deferred && slot.channel == LOG_CHANNEL_MAIN)
+        {
+            //取出完整的记录，逐条还原成文本
+            size_t len = slot.ring->pop(m_staging, m_ring_size);
+            render_records(m_staging, len, used);
+        }
+        else
+        {
+            //不复制数据，记下每个线程缓冲区中完整的行所在的内存，之后一次writev写出
+            struct iovec iov[2];
+            int n = slot.ring->peek(iov, &slot.len);
+            m_iov[slot.channel].insert(m_iov[slot.channel].end(), iov, iov + n);
+        }
     }
 
-    va_end(valst);
+    //切换文件和fsync都在后台写线程中进行，写日志的线程不会被阻塞
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    int report_len = format_overflow_report(m_report_line, sizeof(m_report_line), now);
+    if (report_len > 0)
+    {
+        struct iovec iov;
+        iov.iov_base = m_report_line;
+        iov.iov_len = report_len;
+        m_iov[LOG_CHANNEL_MAIN].push_back(iov);
+    }
+    m_mutex.lock();
+    if (!m_iov[LOG_CHANNEL_MAIN].empty())
+    {
+        m_file.write(m_iov[LOG_CHANNEL_MAIN].data(), (int)m_iov[LOG_CHANNEL_MAIN].size());
+    }
+    if (used > 0)
+    {
+        write_batch(m_batch, used);
+    }
+    if (!m_iov[LOG_CHANNEL_ACCESS].empty())
+    {
+        m_access_file.write(m_iov[LOG_CHANNEL_ACCESS].data(), (int)m_iov[LOG_CHANNEL_ACCESS].size());
+    }
+    m_file.sync(to_ms(now));
+    m_access_file.sync(to_ms(now));
+    m_mutex.unlock();
+
+    for (size_t i = 0; i < m_snapshot.size(); i++)
+    {
+        ring_slot &slot = m_snapshot[i];
+        if (slot.len > 0)
+        {
+            slot.ring->consume(slot.len);
+        }
+        if (slot.closed && slot.ring->size() == 0)
+        {
+            m_ring_mutex.lock();
+            for (size_t j = 0; j < m_rings.size(); j++)
+            {
+                if (m_rings[j].ring == slot.ring)
+                {
+                    m_rings.erase(m_rings.begin() + j);
+                    break;
+                }
+            }
+            m_ring_mutex.unlock();
+            delete slot.ring;
+        }
+    }
+}
+
+void Log::render_records(const char *data, size_t len, size_t &used)
+{
+    const char *p = data;
+    const char *end = data + len;
+    while (end - p >= (long)sizeof(log_record))
+    {
+        log_record rec;
+        memcpy(&rec, p, sizeof(rec));
+        if (rec.len < sizeof(log_record) || rec.len > (size_t)(end - p))
+        {
+            break;
+        }
+
+        //每条记录还原后不超过m_log_buf_size字节
+        if (m_batch_size - used < (size_t)m_log_buf_size)
+        {
+            m_mutex.lock();
+            write_batch(m_batch, used);
+            m_mutex.unlock();
+            used = 0;
+        }
+
+        const char *payload = p + sizeof(log_record);
+        if (rec.type == LOG_RECORD_TEXT)
+        {
+            size_t text_len = rec.len - sizeof(log_record);
+            memcpy(m_batch + used, payload, text_len);
+            used += text_len;
+        }
+        else
+        {
+            used += render_record(m_batch + used, rec, payload, p + rec.len);
+        }
+        p += rec.len;
+    }
+}
+
+void *Log::async_write_log()
+{
+    //被唤醒或者等待超时后，把所有线程缓冲区中的日志批量写入文件
+    while (!m_stop.load())
+    {
+        int interval = (m_flush_interval > 0 && m_flush_interval < WRITER_INTERVAL) ? m_flush_interval : WRITER_INTERVAL;
+        m_writer_sem.timedwait(interval);
+        drain_rings();
+    }
+    drain_rings();
+    return NULL;
 }
 
 void Log::flush(void)
 {
+    //异步模式下交给后台写线程写出，写日志的线程不加锁
+    if (m_is_async)
+    {
+        m_writer_sem.post();
+        return;
+    }
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
     m_mutex.lock();
-    //强制刷新写入流缓冲区
-    fflush(m_fp);
+    flush_if_needed(true, now);
     m_mutex.unlock();
-}
\ No newline at end of file
+}
+
+void Log::tick(void)
+{
+    if (m_is_async)
+    {
+        return;
+    }
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    m_mutex.lock();
+    flush_if_needed(false, now);
+    m_mutex.unlock();
+}
+
+void Log::get_queue_fill(size_t &used, size_t &capacity, int &rings)
+{
+    used = 0;
+    capacity = 0;
+    //缓冲区先从列表中移除再释放，持锁遍历时列表中的缓冲区都有效
+    m_ring_mutex.lock();
+    rings = (int)m_rings.size();
+    for (size_t i = 0; i < m_rings.size(); i++)
+    {
+        used += m_rings[i].ring->size();
+        capacity += m_rings[i].ring->capacity();
+    }
+    m_ring_mutex.unlock();
+}
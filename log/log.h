@@ -4,26 +4,80 @@
 #include <stdio.h>
 #include <iostream>
 #include <string>
+#include <vector>
+#include <atomic>
 #include <stdarg.h>
 #include <pthread.h>
-#include "block_queue.h"
+#include <sys/time.h>
+#include "../lock/locker.h"
+#include "log_buffer.h"
+#include "log_format.h"
+#include "log_file.h"
+#include "log_archiver.h"
+
+//日志级别
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+
+//编译期的最低日志级别，低于该级别的LOG_XXX调用在编译时被整个去掉，参数也不会被求值
+//可以在编译命令中用-DLOG_MIN_LEVEL=1等覆盖
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+//异步模式下线程缓冲区写满时的处理方式
+enum LOG_OVERFLOW_POLICY
+{
+    LOG_OVERFLOW_SYNC = 0,   //退回到加锁同步写文件
+    LOG_OVERFLOW_BLOCK,      //等待后台写线程腾出空间，不丢日志
+    LOG_OVERFLOW_DROP_NEWEST, //丢弃这条日志
+    LOG_OVERFLOW_DROP_LEVEL  //按级别先丢低级别的日志，ERROR级别在缓冲区满时同步写
+};
+
+//日志通道，每个通道写入各自的文件，共用后台写线程
+enum LOG_CHANNEL
+{
+    LOG_CHANNEL_MAIN = 0, //LOG_XXX宏输出的运行日志
+    LOG_CHANNEL_ACCESS,   //每个请求一条的访问日志
+    LOG_CHANNEL_NUMBER
+};
 
 class Log
 {
 private:
     Log();
     virtual ~Log();
-    void *async_write_log()
-    {
-        std::string single_log;
-        //从阻塞队列中取出一个日志string，写入文件
-        while (m_log_queue->pop(single_log))
-        {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
-        }
-    }
+    void *async_write_log();
+
+    //把日志行的前缀（时间 + 级别）格式化到buf中，返回长度
+    int format_prefix(char *buf, int level, const struct timeval &now);
+    //把一行日志（时间 + 级别 + 内容 + 换行）格式化到buf中，返回长度
+    int format_line(char *buf, int size, int level, const struct timeval &now, const char *format, va_list valst);
+    //把一条延迟格式化的记录还原成一行日志，buf至少有m_log_buf_size字节，返回长度
+    int render_record(char *buf, const log_record &rec, const char *args, const char *args_end);
+    //返回当前线程用于组装记录的缓冲区
+    char *thread_record_buffer();
+    //按溢出策略把一条记录写入线程缓冲区，已写入或已丢弃时返回true，需要调用者同步写时返回false
+    bool push_ring(log_ring *ring, const char *data, size_t len, int level);
+    //把一条记录写入当前线程的缓冲区，按溢出策略需要时退回到同步写
+    void push_record(const char *data, size_t len, int level);
+    //距上次统计超过一定时间且有日志被丢弃、同步写或等待时，生成一行统计，返回长度，否则返回0
+    int format_overflow_report(char *buf, int size, const struct timeval &now);
+    //把一批记录还原成文本追加到批量缓冲区中，必要时先写出批量缓冲区
+    void render_records(const char *data, size_t len, size_t &used);
+    //返回当前线程在channel上的日志缓冲区，第一次调用时创建并登记
+    log_ring *thread_ring(int channel);
+    //把当前所有线程缓冲区中的日志取出并写入文件，由后台写线程调用
+    void drain_rings();
+    //写入一批完整的日志行，调用前需持有m_mutex
+    void write_batch(const char *data, size_t len);
+    //同步模式下按刷新策略决定是否把m_batch中的日志写入文件，调用前需持有m_mutex
+    void flush_if_needed(bool force, const struct timeval &now);
+    //日志文件切换后把旧文件交给归档线程
+    static void rotate_callback(const char *closed_path, const char *current_path, void *arg);
+    static void access_rotate_callback(const char *closed_path, const char *current_path, void *arg);
 
 public:
     //C++11以后,使用局部变量懒汉不用加锁
@@ -34,41 +88,226 @@ public:
     }
 
     //异步写日志公有方法，调用私有方法async_write_log
-    static void *flush_log_thread(void *args)
+    static void *flush_log_thread(void *)
     {
-        Log::get_instance()->async_write_log();
+        return Log::get_instance()->async_write_log();
     }
 
-    //可选择的参数有日志文件、日志缓冲区大小、最大行数以及最长日志条队列
-    bool init(const char *file_name, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
+    //可选择的参数有日志文件、日志缓冲区大小、单个日志文件的最大字节数(0为不限)以及最长日志条队列
+    //异步模式下每个写日志的线程有一个可容纳max_queue_size条最长日志的缓冲区
+    //deferred为true且为异步模式时，格式化延迟到后台写线程中进行
+    bool init(const char *file_name, int log_buf_size = 8192, long long split_size = 0, int max_queue_size = 0, bool deferred = false);
+
+    //打开访问日志文件，文件命名和切换规则与init相同；需在init之后调用
+    bool init_access(const char *file_name, long long split_size = 0);
+    bool access_enabled() const
+    {
+        return m_access_enabled;
+    }
+    //写入一条或多条已经格式化好的完整访问日志，异步模式下与运行日志一样经由本线程的缓冲区写出
+    void write_access(const char *data, size_t len);
 
     //将输出内容按照标准格式整理
-    void write_log(int level, const char *format, ...);
+    void write_log(int level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+
+    //是否启用了延迟格式化
+    bool is_deferred() const
+    {
+        return m_is_deferred;
+    }
+
+    //登记一个格式串，返回格式串编号，编号用完时返回-1
+    //由LOG_XXX宏在每个调用点第一次执行时调用一次，format必须是字符串常量
+    int register_format(const char *format);
+
+    //延迟格式化：只记录格式串编号、时间戳和参数的原始字节，由后台写线程生成文本
+    template <typename... Args>
+    void write_log_deferred(int level, int fmt_id, Args... args)
+    {
+        struct timeval now = {0, 0};
+        gettimeofday(&now, NULL);
+
+        char *buf = thread_record_buffer();
+        log_arg_writer writer(buf + sizeof(log_record), buf + sizeof(log_record) + m_log_buf_size);
+        encode_log_args(writer, args...);
+
+        log_record rec;
+        rec.len = (uint32_t)(writer.pos() - buf);
+        rec.type = LOG_RECORD_DEFERRED;
+        rec.level = (uint16_t)level;
+        rec.fmt_id = (uint32_t)fmt_id;
+        rec.usec = (uint32_t)now.tv_usec;
+        rec.sec = now.tv_sec;
+        memcpy(buf, &rec, sizeof(rec));
+        push_record(buf, rec.len, level);
+    }
 
     //强制刷新缓冲区
     void flush(void);
 
+    //同步模式下按刷新间隔写出m_batch中的日志，由事件循环定时调用，避免空闲时日志一直留在缓冲区中
+    //异步模式下后台写线程自己按间隔刷新，这里什么也不做
+    void tick(void);
+
+    //运行期的日志级别阈值，低于该级别的日志在求值参数之前就被丢弃
+    void set_level(int level)
+    {
+        m_level.store(level, std::memory_order_relaxed);
+    }
+    int get_level() const
+    {
+        return m_level.load(std::memory_order_relaxed);
+    }
+    bool level_enabled(int level) const
+    {
+        return level >= m_level.load(std::memory_order_relaxed);
+    }
+
+    //刷新策略，同步模式下满足任一条件时把缓冲的日志写入内核：
+    //距上次刷新超过interval_ms毫秒（0表示每条都刷新，负数表示不按时间刷新）、
+    //未刷新的数据超过size字节（0表示不按大小刷新）、写入了ERROR级别的日志（on_error为true时）
+    //异步模式下后台写线程每批都直接写入内核，interval_ms限制其最长唤醒间隔，ERROR级别的日志立即唤醒它
+    void set_flush_policy(int interval_ms, int size, bool on_error);
+
+    //异步模式下线程缓冲区写满时的处理方式，见LOG_OVERFLOW_POLICY
+    void set_overflow_policy(int policy);
+    //启动以来被丢弃的日志条数、退回同步写的条数和等待过缓冲区的条数
+    unsigned long long get_dropped() const
+    {
+        return m_dropped.load(std::memory_order_relaxed);
+    }
+    unsigned long long get_sync_writes() const
+    {
+        return m_sync_writes.load(std::memory_order_relaxed);
+    }
+    unsigned long long get_blocked() const
+    {
+        return m_blocked.load(std::memory_order_relaxed);
+    }
+    //异步模式下所有线程缓冲区中待写出的字节数、总容量和缓冲区个数，可在任意线程调用
+    void get_queue_fill(size_t &used, size_t &capacity, int &rings);
+
+    //fsync策略，见LOG_FSYNC_POLICY，interval_ms为LOG_FSYNC_PERIODIC的同步间隔
+    void set_fsync_policy(int policy, int interval_ms);
+
+    //启动归档线程：compress为true时用gzip压缩切换出去的日志，并删除超过max_age_days天的日志，
+    //日志总大小超过max_total_size字节时从最旧的开始删除；压缩速率不超过每秒rate字节
+    //参数为0表示不做对应的限制；只处理本进程切换出去的文件，scan_existing为true时才接管目录中已有的日志
+    //访问日志按同样的策略单独归档，需在init_access之后调用
+    bool set_archive_policy(bool compress, int max_age_days, long long max_total_size, long long rate,
+                            bool scan_existing);
+
 private:
-    char dir_name[128]; //路径名
-    char log_name[128]; //log文件名
-    int m_split_lines;  //日志最大行数
+    //后台写线程一次遍历中记录的线程缓冲区状态
+    struct ring_slot
+    {
+        log_ring *ring;
+        int channel;
+        size_t len;   //本次取出的字节数
+        bool closed;  //取数据之前生产者线程是否已经退出
+    };
+
     int m_log_buf_size; //日志缓冲区大小
-    long long m_count;  //日志行数记录
-    int m_today;        //因为按天分类,记录当前时间是那一天
-    FILE *m_fp;         //打开log的文件指针
-    char *m_buf;
-    block_queue<std::string> *m_log_queue; //阻塞队列
+    log_file m_file;    //日志文件，按日期和大小切换
+    log_archiver m_archiver; //压缩和清理切换出去的日志文件
+    log_file m_access_file;  //访问日志文件
+    log_archiver m_access_archiver;
+    bool m_access_enabled;
     bool m_is_async;                  //是否同步标志位
-    locker m_mutex;
+    locker m_mutex;                   //保护m_file，同步模式下还保护m_batch
+
+    //异步模式：每个线程一个无锁缓冲区，后台线程批量取出后写入文件
+    size_t m_ring_size;               //每个线程缓冲区的大小
+    std::vector<ring_slot> m_rings;   //所有线程在各个通道上的缓冲区
+    std::vector<ring_slot> m_snapshot; //后台写线程遍历用的m_rings副本
+    std::vector<struct iovec> m_iov[LOG_CHANNEL_NUMBER]; //线程缓冲区中待写数据所在的内存，每个通道一次writev写出
+    locker m_ring_mutex;              //只在登记和遍历缓冲区列表时使用，不在写日志的路径上
+    sem m_writer_sem;                 //唤醒后台写线程
+    char *m_batch;                    //同步模式下缓冲的日志，延迟格式化模式下后台写线程还原出的文本
+    size_t m_batch_size;
+    pthread_t m_writer;
+    std::atomic<bool> m_stop;
+
+    //延迟格式化：环形缓冲区中存放带log_record头部的记录
+    bool m_is_deferred;
+    char *m_staging;                  //后台写线程从线程缓冲区取出记录用的缓冲区
+    const char **m_formats;           //格式串编号到格式串的映射
+    int m_format_count;
+
+    //日志级别与刷新策略
+    std::atomic<int> m_level;         //运行期日志级别阈值
+    int m_flush_interval;             //按时间刷新的间隔(ms)
+    int m_flush_size;                 //按大小刷新的阈值(字节)
+    bool m_flush_on_error;            //写入ERROR级别日志后立即刷新
+    long long m_last_flush;           //上次刷新的时间(ms)
+    size_t m_unflushed;               //同步模式下m_batch中尚未写入文件的字节数
+
+    //溢出策略与统计
+    std::atomic<int> m_overflow;
+    std::atomic<unsigned long long> m_dropped;
+    std::atomic<unsigned long long> m_sync_writes;
+    std::atomic<unsigned long long> m_blocked;
+    //以下只由后台写线程访问
+    unsigned long long m_reported_dropped;
+    unsigned long long m_reported_sync_writes;
+    unsigned long long m_reported_blocked;
+    long long m_last_report;
+    char m_report_line[256];
 };
 
 //这四个宏定义在其他文件中使用，主要用于不同类型的日志输出
 // __VA_ARGS__宏前面加上##的作用在于，当可变参数的个数为0时，
 // 这里printf参数列表中的的##会把前面多余的","去掉，否则会编译出错，建议使用后面这种，使得程序更加健壮
-#define LOG_DEBUG(format, ...) Log::get_instance()->write_log(0, format, ##__VA_ARGS__)
-#define LOG_INFO(format, ...) Log::get_instance()->write_log(1, format, ##__VA_ARGS__)
-#define LOG_WARN(format, ...) Log::get_instance()->write_log(2, format, ##__VA_ARGS__)
-#define LOG_ERROR(format, ...) Log::get_instance()->write_log(3, format, ##__VA_ARGS__)
+//延迟格式化模式下，每个调用点用函数内静态变量记住自己格式串的编号
+#define LOG_BASE(level, format, ...)                                                     \
+    do                                                                                   \
+    {                                                                                    \
+        Log *log_instance = Log::get_instance();                                         \
+        if (!log_instance->level_enabled(level))                                         \
+        {                                                                                \
+            break;                                                                       \
+        }                                                                                \
+        if (log_instance->is_deferred())                                                 \
+        {                                                                                \
+            static const int log_format_id = log_instance->register_format(format);      \
+            if (log_format_id >= 0)                                                      \
+            {                                                                            \
+                log_instance->write_log_deferred(level, log_format_id, ##__VA_ARGS__);   \
+                break;                                                                   \
+            }                                                                            \
+        }                                                                                \
+        log_instance->write_log(level, format, ##__VA_ARGS__);                           \
+    } while (0)
+
+//低于LOG_MIN_LEVEL的级别展开为空语句
+#define LOG_DISABLED(format, ...) \
+    do                            \
+    {                             \
+    } while (0)
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(format, ...) LOG_BASE(LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(format, ...) LOG_DISABLED(format, ##__VA_ARGS__)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) LOG_BASE(LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#else
+#define LOG_INFO(format, ...) LOG_DISABLED(format, ##__VA_ARGS__)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(format, ...) LOG_BASE(LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#else
+#define LOG_WARN(format, ...) LOG_DISABLED(format, ##__VA_ARGS__)
+#endif
+
+#if LOG_MIN_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(format, ...) LOG_BASE(LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(format, ...) LOG_DISABLED(format, ##__VA_ARGS__)
+#endif
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <algorithm>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <zlib.h>
+#include "log_archiver.h"
+
+//没有新文件需要压缩时，每隔RETENTION_INTERVAL毫秒检查一次保留策略
+static const int RETENTION_INTERVAL = 60 * 1000;
+//压缩时每次读取的字节数
+static const size_t CHUNK_SIZE = 64 * 1024;
+//限速等待时每隔PAUSE_STEP毫秒检查一次是否要求停止
+static const long long PAUSE_STEP = 100;
+
+//linux/ioprio.h中的定义，glibc没有提供
+#define LOG_IOPRIO_CLASS_SHIFT 13
+#define LOG_IOPRIO_CLASS_IDLE 3
+#define LOG_IOPRIO_WHO_PROCESS 1
+
+static long long monotonic_ms()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+log_archiver::log_archiver()
+{
+    m_compress = false;
+    m_max_age_days = 0;
+    m_max_total_size = 0;
+    m_rate = 0;
+    m_scan_existing = false;
+    m_started = false;
+    m_stop = false;
+}
+
+log_archiver::~log_archiver()
+{
+    stop();
+}
+
+bool log_archiver::start(const char *dir_name, const char *log_name, const char *current_path, bool compress,
+                         int max_age_days, long long max_total_size, long long rate, bool scan_existing)
+{
+    if (m_started)
+    {
+        return false;
+    }
+    m_dir_name = dir_name;
+    m_log_name = log_name;
+    m_current = current_path;
+    m_compress = compress;
+    m_max_age_days = max_age_days;
+    m_max_total_size = max_total_size;
+    m_rate = rate;
+    m_scan_existing = scan_existing;
+    m_stop = false;
+    if (pthread_create(&m_thread, NULL, worker, this) != 0)
+    {
+        return false;
+    }
+    m_started = true;
+    return true;
+}
+
+void log_archiver::stop()
+{
+    if (!m_started)
+    {
+        return;
+    }
+    m_stop = true;
+    m_sem.post();
+    pthread_join(m_thread, NULL);
+    m_started = false;
+}
+
+void log_archiver::on_rotate(const char *closed_path, const char *current_path)
+{
+    m_mutex.lock();
+    m_current = current_path;
+    if (closed_path && strcmp(closed_path, current_path) != 0)
+    {
+        m_pending.push_back(closed_path);
+    }
+    m_mutex.unlock();
+    m_sem.post();
+}
+
+void *log_archiver::worker(void *arg)
+{
+    log_archiver *archiver = (log_archiver *)arg;
+    archiver->run();
+    return NULL;
+}
+
+void log_archiver::run()
+{
+    //CPU优先级设为最低，I/O调度设为idle类，只在磁盘空闲时才进行读写
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, tid, 19);
+    syscall(SYS_ioprio_set, LOG_IOPRIO_WHO_PROCESS, tid, LOG_IOPRIO_CLASS_IDLE << LOG_IOPRIO_CLASS_SHIFT);
+
+    //之前的进程留下的日志，只在明确要求时才接管
+    if (m_scan_existing)
+    {
+        scan_existing();
+    }
+
+    while (!m_stop.load())
+    {
+        std::vector<std::string> pending;
+        m_mutex.lock();
+        pending.swap(m_pending);
+        m_mutex.unlock();
+
+        for (size_t i = 0; i < pending.size() && !m_stop.load(); i++)
+        {
+            if (m_compress && compress_file(pending[i]))
+            {
+                m_files.push_back(pending[i] + ".gz");
+            }
+            else
+            {
+                m_files.push_back(pending[i]);
+            }
+        }
+        if (!m_stop.load())
+        {
+            enforce_retention();
+        }
+        m_sem.timedwait(RETENTION_INTERVAL);
+    }
+}
+
+int log_archiver::file_kind(const char *name) const
+{
+    //年_月_日_
+    static const char pattern[] = "dddd_dd_dd_";
+    for (int i = 0; pattern[i]; i++)
+    {
+        if (pattern[i] == 'd' ? (name[i] < '0' || name[i] > '9') : name[i] != pattern[i])
+        {
+            return LOG_FILE_OTHER;
+        }
+    }
+    const char *p = name + sizeof(pattern) - 1;
+    if (strncmp(p, m_log_name.c_str(), m_log_name.size()) != 0)
+    {
+        return LOG_FILE_OTHER;
+    }
+    p += m_log_name.size();
+
+    //可选的.N后缀
+    if (p[0] == '.' && p[1] >= '0' && p[1] <= '9')
+    {
+        p++;
+        while (*p >= '0' && *p <= '9')
+        {
+            p++;
+        }
+    }
+    if (*p == '\0')
+    {
+        return LOG_FILE_PLAIN;
+    }
+    if (strcmp(p, ".gz") == 0)
+    {
+        return LOG_FILE_GZIP;
+    }
+    if (strcmp(p, ".gz.tmp") == 0)
+    {
+        return LOG_FILE_TEMP;
+    }
+    return LOG_FILE_OTHER;
+}
+
+void log_archiver::scan_existing()
+{
+    DIR *dir = opendir(m_dir_name.empty() ? "." : m_dir_name.c_str());
+    if (!dir)
+    {
+        return;
+    }
+    std::vector<std::string> found;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        int kind = file_kind(entry->d_name);
+        std::string path = m_dir_name + entry->d_name;
+        if (kind == LOG_FILE_TEMP)
+        {
+            unlink(path.c_str());
+        }
+        else if (kind == LOG_FILE_PLAIN)
+        {
+            found.push_back(path);
+        }
+        else if (kind == LOG_FILE_GZIP)
+        {
+            m_files.push_back(path);
+        }
+    }
+    closedir(dir);
+
+    //未压缩的文件交给主循环，按m_compress压缩或直接纳入管理
+    m_mutex.lock();
+    for (size_t i = 0; i < found.size(); i++)
+    {
+        if (found[i] != m_current)
+        {
+            m_pending.push_back(found[i]);
+        }
+    }
+    m_mutex.unlock();
+}
+
+bool log_archiver::pause(long long ms)
+{
+    while (ms > 0 && !m_stop.load())
+    {
+        long long step = ms < PAUSE_STEP ? ms : PAUSE_STEP;
+        struct timespec t;
+        t.tv_sec = step / 1000;
+        t.tv_nsec = (step % 1000) * 1000000;
+        nanosleep(&t, NULL);
+        ms -= step;
+    }
+    return !m_stop.load();
+}
+
+bool log_archiver::compress_file(const std::string &path)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        return false;
+    }
+    std::string tmp = path + ".gz.tmp";
+    gzFile gz = gzopen(tmp.c_str(), "wb");
+    if (!gz)
+    {
+        close(fd);
+        return false;
+    }
+
+    //按m_rate限速：读完每一块后，若比限定的速率快就等待
+    char *buf = new char[CHUNK_SIZE];
+    long long begin = monotonic_ms();
+    long long total = 0;
+    bool ok = true;
+    for (;;)
+    {
+        ssize_t n = read(fd, buf, CHUNK_SIZE);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            ok = n == 0;
+            break;
+        }
+        if (gzwrite(gz, buf, (unsigned)n) != (int)n)
+        {
+            ok = false;
+            break;
+        }
+        total += n;
+        if (m_rate > 0)
+        {
+            long long expect = total * 1000 / m_rate;
+            long long elapsed = monotonic_ms() - begin;
+            if (expect > elapsed && !pause(expect - elapsed))
+            {
+                ok = false;
+                break;
+            }
+        }
+        else if (m_stop.load())
+        {
+            ok = false;
+            break;
+        }
+    }
+    delete[] buf;
+    close(fd);
+
+    if (gzclose(gz) != Z_OK)
+    {
+        ok = false;
+    }
+    //保留原文件的修改时间，保留策略按日志的写入时间而不是压缩时间计算
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    utimensat(AT_FDCWD, tmp.c_str(), times, 0);
+
+    //压缩完整后才替换原文件，中途失败或被停止时保留原文件
+    //用link而不是rename，目标已存在时失败而不是覆盖之前的压缩文件，这时同样保留原文件
+    if (!ok || link(tmp.c_str(), (path + ".gz").c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    unlink(tmp.c_str());
+    unlink(path.c_str());
+    return true;
+}
+
+void log_archiver::enforce_retention()
+{
+    if (m_max_age_days <= 0 && m_max_total_size <= 0)
+    {
+        return;
+    }
+
+    m_mutex.lock();
+    std::string current = m_current;
+    m_mutex.unlock();
+
+    //(修改时间, 大小, 路径)，正在写入的文件计入总大小但不会被删除
+    std::vector<std::pair<time_t, std::pair<long long, std::string> > > files;
+    long long total = 0;
+    struct stat st;
+    if (stat(current.c_str(), &st) == 0)
+    {
+        total += st.st_size;
+    }
+    std::vector<std::string> kept;
+    for (size_t i = 0; i < m_files.size(); i++)
+    {
+        //已被外部删除或移走的文件不再管理
+        if (m_files[i] == current || stat(m_files[i].c_str(), &st) != 0)
+        {
+            continue;
+        }
+        kept.push_back(m_files[i]);
+        total += st.st_size;
+        files.push_back(std::make_pair(st.st_mtime, std::make_pair((long long)st.st_size, m_files[i])));
+    }
+    m_files.swap(kept);
+
+    //从最旧的开始删除
+    std::sort(files.begin(), files.end());
+    time_t deadline = time(NULL) - (time_t)m_max_age_days * 24 * 3600;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        bool expired = m_max_age_days > 0 && files[i].first < deadline;
+        bool over = m_max_total_size > 0 && total > m_max_total_size;
+        if (!expired && !over)
+        {
+            break;
+        }
+        if (unlink(files[i].second.second.c_str()) == 0)
+        {
+            total -= files[i].second.first;
+            m_files.erase(std::find(m_files.begin(), m_files.end(), files[i].second.second));
+        }
+    }
+}
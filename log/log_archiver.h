@@ -0,0 +1,84 @@
+#ifndef _LOG_ARCHIVER_H_
+#define _LOG_ARCHIVER_H_
+/*************************************************************
+*日志归档：在低优先级的后台线程中用gzip压缩已经切换出去的日志文件，
+*并按保留时间和总大小删除最旧的日志
+*默认只处理本进程切换出去的文件，目录中已有的日志只有在scan_existing为true时才会被压缩和删除
+*压缩按限定的速率读写，线程的CPU和I/O优先级都设为最低，不与处理请求的线程争抢
+**************************************************************/
+
+#include <pthread.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+//目录中文件的类别
+enum LOG_FILE_KIND
+{
+    LOG_FILE_OTHER = 0, //不是本日志的文件
+    LOG_FILE_PLAIN,     //未压缩的日志
+    LOG_FILE_GZIP,      //压缩后的日志
+    LOG_FILE_TEMP       //压缩到一半的临时文件
+};
+
+class log_archiver
+{
+public:
+    log_archiver();
+    ~log_archiver();
+
+    log_archiver(const log_archiver &) = delete;
+    log_archiver &operator=(const log_archiver &) = delete;
+
+    /**
+     * 启动后台线程，管理dir_name目录下 年_月_日_log_name[.N][.gz] 形式的日志文件
+     * compress: 是否压缩切换出去的文件
+     * max_age_days: 超过该天数的日志被删除，0表示不按时间删除
+     * max_total_size: 日志总字节数超过该值时从最旧的开始删除，0表示不限
+     * rate: 压缩时每秒最多读取的字节数，0表示不限速
+     * scan_existing: 启动时把目录中已有的日志也纳入压缩和删除，false时只处理本进程切换出去的文件
+    */
+    bool start(const char *dir_name, const char *log_name, const char *current_path, bool compress,
+               int max_age_days, long long max_total_size, long long rate, bool scan_existing);
+
+    //停止后台线程，正在压缩的文件会被放弃，下次启动时重新压缩
+    void stop();
+
+    //日志文件切换时调用，closed_path为刚关闭的文件，current_path为正在写入的文件
+    void on_rotate(const char *closed_path, const char *current_path);
+
+private:
+    static void *worker(void *arg);
+    void run();
+    //把目录中除正在写入的文件外已有的日志加入管理的列表，未压缩的加入待压缩列表
+    void scan_existing();
+    //把path压缩为path.gz，成功后删除path
+    bool compress_file(const std::string &path);
+    //按保留时间和总大小删除m_files中最旧的日志
+    void enforce_retention();
+    //按文件名判断是否为本日志的文件，返回LOG_FILE_KIND
+    int file_kind(const char *name) const;
+    //等待ms毫秒，期间被要求停止时返回false
+    bool pause(long long ms);
+
+private:
+    std::string m_dir_name;
+    std::string m_log_name;
+    bool m_compress;
+    int m_max_age_days;
+    long long m_max_total_size;
+    long long m_rate;
+    bool m_scan_existing;
+
+    locker m_mutex;                    //保护m_pending和m_current
+    std::vector<std::string> m_pending; //本进程切换出去、还未处理的文件
+    std::vector<std::string> m_files;   //归档线程管理的文件，只有其中的文件会被删除，仅后台线程访问
+    std::string m_current;             //正在写入的文件，不压缩也不删除
+    sem m_sem;                         //有新文件需要压缩或要求停止时唤醒后台线程
+    pthread_t m_thread;
+    bool m_started;
+    std::atomic<bool> m_stop;
+};
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef _LOG_BUFFER_H_
+#define _LOG_BUFFER_H_
+/*************************************************************
+*单生产者单消费者的无锁环形缓冲区，用于异步日志
+*每个写日志的线程独占一个环形缓冲区（生产者），后台写线程批量取出（消费者）
+*生产者只写m_tail，消费者只写m_head，两者各占一个缓存行，互不干扰
+**************************************************************/
+
+#include <atomic>
+#include <stddef.h>
+#include <string.h>
+#include <sys/uio.h>
+
+class log_ring
+{
+public:
+    // capacity会向上取整为2的幂
+    explicit log_ring(size_t capacity) : m_head(0), m_tail(0), m_closed(false)
+    {
+        m_capacity = 1;
+        while (m_capacity < capacity)
+        {
+            m_capacity <<= 1;
+        }
+        m_mask = m_capacity - 1;
+        m_buf = new char[m_capacity];
+    }
+
+    ~log_ring()
+    {
+        delete[] m_buf;
+    }
+
+    log_ring(const log_ring &) = delete;
+    log_ring &operator=(const log_ring &) = delete;
+
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+
+    // 当前已写入、尚未被取走的字节数
+    size_t size() const
+    {
+        return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+    }
+
+    /**
+     * 生产者调用：写入一条完整的记录
+     * 空间不足时不写入任何数据并返回false，保证消费者看到的总是完整的记录
+     * used_after返回写入后的已用字节数，供调用者决定是否唤醒消费者
+    */
+    bool push(const char *data, size_t len, size_t *used_after = NULL)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        if (m_capacity - (tail - head) < len)
+        {
+            return false;
+        }
+        size_t offset = tail & m_mask;
+        size_t first = m_capacity - offset;
+        if (first >= len)
+        {
+            memcpy(m_buf + offset, data, len);
+        }
+        else
+        {
+            memcpy(m_buf + offset, data, first);
+            memcpy(m_buf, data + first, len - first);
+        }
+        m_tail.store(tail + len, std::memory_order_release);
+        if (used_after)
+        {
+            *used_after = tail + len - head;
+        }
+        return true;
+    }
+
+    /**
+     * 消费者调用：取出当前所有可读数据，最多max字节，返回取出的字节数
+     * max不小于capacity()时，取出的数据一定由完整的记录组成
+    */
+    size_t pop(char *dst, size_t max)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        size_t len = tail - head;
+        if (len > max)
+        {
+            len = max;
+        }
+        if (len == 0)
+        {
+            return 0;
+        }
+        size_t offset = head & m_mask;
+        size_t first = m_capacity - offset;
+        if (first >= len)
+        {
+            memcpy(dst, m_buf + offset, len);
+        }
+        else
+        {
+            memcpy(dst, m_buf + offset, first);
+            memcpy(dst + first, m_buf, len - first);
+        }
+        m_head.store(head + len, std::memory_order_release);
+        return len;
+    }
+
+    /**
+     * 消费者调用：不复制数据，把当前所有可读数据所在的内存（至多两段）填入iov，返回段数
+     * 数据用完后调用consume释放，两次调用之间生产者追加的数据不受影响
+    */
+    int peek(struct iovec iov[2], size_t *len_out) const
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        size_t len = tail - head;
+        *len_out = len;
+        if (len == 0)
+        {
+            return 0;
+        }
+        size_t offset = head & m_mask;
+        size_t first = m_capacity - offset;
+        iov[0].iov_base = m_buf + offset;
+        if (first >= len)
+        {
+            iov[0].iov_len = len;
+            return 1;
+        }
+        iov[0].iov_len = first;
+        iov[1].iov_base = m_buf;
+        iov[1].iov_len = len - first;
+        return 2;
+    }
+
+    void consume(size_t len)
+    {
+        m_head.store(m_head.load(std::memory_order_relaxed) + len, std::memory_order_release);
+    }
+
+    // 生产者线程退出时调用，消费者取完剩余数据后即可释放该缓冲区
+    void close()
+    {
+        m_closed.store(true, std::memory_order_release);
+    }
+
+    bool closed() const
+    {
+        return m_closed.load(std::memory_order_acquire);
+    }
+
+private:
+    char *m_buf;
+    size_t m_capacity;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_head; // 消费者读取位置
+    alignas(64) std::atomic<size_t> m_tail; // 生产者写入位置
+    std::atomic<bool> m_closed;             // 生产者线程是否已经退出
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "log_file.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+//返回下一个零点的时间
+static time_t next_midnight(time_t t)
+{
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
+    my_tm.tm_hour = 0;
+    my_tm.tm_min = 0;
+    my_tm.tm_sec = 0;
+    my_tm.tm_mday += 1;
+    my_tm.tm_isdst = -1;
+    return mktime(&my_tm);
+}
+
+//path是否已被归档线程压缩或正在压缩，这样的编号不能再使用，否则切换出去后会覆盖之前的压缩文件
+static bool archived(const char *path)
+{
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s.gz", path);
+    if (access(name, F_OK) == 0)
+    {
+        return true;
+    }
+    snprintf(name, sizeof(name), "%s.gz.tmp", path);
+    return access(name, F_OK) == 0;
+}
+
+log_file::log_file()
+{
+    m_dir_name[0] = '\0';
+    m_log_name[0] = '\0';
+    m_path[0] = '\0';
+    m_fd = -1;
+    m_split_size = 0;
+    m_size = 0;
+    m_index = 0;
+    m_day_end = 0;
+    m_fsync_policy = LOG_FSYNC_NONE;
+    m_fsync_interval = 1000;
+    m_last_sync = 0;
+    m_dirty = false;
+    m_rotate_callback = NULL;
+    m_rotate_arg = NULL;
+}
+
+log_file::~log_file()
+{
+    close();
+}
+
+bool log_file::open(const char *dir_name, const char *log_name, long long split_size)
+{
+    snprintf(m_dir_name, sizeof(m_dir_name), "%s", dir_name);
+    snprintf(m_log_name, sizeof(m_log_name), "%s", log_name);
+    m_split_size = split_size > 0 ? split_size : 0;
+    m_index = 0;
+    return open_file(time(NULL));
+}
+
+bool log_file::open_file(time_t now)
+{
+    struct tm my_tm;
+    localtime_r(&now, &my_tm);
+    m_day_end = next_midnight(now);
+
+    //重启后接着写当天最后一个没有写满的文件，跳过已经压缩过的编号
+    for (;;)
+    {
+        char *path = m_path;
+        if (m_index == 0)
+        {
+            snprintf(path, sizeof(m_path), "%s%d_%02d_%02d_%s", m_dir_name,
+                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, m_log_name);
+        }
+        else
+        {
+            snprintf(path, sizeof(m_path), "%s%d_%02d_%02d_%s.%d", m_dir_name,
+                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday, m_log_name, m_index);
+        }
+        if (archived(path))
+        {
+            m_index++;
+            continue;
+        }
+
+        m_fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (m_fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        m_size = fstat(m_fd, &st) == 0 ? st.st_size : 0;
+        if (m_split_size == 0 || m_size < m_split_size)
+        {
+            return true;
+        }
+        ::close(m_fd);
+        m_fd = -1;
+        m_index++;
+    }
+}
+
+void log_file::rotate_if_needed(time_t now, size_t len)
+{
+    bool new_day = now >= m_day_end;
+    bool full = m_split_size > 0 && m_size > 0 && m_size + (long long)len > m_split_size;
+    if (!new_day && !full)
+    {
+        return;
+    }
+
+    //关闭之前先按策略把旧文件同步到磁盘
+    if (m_dirty && m_fsync_policy != LOG_FSYNC_NONE)
+    {
+        fdatasync(m_fd);
+        m_dirty = false;
+    }
+    ::close(m_fd);
+    m_fd = -1;
+    char closed_path[sizeof(m_path)];
+    memcpy(closed_path, m_path, sizeof(m_path));
+    m_index = new_day ? 0 : m_index + 1;
+    if (open_file(now) && m_rotate_callback)
+    {
+        m_rotate_callback(closed_path, m_path, m_rotate_arg);
+    }
+}
+
+bool log_file::write(const struct iovec *iov, int iovcnt)
+{
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        total += iov[i].iov_len;
+    }
+    if (total == 0)
+    {
+        return true;
+    }
+
+    rotate_if_needed(time(NULL), total);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    //writev一次最多IOV_MAX段，且可能只写入一部分，需要循环直到写完
+    struct iovec part[IOV_MAX];
+    int index = 0;
+    size_t offset = 0;
+    while (index < iovcnt)
+    {
+        int count = 0;
+        for (int i = index; i < iovcnt && count < IOV_MAX; i++)
+        {
+            part[count].iov_base = (char *)iov[i].iov_base + (i == index ? offset : 0);
+            part[count].iov_len = iov[i].iov_len - (i == index ? offset : 0);
+            count++;
+        }
+
+        ssize_t n = writev(m_fd, part, count);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        m_size += n;
+        m_dirty = true;
+
+        size_t left = (size_t)n;
+        while (index < iovcnt && left >= iov[index].iov_len - offset)
+        {
+            left -= iov[index].iov_len - offset;
+            offset = 0;
+            index++;
+        }
+        offset += left;
+    }
+    return true;
+}
+
+void log_file::sync(long long now_ms)
+{
+    if (!m_dirty || m_fd < 0 || m_fsync_policy == LOG_FSYNC_NONE)
+    {
+        return;
+    }
+    if (m_fsync_policy == LOG_FSYNC_PERIODIC && now_ms - m_last_sync < m_fsync_interval)
+    {
+        return;
+    }
+    fdatasync(m_fd);
+    m_dirty = false;
+    m_last_sync = now_ms;
+}
+
+void log_file::set_fsync_policy(int policy, int interval_ms)
+{
+    m_fsync_policy = policy;
+    m_fsync_interval = interval_ms;
+}
+
+void log_file::set_rotate_callback(log_rotate_callback callback, void *arg)
+{
+    m_rotate_callback = callback;
+    m_rotate_arg = arg;
+}
+
+void log_file::close()
+{
+    if (m_fd < 0)
+    {
+        return;
+    }
+    if (m_dirty && m_fsync_policy != LOG_FSYNC_NONE)
+    {
+        fdatasync(m_fd);
+        m_dirty = false;
+    }
+    ::close(m_fd);
+    m_fd = -1;
+}
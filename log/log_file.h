@@ -0,0 +1,93 @@
+#ifndef _LOG_FILE_H_
+#define _LOG_FILE_H_
+/*************************************************************
+*日志文件：用O_APPEND打开，用writev批量写入
+*按日期和大小切换文件，切换只发生在两批数据之间，保证每个文件中都是完整的行
+*按fsync策略把数据同步到磁盘
+*本类不加锁，由调用者保证互斥，异步模式下只有后台写线程调用
+**************************************************************/
+
+#include <sys/uio.h>
+#include <time.h>
+
+//切换文件后的回调，closed_path为刚关闭的文件，current_path为新打开的文件
+typedef void (*log_rotate_callback)(const char *closed_path, const char *current_path, void *arg);
+
+//fsync策略
+enum LOG_FSYNC_POLICY
+{
+    LOG_FSYNC_NONE = 0, //不主动同步，由内核决定何时写回
+    LOG_FSYNC_PERIODIC, //距上次同步超过指定间隔后，在下一批写完时调用fdatasync
+    LOG_FSYNC_BATCH     //每批写完都调用fdatasync
+};
+
+class log_file
+{
+public:
+    log_file();
+    ~log_file();
+
+    log_file(const log_file &) = delete;
+    log_file &operator=(const log_file &) = delete;
+
+    //日志文件名为 dir_name + 年_月_日_ + log_name，同一天内超过split_size字节后依次加后缀.1、.2...
+    // split_size为0表示不按大小切换；一批数据不会被拆到两个文件中，文件最多超出split_size一批的大小
+    bool open(const char *dir_name, const char *log_name, long long split_size);
+
+    void set_fsync_policy(int policy, int interval_ms);
+
+    //切换文件后在写日志的线程中调用callback，异步模式下即后台写线程
+    void set_rotate_callback(log_rotate_callback callback, void *arg);
+
+    const char *dir_name() const
+    {
+        return m_dir_name;
+    }
+    const char *log_name() const
+    {
+        return m_log_name;
+    }
+    //当前正在写入的文件
+    const char *path() const
+    {
+        return m_path;
+    }
+
+    //写入一批完整的日志行，写入前按日期和大小检查是否需要切换文件，全部写入时返回true
+    bool write(const struct iovec *iov, int iovcnt);
+    bool write(const char *data, size_t len)
+    {
+        struct iovec iov;
+        iov.iov_base = (void *)data;
+        iov.iov_len = len;
+        return write(&iov, 1);
+    }
+
+    //一批数据写完后调用，按fsync策略决定是否同步到磁盘
+    void sync(long long now_ms);
+
+    void close();
+
+private:
+    //打开now所在日期、编号为m_index的文件，文件已经写满时继续尝试下一个编号
+    bool open_file(time_t now);
+    void rotate_if_needed(time_t now, size_t len);
+
+private:
+    char m_dir_name[128];
+    char m_log_name[128];
+    char m_path[300];
+    int m_fd;
+    long long m_split_size; //单个文件的最大字节数
+    long long m_size;       //当前文件的字节数
+    int m_index;            //当前文件在当天的编号，0表示不带后缀
+    time_t m_day_end;       //当天结束的时间，超过后切换到新一天的日志文件
+    int m_fsync_policy;
+    int m_fsync_interval;   //LOG_FSYNC_PERIODIC的同步间隔(ms)
+    long long m_last_sync;  //上次同步的时间(ms)
+    bool m_dirty;           //上次同步后是否写入过数据
+    log_rotate_callback m_rotate_callback;
+    void *m_rotate_arg;
+};
+
+#endif
@@ -0,0 +1,363 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <stddef.h>
+#include "log_format.h"
+
+//格式串中的长度修饰符
+enum LENGTH_MODIFIER
+{
+    LEN_NONE = 0,
+    LEN_HH,
+    LEN_H,
+    LEN_L,
+    LEN_LL,
+    LEN_J,
+    LEN_Z,
+    LEN_T,
+    LEN_LONG_DOUBLE
+};
+
+//编码后的一个参数
+struct log_arg
+{
+    int type;
+    int64_t i;
+    double d;
+    const char *s;
+    uint32_t len;
+};
+
+//从编码后的参数中取出下一个参数，参数已经取完时返回false
+static bool next_arg(const char *&args, const char *args_end, log_arg &arg)
+{
+    if (args >= args_end)
+    {
+        return false;
+    }
+    arg.type = *args++;
+    switch (arg.type)
+    {
+    case LOG_ARG_INT:
+    case LOG_ARG_UINT:
+    case LOG_ARG_POINTER:
+        if (args_end - args < (long)sizeof(int64_t))
+        {
+            return false;
+        }
+        memcpy(&arg.i, args, sizeof(int64_t));
+        args += sizeof(int64_t);
+        return true;
+    case LOG_ARG_DOUBLE:
+        if (args_end - args < (long)sizeof(double))
+        {
+            return false;
+        }
+        memcpy(&arg.d, args, sizeof(double));
+        args += sizeof(double);
+        return true;
+    case LOG_ARG_STRING:
+        if (args_end - args < (long)sizeof(uint32_t))
+        {
+            return false;
+        }
+        memcpy(&arg.len, args, sizeof(uint32_t));
+        args += sizeof(uint32_t);
+        if (args_end - args < (long)arg.len)
+        {
+            return false;
+        }
+        arg.s = args;
+        args += arg.len;
+        return true;
+    case LOG_ARG_NULL_STRING:
+        arg.s = NULL;
+        arg.len = 0;
+        return true;
+    default:
+        args = args_end;
+        return false;
+    }
+}
+
+//按原格式串中的长度修饰符截断整数，得到与vsnprintf读取到的相同的值
+static long long signed_value(int64_t v, int length)
+{
+    switch (length)
+    {
+    case LEN_HH:
+        return (signed char)v;
+    case LEN_H:
+        return (short)v;
+    case LEN_NONE:
+        return (int)v;
+    case LEN_L:
+        return (long)v;
+    case LEN_Z:
+        return (ssize_t)v;
+    case LEN_T:
+        return (ptrdiff_t)v;
+    default:
+        return (long long)v;
+    }
+}
+
+static unsigned long long unsigned_value(int64_t v, int length)
+{
+    switch (length)
+    {
+    case LEN_HH:
+        return (unsigned char)v;
+    case LEN_H:
+        return (unsigned short)v;
+    case LEN_NONE:
+        return (unsigned int)v;
+    case LEN_L:
+        return (unsigned long)v;
+    case LEN_Z:
+        return (size_t)v;
+    default:
+        return (unsigned long long)v;
+    }
+}
+
+int format_deferred(char *out, int size, const char *format, const char *args, const char *args_end)
+{
+    if (size <= 0)
+    {
+        return 0;
+    }
+    int limit = size - 1;
+    int n = 0;
+    const char *p = format;
+
+    while (*p && n < limit)
+    {
+        //普通字符直接复制到下一个'%'
+        if (*p != '%')
+        {
+            const char *next = strchr(p, '%');
+            int len = next ? (int)(next - p) : (int)strlen(p);
+            int copy = len < limit - n ? len : limit - n;
+            memcpy(out + n, p, copy);
+            n += copy;
+            p += len;
+            continue;
+        }
+
+        const char *spec_begin = p++;
+        if (*p == '%')
+        {
+            out[n++] = '%';
+            p++;
+            continue;
+        }
+
+        //重新拼出转换说明：标志和宽度照抄，精度单独记录，长度修饰符按编码后的类型重写
+        char spec[64];
+        int sl = 0;
+        spec[sl++] = '%';
+        while (*p && strchr("-+ #0'", *p) && sl < 16)
+        {
+            spec[sl++] = *p++;
+        }
+        log_arg arg;
+        if (*p == '*')
+        {
+            p++;
+            if (!next_arg(args, args_end, arg))
+            {
+                break;
+            }
+            sl += snprintf(spec + sl, sizeof(spec) - sl, "%d", (int)arg.i);
+        }
+        else
+        {
+            while (*p >= '0' && *p <= '9' && sl < 40)
+            {
+                spec[sl++] = *p++;
+            }
+        }
+        bool has_precision = false;
+        int precision = 0;
+        if (*p == '.')
+        {
+            p++;
+            if (*p == '*')
+            {
+                p++;
+                if (!next_arg(args, args_end, arg))
+                {
+                    break;
+                }
+                //精度为负数时视为没有指定精度
+                if ((int)arg.i >= 0)
+                {
+                    has_precision = true;
+                    precision = (int)arg.i;
+                }
+            }
+            else
+            {
+                has_precision = true;
+                while (*p >= '0' && *p <= '9')
+                {
+                    precision = precision * 10 + (*p++ - '0');
+                }
+            }
+        }
+
+        int length = LEN_NONE;
+        switch (*p)
+        {
+        case 'h':
+            p++;
+            length = LEN_H;
+            if (*p == 'h')
+            {
+                p++;
+                length = LEN_HH;
+            }
+            break;
+        case 'l':
+            p++;
+            length = LEN_L;
+            if (*p == 'l')
+            {
+                p++;
+                length = LEN_LL;
+            }
+            break;
+        case 'q':
+            p++;
+            length = LEN_LL;
+            break;
+        case 'j':
+            p++;
+            length = LEN_J;
+            break;
+        case 'z':
+            p++;
+            length = LEN_Z;
+            break;
+        case 't':
+            p++;
+            length = LEN_T;
+            break;
+        case 'L':
+            p++;
+            length = LEN_LONG_DOUBLE;
+            break;
+        }
+
+        char conv = *p;
+        if (conv == '\0')
+        {
+            break;
+        }
+        p++;
+        if (has_precision && conv != 's')
+        {
+            sl += snprintf(spec + sl, sizeof(spec) - sl, ".%d", precision);
+        }
+
+        if (!next_arg(args, args_end, arg))
+        {
+            //参数不足，原样输出剩余的转换说明
+            int len = (int)(p - spec_begin);
+            int copy = len < limit - n ? len : limit - n;
+            memcpy(out + n, spec_begin, copy);
+            n += copy;
+            continue;
+        }
+
+        int ret = 0;
+        switch (conv)
+        {
+        case 'd':
+        case 'i':
+            spec[sl++] = 'l';
+            spec[sl++] = 'l';
+            spec[sl++] = conv;
+            spec[sl] = '\0';
+            ret = snprintf(out + n, size - n, spec, arg.type == LOG_ARG_DOUBLE ? 0LL : signed_value(arg.i, length));
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            spec[sl++] = 'l';
+            spec[sl++] = 'l';
+            spec[sl++] = conv;
+            spec[sl] = '\0';
+            ret = snprintf(out + n, size - n, spec, arg.type == LOG_ARG_DOUBLE ? 0ULL : unsigned_value(arg.i, length));
+            break;
+        case 'c':
+            spec[sl++] = 'c';
+            spec[sl] = '\0';
+            ret = snprintf(out + n, size - n, spec, (int)arg.i);
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec[sl++] = conv;
+            spec[sl] = '\0';
+            ret = snprintf(out + n, size - n, spec, arg.type == LOG_ARG_DOUBLE ? arg.d : (double)arg.i);
+            break;
+        case 's':
+            if (arg.type == LOG_ARG_NULL_STRING)
+            {
+                if (has_precision)
+                {
+                    sl += snprintf(spec + sl, sizeof(spec) - sl, ".%d", precision);
+                }
+                spec[sl++] = 's';
+                spec[sl] = '\0';
+                ret = snprintf(out + n, size - n, spec, (const char *)NULL);
+            }
+            else if (arg.type == LOG_ARG_STRING)
+            {
+                //编码后的字符串不以'\0'结尾，用精度限制输出长度
+                int len = (int)arg.len;
+                if (has_precision && precision < len)
+                {
+                    len = precision;
+                }
+                spec[sl++] = '.';
+                spec[sl++] = '*';
+                spec[sl++] = 's';
+                spec[sl] = '\0';
+                ret = snprintf(out + n, size - n, spec, len, arg.s);
+            }
+            break;
+        case 'p':
+            spec[sl++] = 'p';
+            spec[sl] = '\0';
+            ret = snprintf(out + n, size - n, spec, (void *)(uintptr_t)arg.i);
+            break;
+        case 'n':
+            break;
+        default:
+        {
+            //不认识的转换说明原样输出
+            int len = (int)(p - spec_begin);
+            int copy = len < limit - n ? len : limit - n;
+            memcpy(out + n, spec_begin, copy);
+            n += copy;
+            continue;
+        }
+        }
+        if (ret > 0)
+        {
+            n += ret < limit - n ? ret : limit - n;
+        }
+    }
+
+    out[n] = '\0';
+    return n;
+}
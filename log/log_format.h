@@ -0,0 +1,172 @@
+#ifndef _LOG_FORMAT_H_
+#define _LOG_FORMAT_H_
+/*************************************************************
+*延迟格式化日志的记录格式
+*写日志的线程只记录格式串编号、时间戳和参数的原始字节，由后台写线程调用format_deferred
+*按格式串还原出与vsnprintf完全相同的文本
+**************************************************************/
+
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+//环形缓冲区中每条记录的头部
+struct log_record
+{
+    uint32_t len;    //整条记录的长度，包括头部
+    uint16_t type;   //LOG_RECORD_TEXT或LOG_RECORD_DEFERRED
+    uint16_t level;  //日志级别
+    uint32_t fmt_id; //格式串编号，仅LOG_RECORD_DEFERRED有效
+    uint32_t usec;   //时间戳
+    int64_t sec;
+};
+
+enum LOG_RECORD_TYPE
+{
+    LOG_RECORD_TEXT = 0,    //头部之后是已经格式化好的一行日志
+    LOG_RECORD_DEFERRED     //头部之后是编码后的参数
+};
+
+//参数的类型标记，每个参数编码为1字节标记 + 数据
+enum LOG_ARG_TYPE
+{
+    LOG_ARG_INT = 0,     //int64_t
+    LOG_ARG_UINT,        //uint64_t
+    LOG_ARG_DOUBLE,      //double
+    LOG_ARG_STRING,      //uint32_t长度 + 字符串内容
+    LOG_ARG_NULL_STRING, //空指针，无数据
+    LOG_ARG_POINTER      //uint64_t
+};
+
+//把参数依次编码到一段定长缓冲区中，空间不足时截断字符串，其余参数丢弃
+class log_arg_writer
+{
+public:
+    log_arg_writer(char *begin, char *end) : m_pos(begin), m_end(end) {}
+
+    char *pos() const
+    {
+        return m_pos;
+    }
+
+    void put_int(int64_t v)
+    {
+        put_fixed(LOG_ARG_INT, &v, sizeof(v));
+    }
+    void put_uint(uint64_t v)
+    {
+        put_fixed(LOG_ARG_UINT, &v, sizeof(v));
+    }
+    void put_double(double v)
+    {
+        put_fixed(LOG_ARG_DOUBLE, &v, sizeof(v));
+    }
+    void put_pointer(const void *p)
+    {
+        uint64_t v = (uint64_t)(uintptr_t)p;
+        put_fixed(LOG_ARG_POINTER, &v, sizeof(v));
+    }
+    void put_string(const char *s)
+    {
+        if (!s)
+        {
+            if (m_end - m_pos >= 1)
+            {
+                *m_pos++ = LOG_ARG_NULL_STRING;
+            }
+            return;
+        }
+        if (m_end - m_pos < 1 + (long)sizeof(uint32_t))
+        {
+            return;
+        }
+        size_t room = m_end - m_pos - 1 - sizeof(uint32_t);
+        const char *end = (const char *)memchr(s, '\0', room);
+        uint32_t len = end ? (uint32_t)(end - s) : (uint32_t)room;
+        *m_pos++ = LOG_ARG_STRING;
+        memcpy(m_pos, &len, sizeof(len));
+        m_pos += sizeof(len);
+        memcpy(m_pos, s, len);
+        m_pos += len;
+    }
+
+private:
+    void put_fixed(char type, const void *v, size_t size)
+    {
+        if (m_end - m_pos < (long)(1 + size))
+        {
+            return;
+        }
+        *m_pos++ = type;
+        memcpy(m_pos, v, size);
+        m_pos += size;
+    }
+
+private:
+    char *m_pos;
+    char *m_end;
+};
+
+//按参数的静态类型选择编码方式，类型在编译期确定，写日志时不需要解析格式串
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+encode_log_arg(log_arg_writer &w, T v)
+{
+    w.put_int((int64_t)v);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+encode_log_arg(log_arg_writer &w, T v)
+{
+    w.put_uint((uint64_t)v);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_enum<T>::value>::type
+encode_log_arg(log_arg_writer &w, T v)
+{
+    w.put_int((int64_t)v);
+}
+
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+encode_log_arg(log_arg_writer &w, T v)
+{
+    w.put_double((double)v);
+}
+
+inline void encode_log_arg(log_arg_writer &w, const char *s)
+{
+    w.put_string(s);
+}
+
+inline void encode_log_arg(log_arg_writer &w, char *s)
+{
+    w.put_string(s);
+}
+
+template <typename T>
+inline void encode_log_arg(log_arg_writer &w, T *p)
+{
+    w.put_pointer(p);
+}
+
+inline void encode_log_args(log_arg_writer &)
+{
+}
+
+template <typename T, typename... Args>
+inline void encode_log_args(log_arg_writer &w, T v, Args... args)
+{
+    encode_log_arg(w, v);
+    encode_log_args(w, args...);
+}
+
+/**
+ * 按格式串和编码后的参数生成文本，写入out，最多size-1个字符并以'\0'结尾
+ * 返回写入的字符数，结果与用原始参数调用vsnprintf后截断到size-1相同
+*/
+int format_deferred(char *out, int size, const char *format, const char *args, const char *args_end);
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef _MPSC_QUEUE_H_
+#define _MPSC_QUEUE_H_
+/*************************************************************
+*有界的多生产者单消费者无锁队列，接口与block_queue相同
+*每个槽位带一个序号，生产者用CAS抢占写入位置，消费者独占读取位置，放入和取出都不加锁
+*队列为空时消费者先短暂自旋，再在futex上休眠；生产者只在消费者休眠时才调用futex唤醒
+**************************************************************/
+
+#include <atomic>
+#include <stddef.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+template <typename T>
+class mpsc_queue
+{
+private:
+    struct cell
+    {
+        std::atomic<size_t> seq; // 等于写入位置时可写，等于写入位置+1时可读
+        T data;
+    };
+
+    // 休眠前自旋检查的次数
+    static const int SPIN_COUNT = 64;
+
+    cell *m_cells;
+    size_t m_capacity;
+    size_t m_mask;
+    alignas(64) std::atomic<size_t> m_tail;  // 生产者写入位置
+    alignas(64) std::atomic<size_t> m_head;  // 消费者读取位置
+    alignas(64) std::atomic<int> m_parked;   // 消费者是否在futex上休眠
+    std::atomic<bool> m_closed;
+
+public:
+    // max_size会向上取整为2的幂
+    mpsc_queue(int max_size = 1024) : m_tail(0), m_head(0), m_parked(0), m_closed(false)
+    {
+        if (max_size <= 0)
+        {
+            exit(-1);
+        }
+        m_capacity = 1;
+        while (m_capacity < (size_t)max_size)
+        {
+            m_capacity <<= 1;
+        }
+        m_mask = m_capacity - 1;
+        m_cells = new cell[m_capacity];
+        for (size_t i = 0; i < m_capacity; i++)
+        {
+            m_cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    ~mpsc_queue()
+    {
+        delete[] m_cells;
+    }
+
+    mpsc_queue(const mpsc_queue &) = delete;
+    mpsc_queue &operator=(const mpsc_queue &) = delete;
+
+    int max_size() const
+    {
+        return (int)m_capacity;
+    }
+
+    // 近似的元素个数
+    int size() const
+    {
+        size_t tail = m_tail.load(std::memory_order_acquire);
+        size_t head = m_head.load(std::memory_order_acquire);
+        return tail > head ? (int)(tail - head) : 0;
+    }
+
+    bool full() const
+    {
+        return size() >= (int)m_capacity;
+    }
+
+    // 关闭队列，唤醒消费者，之后pop在队列为空时立即返回false
+    void close()
+    {
+        m_closed.store(true);
+        wake();
+    }
+
+    // 任意线程调用：放入一个元素，队列已满时返回false
+    bool push(const T &item)
+    {
+        size_t pos = m_tail.load(std::memory_order_relaxed);
+        cell *c;
+        for (;;)
+        {
+            c = &m_cells[pos & m_mask];
+            size_t seq = c->seq.load(std::memory_order_acquire);
+            long diff = (long)(seq - pos);
+            if (diff == 0)
+            {
+                if (m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = m_tail.load(std::memory_order_relaxed);
+            }
+        }
+        c->data = item;
+        c->seq.store(pos + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    // 仅消费者线程调用：队列为空时立即返回false
+    bool try_pop(T &item)
+    {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        cell *c = &m_cells[pos & m_mask];
+        if (c->seq.load(std::memory_order_acquire) != pos + 1)
+        {
+            return false;
+        }
+        item = c->data;
+        c->seq.store(pos + m_capacity, std::memory_order_release);
+        m_head.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 仅消费者线程调用：队列为空时等待，关闭后返回false
+    bool pop(T &item)
+    {
+        return wait_pop(item, -1);
+    }
+
+    // 仅消费者线程调用：最多等待ms_timeout毫秒
+    bool pop(T &item, int ms_timeout)
+    {
+        return wait_pop(item, ms_timeout);
+    }
+
+private:
+    static long long monotonic_ns()
+    {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (long long)t.tv_sec * 1000000000LL + t.tv_nsec;
+    }
+
+    // 生产者放入元素后调用：与消费者的休眠检查构成Dekker式的配对，两者至少有一方看到对方的写入
+    void wake()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_parked.load(std::memory_order_relaxed) && m_parked.exchange(0) == 1)
+        {
+            syscall(SYS_futex, (int *)&m_parked, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        }
+    }
+
+    bool wait_pop(T &item, int ms_timeout)
+    {
+        long long deadline = ms_timeout >= 0 ? monotonic_ns() + (long long)ms_timeout * 1000000 : 0;
+        for (;;)
+        {
+            for (int i = 0; i < SPIN_COUNT; i++)
+            {
+                if (try_pop(item))
+                {
+                    return true;
+                }
+            }
+            if (m_closed.load())
+            {
+                return try_pop(item);
+            }
+
+            //先声明要休眠，再检查一次，避免与生产者的唤醒错过
+            m_parked.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (try_pop(item))
+            {
+                m_parked.store(0, std::memory_order_relaxed);
+                return true;
+            }
+            if (m_closed.load())
+            {
+                m_parked.store(0, std::memory_order_relaxed);
+                continue;
+            }
+
+            struct timespec t;
+            struct timespec *timeout = NULL;
+            if (ms_timeout >= 0)
+            {
+                long long left = deadline - monotonic_ns();
+                if (left <= 0)
+                {
+                    m_parked.store(0, std::memory_order_relaxed);
+                    return try_pop(item);
+                }
+                t.tv_sec = left / 1000000000LL;
+                t.tv_nsec = left % 1000000000LL;
+                timeout = &t;
+            }
+            //m_parked已被生产者清零时立即返回
+            syscall(SYS_futex, (int *)&m_parked, FUTEX_WAIT_PRIVATE, 1, timeout, NULL, 0);
+            m_parked.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+#endif
@@ -10,29 +10,122 @@
 #include <stdlib.h>
 #include <cassert>
 #include <sys/epoll.h>
+#include <sys/mman.h>
+#include <new>
 
 #include "./lock/locker.h"
 #include "./threadpool/threadpool.h"
+#include "./threadpool/affinity.h"
 #include "./http/http_conn.h"
 #include "./log/log.h"
+#include "./log/access_log.h"
+#include "./metrics/metrics.h"
+#include "./profiler/profiler.h"
+#include "./admin/admin_server.h"
+#include "./config/server_config.h"
 #include "./timer/lst_timer.h"
+#include "./timer/heap_timer.h"
+#include "./timer/wheel_timer.h"
 
 #define MAX_FD 65535        // 最大文件描述符
 #define MAX_EVENT_NUMBER 10000      // 最大事件数
 #define TIMESLOT 5             //最小超时单位
+#define HIGH_LANE_WEIGHT 4      //高优先级通道的出队权重
+#define LOW_LANE_WEIGHT 1       //低优先级通道的出队权重
+// 以下带#ifndef的参数可在编译时用-D覆盖，stress_test/mode_bench据此构建不同的模式做对比
+// 其中线程数、队列长度、触发模式、日志模式、超时、网站根目录和定时器容器只是默认值，运行时可用命令行或配置文件修改，见server_config.h
+#ifndef THREAD_NUMBER
+#define THREAD_NUMBER 8         //解析请求的线程数
+#endif
+#ifndef IO_THREAD_NUMBER
+#define IO_THREAD_NUMBER 4      //执行阻塞文件操作的I/O线程数
+#endif
+#ifndef QUEUE_SIZE
+#define QUEUE_SIZE 10000        //每个线程池请求队列的最大长度
+#endif
+#ifndef CONN_TRIGGER
+#define CONN_TRIGGER "lt"       //连接socket的触发模式："lt"水平触发、"et"边缘触发
+#endif
+#ifndef LISTEN_TRIGGER
+#define LISTEN_TRIGGER "lt"     //监听socket的触发模式，同上
+#endif
+#ifndef READ_BUDGET
+#define READ_BUDGET 0           //边缘触发时一次读事件最多读取的字节数，避免一个连接占住事件循环；0为读到EAGAIN或读缓冲区满
+#endif
+#ifndef CONN_TIMEOUT
+#define CONN_TIMEOUT (3 * TIMESLOT)     //连接空闲超时(s)
+#endif
+#ifndef DOC_ROOT
+#define DOC_ROOT "./root"       //网站的根目录，相对路径从服务器的工作目录算起
+#endif
+#define SHUTDOWN_TIMEOUT 3000   //退出时等待线程池处理完已有请求的最长时间(ms)
+#ifndef LOOP_CPU
+#define LOOP_CPU -1             //事件循环绑定的CPU，-1为不绑定
+#endif
+#ifndef WORKER_CPUS
+#define WORKER_CPUS ""          //解析线程绑定的CPU列表，格式同taskset -c，或"node:N"表示NUMA节点N的所有CPU；空为不绑定
+#endif
+#ifndef IO_CPUS
+#define IO_CPUS ""              //I/O线程绑定的CPU列表，格式同上
+#endif
 
+#if !defined(SYNLOG) && !defined(ASYNLOG) && !defined(DEFERLOG)
 #define SYNLOG  //同步写日志
 //#define ASYNLOG //异步写日志
+//#define DEFERLOG //异步写日志，格式化也延迟到后台写线程中进行
+#endif
+#if defined(ASYNLOG)
+#define LOG_MODE "async"
+#elif defined(DEFERLOG)
+#define LOG_MODE "defer"
+#else
+#define LOG_MODE "sync"
+#endif
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO        //运行期日志级别，请求路径上的逐行日志为DEBUG级别
+#endif
+#define LOG_FLUSH_INTERVAL 1000         //日志按时间刷新的间隔(ms)
+#define LOG_FLUSH_SIZE (64 * 1024)      //未刷新的日志超过该大小时刷新
+#define LOG_SPLIT_SIZE (64LL * 1024 * 1024) //单个日志文件的最大字节数，超过后切换到新文件
+#define LOG_OVERFLOW LOG_OVERFLOW_DROP_LEVEL //异步日志缓冲区写满时的处理方式，见LOG_OVERFLOW_POLICY
+#define LOG_FSYNC LOG_FSYNC_NONE        //日志fsync策略：LOG_FSYNC_NONE、LOG_FSYNC_PERIODIC、LOG_FSYNC_BATCH
+#define LOG_FSYNC_INTERVAL 1000         //LOG_FSYNC_PERIODIC的同步间隔(ms)
+#define LOG_COMPRESS false              //用gzip压缩本进程切换出去的日志文件
+#define LOG_MAX_AGE_DAYS 0              //日志最多保留的天数，0为不限
+#define LOG_MAX_TOTAL_SIZE 0            //日志最多占用的字节数，0为不限
+#define LOG_COMPRESS_RATE (4 * 1024 * 1024)      //压缩时每秒最多读取的字节数，0为不限速
+#define LOG_SCAN_EXISTING false         //启动时接管目录中已有的日志，一并压缩和按上面的策略删除
+#define ACCESS_LOG          //记录访问日志，每个请求一条，写入单独的AccessLog文件
+#define ACCESS_LOG_FORMAT ACCESS_FORMAT_JSON    //访问日志格式：ACCESS_FORMAT_JSON或ACCESS_FORMAT_CLF
+#ifndef ACCESS_LOG_SAMPLE
+#define ACCESS_LOG_SAMPLE 100           //每100个正常请求记录一条，0为只记录出错和慢请求
+#endif
+#define ACCESS_LOG_SLOW_MS 200          //耗时不少于该值(ms)的请求总是记录
+#define METRICS_PATH "/metrics"         //以Prometheus文本格式返回统计指标的URL，注释掉则不提供
+#define WORKER_STALL_MS 5000          //线程池中一个任务执行超过该时间(ms)时报告卡住的线程及其调用栈，0为不检查
+#define WORKER_REPLACE true             //是否创建新线程顶替卡住的线程，保持线程池的处理能力
+#define ADMIN_SOCKET "admin.sock"       //管理接口的unix域套接字，发送help查看命令，注释掉则不提供
+#define CONN_TRACE_SLOW_MS 0            //请求耗时不少于该值(ms)时把连接上的事件记录追加到ConnTrace.json，0为不记录
+#ifndef TIMER_CONTAINER
+#define TIMER_CONTAINER "wheel"         //定时器容器："list"升序链表、"heap2"二叉堆、"heap4"4叉堆、"wheel"时间轮，性能见bench/timer_bench
+#endif
+#define TIMER_WHEEL_SLOTS 64            //时间轮的槽数(每槽1秒)，应不小于连接的空闲超时
 
 //这三个函数在http_conn.cpp中定义，改变链接属性
-extern int addfd(int epollfd, int fd, bool one_shot);
+extern int addfd(int epollfd, int fd, bool one_shot, bool et);
 extern int removefd(int epollfd, int fd);
 extern int setnonblocking(int fd);
 
 //设置定时器相关参数
 static int pipefd[2];
-static sort_timer_lst timer_lst;    //创建定时器容器链表
+static timer_container *timer_lst = NULL;   //定时器容器，由config.timer选择
 static int epollfd = 0;
+static http_conn *users = NULL;     //以文件描述符为下标的连接对象
+static server_config config;        //运行期配置
+
+//事件循环更新的统计指标
+static int metric_accepted = -1;
+static int metric_timers = -1;
 
 //信号处理函数
 void sig_handler(int sig)
@@ -68,19 +161,248 @@ void addsig(int sig, void( handler )(int), bool restart = true)
 //定时处理任务，重新定时以不断触发SIGALRM信号
 void timer_handler()
 {
-    timer_lst.tick();
+    timer_lst->tick();
+    Log::get_instance()->tick();
     alarm(TIMESLOT);
 }
 
+//按名称创建定时器容器，名称无效时返回NULL
+static timer_container *create_timer_container(const char *name)
+{
+    if (strcmp(name, "list") == 0)
+        return new sort_timer_lst;
+    if (strcmp(name, "heap2") == 0)
+        return new heap_timer<2>;
+    if (strcmp(name, "heap4") == 0)
+        return new heap_timer<4>;
+    if (strcmp(name, "wheel") == 0)
+        return new wheel_timer(TIMER_WHEEL_SLOTS);
+    return NULL;
+}
+
+//分配MAX_FD个连接对象，node>=0时从该NUMA节点分配
+//先映射尚未访问过的内存并设置内存策略，再逐个构造，物理页在构造时才按策略分配
+static http_conn *create_users(int node)
+{
+    size_t len = sizeof(http_conn) * MAX_FD;
+    void *mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        return NULL;
+    }
+    if (node >= 0 && !bind_memory_to_node(mem, len, node))
+    {
+        printf("bind connections to numa node %d failed\n", node);
+    }
+    http_conn *conns = (http_conn *)mem;
+    for (int i = 0; i < MAX_FD; i++)
+    {
+        new (conns + i) http_conn;
+    }
+    return conns;
+}
+
+static void destroy_users(http_conn *conns)
+{
+    for (int i = 0; i < MAX_FD; i++)
+    {
+        conns[i].~http_conn();
+    }
+    munmap(conns, sizeof(http_conn) * MAX_FD);
+}
+
 //定时器回调函数，删除非活动连接在socket上的注册事件，并关闭
+//通过close_conn关闭，连接对象随之标记为已关闭，已被关闭过的连接不会重复关闭和计数
 void cb_func(client_data *user_data)
 {
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
-    close(user_data->sockfd);
-    http_conn::m_user_count--;
-    LOG_INFO("close fd %d", user_data->sockfd);
-    Log::get_instance()->flush();
+    users[user_data->sockfd].close_conn();
+    metrics::get_instance()->add(metric_timers, -1);
+    LOG_DEBUG("close fd %d", user_data->sockfd);
+}
+
+static long long sample_queue_size(void *pool)
+{
+    return ((threadpool<http_conn> *)pool)->queue_size();
+}
+
+static long long sample_active(void *pool)
+{
+    return ((threadpool<http_conn> *)pool)->active();
+}
+
+static long long sample_stalls(void *pool)
+{
+    return ((threadpool<http_conn> *)pool)->stalls();
+}
+
+static long long sample_lost(void *pool)
+{
+    return ((threadpool<http_conn> *)pool)->lost();
+}
+
+//看门狗报告卡住的工作线程
+static void on_worker_stall(const stall_info<http_conn> &info)
+{
+    char conn[512] = "none";
+    if (info.request)
+    {
+        info.request->describe(conn, sizeof(conn));
+    }
+    LOG_WARN("%s thread %d (tid %d) stalled %lldms%s, %s\n%s", info.pool, info.worker, (int)info.tid, info.stalled_ms,
+             info.replaced ? ", replaced" : "", conn, info.stack.c_str());
+}
+
+static long long sample_log_dropped(void *)
+{
+    return Log::get_instance()->get_dropped();
+}
+
+//注册统计指标，需在线程池创建之后、开始接受连接之前调用
+static void register_metrics(threadpool<http_conn> *pool, threadpool<http_conn> *io_pool)
+{
+    metrics *m = metrics::get_instance();
+    metric_accepted = m->add_counter("webserver_accepted_connections_total", "Accepted client connections.");
+    metric_timers = m->add_gauge("webserver_timers", "Connection timers in the timer container.");
+    m->add_sampled("webserver_queue_depth{pool=\"worker\"}", "Tasks waiting in a thread pool queue.", METRIC_GAUGE, sample_queue_size, pool);
+    m->add_sampled("webserver_queue_depth{pool=\"io\"}", "Tasks waiting in a thread pool queue.", METRIC_GAUGE, sample_queue_size, io_pool);
+    m->add_sampled("webserver_busy_threads{pool=\"worker\"}", "Threads running a task.", METRIC_GAUGE, sample_active, pool);
+    m->add_sampled("webserver_busy_threads{pool=\"io\"}", "Threads running a task.", METRIC_GAUGE, sample_active, io_pool);
+    m->add_sampled("webserver_worker_stalls_total{pool=\"worker\"}", "Tasks that ran longer than the stall threshold.", METRIC_COUNTER, sample_stalls, pool);
+    m->add_sampled("webserver_worker_stalls_total{pool=\"io\"}", "Tasks that ran longer than the stall threshold.", METRIC_COUNTER, sample_stalls, io_pool);
+    m->add_sampled("webserver_workers_replaced_total{pool=\"worker\"}", "Stalled threads replaced by a new thread.", METRIC_COUNTER, sample_lost, pool);
+    m->add_sampled("webserver_workers_replaced_total{pool=\"io\"}", "Stalled threads replaced by a new thread.", METRIC_COUNTER, sample_lost, io_pool);
+    m->add_sampled("webserver_log_dropped_lines_total", "Log lines dropped because a log buffer was full.", METRIC_COUNTER, sample_log_dropped, NULL);
+    http_conn::register_metrics();
+    if (CONN_TRACE_SLOW_MS > 0 && conn_trace::open("ConnTrace.json"))
+    {
+        http_conn::m_trace_threshold_us = CONN_TRACE_SLOW_MS * 1000LL;
+    }
+#ifdef METRICS_PATH
+    http_conn::m_metrics_path = METRICS_PATH;
+#endif
+}
+
+//管理接口的命令
+static void admin_conns(std::string &out, const char *, void *)
+{
+    long long now = http_conn::now();
+    char line[64];
+    snprintf(line, sizeof(line), "connections: %d\n", http_conn::m_user_count.load());
+    out += line;
+    for (int fd = 0; fd < MAX_FD; fd++)
+    {
+        if (users[fd].is_open())
+        {
+            users[fd].append_state(out, now);
+        }
+    }
+}
+
+static void admin_timers(std::string &out, const char *, void *)
+{
+    char line[96];
+    time_t next = timer_lst->next_expire();
+    if (next)
+    {
+        snprintf(line, sizeof(line), "timers: %d container=%s next_expire_in_s=%ld\n", timer_lst->size(), config.timer.c_str(), (long)(next - time(NULL)));
+    }
+    else
+    {
+        snprintf(line, sizeof(line), "timers: %d container=%s\n", timer_lst->size(), config.timer.c_str());
+    }
+    out += line;
+}
+
+static void admin_pool(std::string &out, const char *, void *pool)
+{
+    ((threadpool<http_conn> *)pool)->describe(out);
+}
+
+//没有应答缓存，报告按URL记录的响应代价提示表
+static void admin_cache(std::string &out, const char *, void *)
+{
+    int used, capacity;
+    http_conn::cost_hint_usage(used, capacity);
+    char line[96];
+    snprintf(line, sizeof(line), "response cache: none\ncost hints: %d/%d\n", used, capacity);
+    out += line;
+}
+
+static void admin_log(std::string &out, const char *, void *)
+{
+    Log *log = Log::get_instance();
+    size_t used, capacity;
+    int rings;
+    log->get_queue_fill(used, capacity, rings);
+    char line[192];
+    snprintf(line, sizeof(line), "log buffers: %d used=%zu capacity=%zu dropped=%llu sync_writes=%llu blocked=%llu\n",
+             rings, used, capacity, log->get_dropped(), log->get_sync_writes(), log->get_blocked());
+    out += line;
+}
+
+static void admin_config(std::string &out, const char *, void *)
+{
+    config.describe(out);
+}
+
+static void admin_metrics(std::string &out, const char *, void *)
+{
+    metrics::get_instance()->render(out);
+}
+
+//控制采样剖析器：start 秒数 [频率]、stop、dump（折叠格式的调用栈，可交给flamegraph.pl），不带参数时返回是否在采样
+static void admin_profile(std::string &out, const char *args, void *)
+{
+    int seconds = 0;
+    int hz = profiler::DEFAULT_HZ;
+    if (sscanf(args, "start %d %d", &seconds, &hz) >= 1)
+    {
+        if (seconds <= 0 || hz <= 0)
+        {
+            out += "usage: profile start <seconds> [hz]\n";
+            return;
+        }
+        out += profiler::start(seconds * 1000, hz) ? "started\n" : "already running\n";
+    }
+    else if (strcmp(args, "stop") == 0)
+    {
+        profiler::stop();
+        out += "stopped\n";
+    }
+    else if (strcmp(args, "dump") == 0)
+    {
+        profiler::folded(out);
+    }
+    else if (args[0] == '\0')
+    {
+        out += profiler::running() ? "running\n" : "idle\n";
+    }
+    else
+    {
+        out += "usage: profile start <seconds> [hz] | profile stop | profile dump\n";
+    }
+}
+
+//注册管理接口的命令并启动服务线程
+static void start_admin(threadpool<http_conn> *pool, threadpool<http_conn> *io_pool)
+{
+#ifdef ADMIN_SOCKET
+    admin_server *admin = admin_server::get_instance();
+    admin->add_command("conns", "open connections: fd, peer, parse state, phase, bytes, idle time, url", admin_conns, NULL);
+    admin->add_command("timers", "timer count and time until the next expiry", admin_timers, NULL);
+    admin->add_command("pool", "worker pool queue and per-thread state", admin_pool, pool);
+    admin->add_command("io_pool", "io pool queue and per-thread state", admin_pool, io_pool);
+    admin->add_command("cache", "cache occupancy", admin_cache, NULL);
+    admin->add_command("log", "async log buffer fill and overflow counters", admin_log, NULL);
+    admin->add_command("config", "runtime configuration in config file format", admin_config, NULL);
+    admin->add_command("metrics", "all metrics in Prometheus text format", admin_metrics, NULL);
+    admin->add_command("profile", "sampling profiler: start <seconds> [hz], stop, dump (folded stacks)", admin_profile, NULL);
+    if (!admin->start(ADMIN_SOCKET))
+    {
+        LOG_WARN("admin socket %s unavailable: %s", ADMIN_SOCKET, strerror(errno));
+    }
+#endif
 }
 
 // 打印错误信息函数
@@ -93,21 +415,61 @@ void show_error(int connfd, const char* info)
 
 int main(int argc, char *argv[])
 {
-#ifdef ASYNLOG
-    Log::get_instance()->init("ServerLog", 2000, 800000, 8); //异步日志模型
-#endif
-
-#ifdef SYNLOG
-    Log::get_instance()->init("ServerLog", 2000, 800000, 0); //同步日志模型
-#endif
-    if (argc <= 2)
+    // 编译时的默认值，命令行和配置文件中的设置覆盖它们
+    config.threads = THREAD_NUMBER;
+    config.io_threads = IO_THREAD_NUMBER;
+    config.queue_size = QUEUE_SIZE;
+    config.conn_et = strcmp(CONN_TRIGGER, "et") == 0;
+    config.listen_et = strcmp(LISTEN_TRIGGER, "et") == 0;
+    config.log_mode = LOG_MODE;
+    config.read_budget = READ_BUDGET;
+    config.timeout = CONN_TIMEOUT;
+    config.doc_root = DOC_ROOT;
+    config.loop_cpu = LOOP_CPU;
+    config.worker_cpus = WORKER_CPUS;
+    config.io_cpus = IO_CPUS;
+    config.timer = TIMER_CONTAINER;
+    std::string error;
+    if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))
+    {
+        server_config::usage(basename(argv[0]));
+        return 0;
+    }
+    if (!config.parse_args(argc, argv, error))
     {
-        printf("usage: %s ip_address port_number\n", basename(argv[0]));
+        printf("%s\n", error.c_str());
+        server_config::usage(basename(argv[0]));
         return 1;
     }
 
-    const char* ip = argv[1];
-    int port = atoi(argv[2]);
+    if (config.log_mode == "async")
+    {
+        Log::get_instance()->init("ServerLog", 2000, LOG_SPLIT_SIZE, 8); //异步日志模型
+    }
+    else if (config.log_mode == "defer")
+    {
+        Log::get_instance()->init("ServerLog", 2000, LOG_SPLIT_SIZE, 8, true); //延迟格式化的异步日志模型
+    }
+    else
+    {
+        Log::get_instance()->init("ServerLog", 2000, LOG_SPLIT_SIZE, 0); //同步日志模型
+    }
+    Log::get_instance()->set_level(LOG_LEVEL);
+    Log::get_instance()->set_flush_policy(LOG_FLUSH_INTERVAL, LOG_FLUSH_SIZE, true);
+    Log::get_instance()->set_fsync_policy(LOG_FSYNC, LOG_FSYNC_INTERVAL);
+    Log::get_instance()->set_overflow_policy(LOG_OVERFLOW);
+#ifdef ACCESS_LOG
+    Log::get_instance()->init_access("AccessLog", LOG_SPLIT_SIZE);
+    access_log::configure(ACCESS_LOG_FORMAT, ACCESS_LOG_SAMPLE, ACCESS_LOG_SLOW_MS);
+#endif
+    Log::get_instance()->set_archive_policy(LOG_COMPRESS, LOG_MAX_AGE_DAYS, LOG_MAX_TOTAL_SIZE, LOG_COMPRESS_RATE,
+                                            LOG_SCAN_EXISTING);
+
+    const char* ip = config.ip.c_str();
+    int port = config.port;
+    http_conn::m_et = config.conn_et;
+    http_conn::m_read_budget = config.read_budget;
+    http_conn::m_doc_root = config.doc_root.c_str();
 
     // 忽略SIGPIPE信号
     addsig(SIGPIPE, SIG_IGN);
@@ -116,17 +478,66 @@ int main(int argc, char *argv[])
     threadpool<http_conn> *pool = NULL;
     try
     {
-        pool = new threadpool<http_conn>();
+        pool = new threadpool<http_conn>(config.threads, config.queue_size, http_conn::PRIORITY_NUMBER);
+        pool->set_lane_weight(http_conn::PRIORITY_HIGH, HIGH_LANE_WEIGHT);
+        pool->set_lane_weight(http_conn::PRIORITY_LOW, LOW_LANE_WEIGHT);
     }
     catch(...)
     {
         return 1;
     }
+    std::vector<int> cpus;
+    if (!parse_cpu_list(config.worker_cpus.c_str(), cpus) || !pool->set_cpus(cpus) || !pool->start())
+    {
+        return 1;
+    }
+
+    // 创建I/O线程池，文件系统操作在这里执行，冷文件不会占住解析线程
+    threadpool<http_conn> *io_pool = NULL;
+    try
+    {
+        io_pool = new threadpool<http_conn>(config.io_threads, config.queue_size);
+        io_pool->set_name("io");
+    }
+    catch(...)
+    {
+        return 1;
+    }
+    if (!parse_cpu_list(config.io_cpus.c_str(), cpus) || !io_pool->set_cpus(cpus) || !io_pool->start())
+    {
+        return 1;
+    }
+    http_conn::m_io_pool = io_pool;
+    register_metrics(pool, io_pool);
+    if (WORKER_STALL_MS > 0)
+    {
+        pool->start_watchdog(WORKER_STALL_MS, WORKER_REPLACE, on_worker_stall);
+        io_pool->start_watchdog(WORKER_STALL_MS, WORKER_REPLACE, on_worker_stall);
+    }
+
+    // 工作线程创建之后再绑定事件循环，避免工作线程继承事件循环的亲和性
+    int loop_node = -1;
+    if (config.loop_cpu >= 0)
+    {
+        if (!pin_current_thread(config.loop_cpu))
+        {
+            printf("bind event loop to cpu %d failed\n", config.loop_cpu);
+            return 1;
+        }
+        loop_node = cpu_to_node(config.loop_cpu);
+    }
 
     // 预先为每个可能的客户连接分配一个http_conn对象
-    http_conn *users = new http_conn[MAX_FD];
+    // 连接对象及其读写缓冲区主要由事件循环访问，从事件循环所在的NUMA节点上分配
+    users = create_users(loop_node);
     assert(users);
-    int user_count = 0;
+    timer_lst = create_timer_container(config.timer.c_str());
+    if (!timer_lst)
+    {
+        printf("unknown timer container %s\n", config.timer.c_str());
+        return 1;
+    }
+    start_admin(pool, io_pool);
 
     int listenfd = socket(PF_INET, SOCK_STREAM, 0);
     assert(listenfd >= 0);
@@ -143,6 +554,14 @@ int main(int argc, char *argv[])
 
     int flag = 1;
     setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    // 绑定CPU时，每个CPU可以各运行一个服务器进程监听同一端口，
+    // 内核通过SO_INCOMING_CPU把连接交给与网卡接收队列同一CPU上的进程
+    if (config.loop_cpu >= 0)
+    {
+        int cpu = config.loop_cpu;
+        setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
+        setsockopt(listenfd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof(cpu));
+    }
     ret = bind(listenfd, (struct sockaddr*)&address, sizeof(address));
     assert(ret >= 0);
 
@@ -154,9 +573,22 @@ int main(int argc, char *argv[])
     epollfd = epoll_create(5);
     assert(epollfd != -1);
 
-    addfd(epollfd, listenfd, false);
+    addfd(epollfd, listenfd, false, config.listen_et);
     http_conn::m_epollfd = epollfd;
 
+    // 工作线程通过完成队列把epoll操作交回主线程
+    completion_queue *completions = NULL;
+    try
+    {
+        completions = new completion_queue();
+    }
+    catch(...)
+    {
+        return 1;
+    }
+    addfd(epollfd, completions->get_fd(), false, false);
+    http_conn::m_completion = completions;
+
     //创建管道套接字
     ret = socketpair(PF_UNIX, SOCK_STREAM, 0, pipefd);
     assert(ret != -1);
@@ -166,8 +598,8 @@ int main(int argc, char *argv[])
     // 如果缓冲区满了，则会阻塞，这时候会进一步增加信号处理函数的执行时间，为此，将其修改为非阻塞。
     setnonblocking(pipefd[1]);
 
-    // 设置管道读端为ET非阻塞
-    addfd(epollfd, pipefd[0], false);
+    // 设置管道读端为LT非阻塞
+    addfd(epollfd, pipefd[0], false, false);
 
     // 传递给主循环的信号值，此处只关注SIGALRM和SIGTERM
     addsig(SIGALRM, sig_handler, false);
@@ -184,6 +616,7 @@ int main(int argc, char *argv[])
 
     // 每隔TIMESLOT时间出发SIGALRM
     alarm(TIMESLOT);
+    profiler::register_thread("event_loop");
 
     while (!stop_server)
     {
@@ -199,51 +632,59 @@ int main(int argc, char *argv[])
             // 处理新到的客户连接
             if (sockfd == listenfd)
             {
-                //初始化客户端连接地址
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof(client_address);
-
-                //该连接分配的文件描述符
-                int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlength);
-                if (connfd < 0)
+                // 边缘触发时一次事件可能对应多个新连接，需要一直accept到EAGAIN
+                do
                 {
-                    LOG_ERROR("%s:errno is:%d", "accept error", errno);
-                    continue;
-                }
-                if (http_conn::m_user_count >= MAX_FD)
-                {
-                    show_error(connfd, "Internal server busy");
-                    LOG_ERROR("%s", "Internal server busy");
-                    continue;
-                }
-                //printf("客户端%s:%d连接成功\n", inet_ntoa(client_address.sin_addr), client_address.sin_port);
-                // 初始化客户连接
-                users[connfd].init(connfd, client_address);
-
-                //初始化client_data数据
-                //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
-                users_timer[connfd].address = client_address;
-                users_timer[connfd].sockfd = connfd;
-
-                //创建定时器临时变量
-                util_timer *timer = new util_timer;
-                //设置定时器对应的连接资源
-                timer->user_data = &users_timer[connfd];
-                //设置回调函数
-                timer->cb_func = cb_func;
-                time_t cur = time(NULL);
-
-                //设置绝对超时时间
-                timer->expire = cur + 3 * TIMESLOT;
-                //创建该连接对应的定时器，初始化为前述临时变量
-                users_timer[connfd].timer = timer;
-                //将该定时器添加到链表中
-                timer_lst.add_timer(timer);
+                    //初始化客户端连接地址
+                    struct sockaddr_in client_address;
+                    socklen_t client_addrlength = sizeof(client_address);
+
+                    //该连接分配的文件描述符
+                    int connfd = accept(listenfd, (struct sockaddr*)&client_address, &client_addrlength);
+                    if (connfd < 0)
+                    {
+                        if (!config.listen_et || (errno != EAGAIN && errno != EWOULDBLOCK))
+                        {
+                            LOG_ERROR("%s:errno is:%d", "accept error", errno);
+                        }
+                        break;
+                    }
+                    if (http_conn::m_user_count >= MAX_FD)
+                    {
+                        show_error(connfd, "Internal server busy");
+                        LOG_ERROR("%s", "Internal server busy");
+                        continue;
+                    }
+                    metrics::get_instance()->add(metric_accepted);
+                    //printf("客户端%s:%d连接成功\n", inet_ntoa(client_address.sin_addr), client_address.sin_port);
+                    // 初始化客户连接
+                    users[connfd].init(connfd, client_address);
+
+                    //初始化client_data数据
+                    //创建定时器，设置回调函数和超时时间，绑定用户数据，将定时器添加到链表中
+                    users_timer[connfd].address = client_address;
+                    users_timer[connfd].sockfd = connfd;
+
+                    //创建定时器临时变量
+                    util_timer *timer = new util_timer;
+                    //设置定时器对应的连接资源
+                    timer->user_data = &users_timer[connfd];
+                    //设置回调函数
+                    timer->cb_func = cb_func;
+                    time_t cur = time(NULL);
+
+                    //设置绝对超时时间
+                    timer->expire = cur + config.timeout;
+                    //创建该连接对应的定时器，初始化为前述临时变量
+                    users_timer[connfd].timer = timer;
+                    //将该定时器添加到链表中
+                    timer_lst->add_timer(timer);
+                    metrics::get_instance()->add(metric_timers);
+                } while (config.listen_et);
             }
             // 处理定时器信号
             else if ((sockfd == pipefd[0]) && (events[i].events & EPOLLIN))
             {
-                int sig;
                 char signals[1024];
                 //从管道读端读出信号值，成功返回字节数，失败返回-1
                 //正常情况下，这里的ret返回值总是1，只有14和15两个ASCII码对应的字符
@@ -282,39 +723,47 @@ int main(int argc, char *argv[])
                 }
 
             }
+            // 处理工作线程投递回来的完成任务
+            else if ((sockfd == completions->get_fd()) && (events[i].events & EPOLLIN))
+            {
+                completions->run();
+            }
             // 处理异常情况
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
             {
+                users[sockfd].trace(TRACE_EPOLLHUP, events[i].events);
                 //服务器端关闭连接，移除对应的定时器
                 util_timer *timer = users_timer[sockfd].timer;
                 timer->cb_func(&users_timer[sockfd]);
                 if (timer)
                 {
-                    timer_lst.del_timer(timer);
+                    timer_lst->del_timer(timer);
                 }
             }
             // 处理客户连接上接收到的数据
             else if (events[i].events & EPOLLIN)
             {
+                users[sockfd].trace(TRACE_EPOLLIN);
                 //创建定时器临时变量，将该连接对应的定时器取出来
                 util_timer *timer = users_timer[sockfd].timer;
                 // 根据读的结果，决定将任务添加到线程池，还是关闭连接
                 if (users[sockfd].read())
                 {
-                    LOG_INFO("deal with the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
-                    //若监测到读事件，将该事件放入请求队列
-                    pool->append(users+sockfd);
+                    LOG_DEBUG("deal with the client(%s) fd %d", inet_ntoa(users[sockfd].get_address()->sin_addr), sockfd);
+                    //若监测到读事件，按请求行分类后将该事件放入对应优先级的请求队列
+                    http_conn::PRIORITY lane = users[sockfd].classify();
+                    users[sockfd].trace(TRACE_ENQUEUE, lane);
+                    pool->append(users + sockfd, lane);
 
-                    //若有数据传输，则将定时器往后延迟3个单位
+                    //若有数据传输，则将定时器往后延迟config.timeout秒
                     //对其在链表上的位置进行调整
                     if (timer)
                     {
                         time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
+                        timer->expire = cur + config.timeout;
+                        LOG_DEBUG("%s", "adjust timer once");
+                        timer_lst->adjust_timer(timer);
+                        users[sockfd].trace(TRACE_TIMER_ADJUST, timer->expire);
                     }
                 }
                 else
@@ -323,27 +772,27 @@ int main(int argc, char *argv[])
                     timer->cb_func(&users_timer[sockfd]);
                     if (timer)
                     {
-                        timer_lst.del_timer(timer);
+                        timer_lst->del_timer(timer);
                     }
                 }
             }
             else if (events[i].events & EPOLLOUT)
             {
+                users[sockfd].trace(TRACE_EPOLLOUT);
                 util_timer *timer = users_timer[sockfd].timer;
                 // 根据写的结果，决定是否关闭连接
                 if (!users[sockfd].write())
                 {
-                    LOG_INFO("send data to the client(%s)", inet_ntoa(users[sockfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
-                    //若有数据传输，则将定时器往后延迟3个单位
+                    LOG_DEBUG("send data to the client(%s) fd %d", inet_ntoa(users[sockfd].get_address()->sin_addr), sockfd);
+                    //若有数据传输，则将定时器往后延迟config.timeout秒
                     //并对新的定时器在链表上的位置进行调整
                     if (timer)
                     {
                         time_t cur = time(NULL);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
+                        timer->expire = cur + config.timeout;
+                        LOG_DEBUG("%s", "adjust timer once");
+                        timer_lst->adjust_timer(timer);
+                        users[sockfd].trace(TRACE_TIMER_ADJUST, timer->expire);
                     }
                 }
                 else
@@ -351,7 +800,7 @@ int main(int argc, char *argv[])
                     timer->cb_func(&users_timer[sockfd]);
                     if (timer)
                     {
-                        timer_lst.del_timer(timer);
+                        timer_lst->del_timer(timer);
                     }
                 }
             }
@@ -364,13 +813,44 @@ int main(int argc, char *argv[])
         }
     }
 
+    // 先让解析线程处理完已入队的请求（它们可能继续向I/O线程池投递），再停止I/O线程池
+    if (!pool->drain(SHUTDOWN_TIMEOUT))
+    {
+        LOG_WARN("%s", "threadpool drain timeout");
+    }
+    if (!io_pool->drain(SHUTDOWN_TIMEOUT))
+    {
+        LOG_WARN("%s", "io threadpool drain timeout");
+    }
+
+    // 退出前把各直方图的分位数写入日志
+    std::string summary;
+    metrics::get_instance()->summarize(summary);
+    for (size_t begin = 0, end; (end = summary.find('\n', begin)) != std::string::npos; begin = end + 1)
+    {
+        LOG_INFO("latency(us) %.*s", (int)(end - begin), summary.c_str() + begin);
+    }
+
+    admin_server::get_instance()->stop();
     close(epollfd);
     close(listenfd);
     close(pipefd[1]);
     close(pipefd[0]);
-    delete[] users;
+    delete timer_lst;
+    timer_lst = NULL;
+    // 被放弃的线程可能仍在执行任务，持有连接对象、I/O线程池和完成队列，这时不释放它们，交给进程退出回收
+    if (pool->abandoned() > 0 || io_pool->abandoned() > 0)
+    {
+        LOG_WARN("%s", "worker threads still running, leaving shared state allocated");
+        return 0;
+    }
+    destroy_users(users);
     delete[] users_timer;
     delete pool;
+    http_conn::m_io_pool = NULL;
+    delete io_pool;
+    http_conn::m_completion = NULL;
+    delete completions;
     return 0;
 
 
@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <new>
+#include "metrics.h"
+
+metrics::metrics() : m_count(0), m_slots(0), m_shards(NULL)
+{
+}
+
+metrics::~metrics()
+{
+    //其他线程在退出前仍可能访问自己的分片，分片不释放
+}
+
+int metrics::bucket_index(long long v)
+{
+    //桶的上界包含在桶内，所以按v-1分桶
+    v = v > 0 ? v - 1 : 0;
+    if (v < LINEAR_BUCKETS)
+    {
+        return (int)v;
+    }
+    int e = 63 - __builtin_clzll((unsigned long long)v);
+    if (e > MAX_EXPONENT)
+    {
+        return HISTOGRAM_BUCKETS;
+    }
+    int sub = (int)(v >> (e - SUB_BUCKET_BITS)) & ((1 << SUB_BUCKET_BITS) - 1);
+    return LINEAR_BUCKETS + (e - 4) * (1 << SUB_BUCKET_BITS) + sub;
+}
+
+long long metrics::bucket_bound(int i)
+{
+    if (i < LINEAR_BUCKETS)
+    {
+        return i + 1;
+    }
+    int e = (i - LINEAR_BUCKETS) / (1 << SUB_BUCKET_BITS) + 4;
+    int sub = (i - LINEAR_BUCKETS) % (1 << SUB_BUCKET_BITS);
+    return (long long)((1 << SUB_BUCKET_BITS) + sub + 1) << (e - SUB_BUCKET_BITS);
+}
+
+int metrics::add_metric(const char *name, const char *help, METRIC_TYPE type, int slots, metric_sampler sampler, void *arg)
+{
+    m_mutex.lock();
+    if (m_count >= MAX_METRICS || m_slots + slots > MAX_SLOTS)
+    {
+        m_mutex.unlock();
+        return -1;
+    }
+    int id = m_count;
+    metric_def &def = m_defs[id];
+    def.name = name;
+    def.help = help;
+    def.type = type;
+    def.slot = sampler ? -1 : m_slots;
+    def.sampler = sampler;
+    def.arg = arg;
+    m_slots += slots;
+    m_count++;
+    m_mutex.unlock();
+    return id;
+}
+
+int metrics::add_counter(const char *name, const char *help)
+{
+    return add_metric(name, help, METRIC_COUNTER, 1, NULL, NULL);
+}
+
+int metrics::add_gauge(const char *name, const char *help)
+{
+    return add_metric(name, help, METRIC_GAUGE, 1, NULL, NULL);
+}
+
+int metrics::add_histogram(const char *name, const char *help)
+{
+    return add_metric(name, help, METRIC_HISTOGRAM, HISTOGRAM_SLOTS, NULL, NULL);
+}
+
+int metrics::add_sampled(const char *name, const char *help, METRIC_TYPE type, metric_sampler sampler, void *arg)
+{
+    if (!sampler || type == METRIC_HISTOGRAM)
+    {
+        return -1;
+    }
+    return add_metric(name, help, type, 0, sampler, arg);
+}
+
+metrics::shard *metrics::new_shard()
+{
+    shard *s = new (std::nothrow) shard;
+    if (!s)
+    {
+        abort();
+    }
+    for (int i = 0; i < MAX_SLOTS; i++)
+    {
+        s->slots[i].store(0, std::memory_order_relaxed);
+    }
+    s->next = m_shards.load();
+    while (!m_shards.compare_exchange_weak(s->next, s))
+    {
+    }
+    return s;
+}
+
+//指标名中'{'之前的部分为指标族，同一族的HELP和TYPE只输出一次
+static int family_length(const char *name)
+{
+    const char *brace = strchr(name, '{');
+    return brace ? (int)(brace - name) : (int)strlen(name);
+}
+
+static void append(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+static void append(std::string &out, const char *format, ...)
+{
+    char buf[512];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    if (n > 0)
+    {
+        out.append(buf, n < (int)sizeof(buf) ? n : (int)sizeof(buf) - 1);
+    }
+}
+
+void metrics::collect(const metric_def &def, long long *values)
+{
+    int slots = def.type == METRIC_HISTOGRAM ? HISTOGRAM_SLOTS : 1;
+    memset(values, 0, sizeof(long long) * slots);
+    for (shard *s = m_shards.load(); s; s = s->next)
+    {
+        for (int i = 0; i < slots; i++)
+        {
+            values[i] += s->slots[def.slot + i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+long long metrics::quantile(const long long *values, double q)
+{
+    long long count = 0;
+    for (int i = 0; i <= HISTOGRAM_BUCKETS; i++)
+    {
+        count += values[i];
+    }
+    if (count == 0)
+    {
+        return 0;
+    }
+    //第rank个值所在的桶，rank向上取整
+    double exact = q * count;
+    long long rank = (long long)exact;
+    rank = rank < exact ? rank + 1 : rank;
+    rank = rank < 1 ? 1 : rank;
+    long long cumulative = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        cumulative += values[i];
+        if (cumulative >= rank)
+        {
+            return bucket_bound(i);
+        }
+    }
+    //落在+Inf桶中，按范围上界报告
+    return bucket_bound(HISTOGRAM_BUCKETS - 1);
+}
+
+long long metrics::quantile(int id, double q)
+{
+    if (id < 0 || id >= m_count || m_defs[id].type != METRIC_HISTOGRAM)
+    {
+        return 0;
+    }
+    long long values[HISTOGRAM_SLOTS];
+    collect(m_defs[id], values);
+    return quantile(values, q);
+}
+
+void metrics::summarize(std::string &out)
+{
+    m_mutex.lock();
+    int count = m_count;
+    m_mutex.unlock();
+
+    long long values[HISTOGRAM_SLOTS];
+    for (int id = 0; id < count; id++)
+    {
+        const metric_def &def = m_defs[id];
+        if (def.type != METRIC_HISTOGRAM)
+        {
+            continue;
+        }
+        collect(def, values);
+        long long total = 0;
+        for (int i = 0; i <= HISTOGRAM_BUCKETS; i++)
+        {
+            total += values[i];
+        }
+        append(out, "%s count=%lld p50=%lld p99=%lld p999=%lld max=%lld\n", def.name, total,
+               quantile(values, 0.5), quantile(values, 0.99), quantile(values, 0.999), quantile(values, 1.0));
+    }
+}
+
+void metrics::render(std::string &out)
+{
+    static const char *type_names[] = {"counter", "gauge", "histogram"};
+
+    m_mutex.lock();
+    int count = m_count;
+    m_mutex.unlock();
+
+    const char *last_family = NULL;
+    int last_length = 0;
+    long long values[HISTOGRAM_SLOTS];
+    for (int id = 0; id < count; id++)
+    {
+        const metric_def &def = m_defs[id];
+        int length = family_length(def.name);
+        if (!last_family || length != last_length || strncmp(def.name, last_family, length) != 0)
+        {
+            append(out, "# HELP %.*s %s\n# TYPE %.*s %s\n", length, def.name, def.help, length, def.name, type_names[def.type]);
+            last_family = def.name;
+            last_length = length;
+        }
+
+        if (def.sampler)
+        {
+            append(out, "%s %lld\n", def.name, def.sampler(def.arg));
+            continue;
+        }
+
+        collect(def, values);
+
+        if (def.type != METRIC_HISTOGRAM)
+        {
+            append(out, "%s %lld\n", def.name, values[0]);
+            continue;
+        }
+
+        //固定标签放在le之前，_sum和_count带同样的标签
+        const char *labels = def.name + length;
+        int label_length = *labels ? (int)strlen(labels) - 2 : 0;
+        const char *label_body = *labels ? labels + 1 : "";
+        const char *separator = label_length > 0 ? "," : "";
+        long long cumulative = 0;
+        for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        {
+            cumulative += values[i];
+            long long bound = bucket_bound(i);
+            append(out, "%.*s_bucket{%.*s%sle=\"%lld.%06lld\"} %lld\n", length, def.name, label_length, label_body, separator,
+                   bound / 1000000, bound % 1000000, cumulative);
+        }
+        cumulative += values[HISTOGRAM_BUCKETS];
+        long long sum = values[HISTOGRAM_BUCKETS + 1];
+        append(out, "%.*s_bucket{%.*s%sle=\"+Inf\"} %lld\n", length, def.name, label_length, label_body, separator, cumulative);
+        append(out, "%.*s_sum%s %lld.%06lld\n", length, def.name, labels, sum / 1000000, sum % 1000000);
+        append(out, "%.*s_count%s %lld\n", length, def.name, labels, cumulative);
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef _METRICS_H_
+#define _METRICS_H_
+/*************************************************************
+*统计指标：计数器、仪表和直方图，以Prometheus文本格式输出
+*每个线程更新自己的分片，分片按缓存行对齐，更新时不加锁、不使用原子读改写指令
+*抓取时汇总所有线程的分片，分片在线程退出后保留，计数不会丢失
+*指标需在启动阶段、工作线程开始更新之前注册
+**************************************************************/
+
+#include <atomic>
+#include <string>
+#include "../lock/locker.h"
+
+enum METRIC_TYPE
+{
+    METRIC_COUNTER = 0, //只增不减的计数
+    METRIC_GAUGE,       //可增可减的当前值，各分片的增量之和
+    METRIC_HISTOGRAM    //对数-线性分桶的直方图，值的单位为us，输出为秒
+};
+
+//抓取时才求值的指标，如队列长度
+typedef long long (*metric_sampler)(void *arg);
+
+class metrics
+{
+public:
+    //最多可注册的指标数和每个分片的槽位数
+    static const int MAX_METRICS = 64;
+    static const int MAX_SLOTS = 1024;
+    //直方图：小于16us时每1us一个桶，之后每个2的幂区间分4个桶，最大到2^26us(约67s)，更大的值计入+Inf
+    static const int LINEAR_BUCKETS = 16;
+    static const int SUB_BUCKET_BITS = 2;
+    static const int MAX_EXPONENT = 26;
+    static const int HISTOGRAM_BUCKETS = LINEAR_BUCKETS + (MAX_EXPONENT - 4 + 1) * (1 << SUB_BUCKET_BITS);
+    //直方图占用的槽位：各个桶、+Inf桶和总和
+    static const int HISTOGRAM_SLOTS = HISTOGRAM_BUCKETS + 2;
+
+    static metrics *get_instance()
+    {
+        static metrics instance;
+        return &instance;
+    }
+
+    //注册指标，返回指标编号，失败返回-1
+    //name可以带固定的标签，如"http_responses_total{code=\"2xx\"}"，同名不同标签的指标应连续注册
+    int add_counter(const char *name, const char *help);
+    int add_gauge(const char *name, const char *help);
+    int add_histogram(const char *name, const char *help);
+    //抓取时调用sampler求值，type为METRIC_COUNTER或METRIC_GAUGE
+    int add_sampled(const char *name, const char *help, METRIC_TYPE type, metric_sampler sampler, void *arg);
+
+    //计数器或仪表加上delta，只写当前线程的分片
+    void add(int id, long long delta = 1)
+    {
+        if (id < 0)
+        {
+            return;
+        }
+        std::atomic<long long> &slot = local()->slots[m_defs[id].slot];
+        slot.store(slot.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+    //直方图记录一个值(us)
+    void observe(int id, long long us)
+    {
+        if (id < 0)
+        {
+            return;
+        }
+        std::atomic<long long> *slots = local()->slots + m_defs[id].slot;
+        std::atomic<long long> &bucket = slots[bucket_index(us)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic<long long> &sum = slots[HISTOGRAM_BUCKETS + 1];
+        sum.store(sum.load(std::memory_order_relaxed) + (us > 0 ? us : 0), std::memory_order_relaxed);
+    }
+
+    //汇总所有分片，按Prometheus文本格式追加到out
+    void render(std::string &out);
+    //直方图的q分位数(us)，取该分位所在桶的上界，没有数据时为0
+    long long quantile(int id, double q);
+    //每个直方图一行：名字、个数、p50、p99、p999和最大值所在桶的上界(us)，追加到out
+    void summarize(std::string &out);
+
+    //值v所在的桶，第i个桶为(上一个桶的上界, bucket_bound(i)]，超出范围时返回+Inf桶HISTOGRAM_BUCKETS
+    static int bucket_index(long long v);
+    //第i个桶的上界(us)
+    static long long bucket_bound(int i);
+
+private:
+    metrics();
+    ~metrics();
+
+    struct metric_def
+    {
+        const char *name;
+        const char *help;
+        METRIC_TYPE type;
+        int slot;               //在分片中的起始槽位，抓取时求值的指标为-1
+        metric_sampler sampler;
+        void *arg;
+    };
+
+    //每个线程一个分片，只由所属线程写，抓取线程读
+    struct alignas(64) shard
+    {
+        std::atomic<long long> slots[MAX_SLOTS];
+        shard *next;
+    };
+
+    //汇总指标在所有分片中的槽位，values至少有HISTOGRAM_SLOTS个元素
+    void collect(const metric_def &def, long long *values);
+    //由汇总后的直方图求q分位数
+    static long long quantile(const long long *values, double q);
+
+    int add_metric(const char *name, const char *help, METRIC_TYPE type, int slots, metric_sampler sampler, void *arg);
+
+    shard *local()
+    {
+        static thread_local shard *t_shard = NULL;
+        if (!t_shard)
+        {
+            t_shard = new_shard();
+        }
+        return t_shard;
+    }
+    shard *new_shard();
+
+private:
+    locker m_mutex;                     //保护指标的注册
+    metric_def m_defs[MAX_METRICS];
+    int m_count;
+    int m_slots;                        //已分配的槽位数
+    std::atomic<shard *> m_shards;      //所有线程的分片，新分片无锁地插入链表头
+};
+
+#endif
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include <map>
+#include <vector>
+#include "profiler.h"
+#include "../lock/locker.h"
+
+struct thread_info
+{
+    pthread_t thread;
+    pid_t tid;
+    const char *name;
+    timer_t timer;
+    bool armed;
+};
+
+struct sample
+{
+    void *frames[profiler::MAX_FRAMES];
+    int depth;
+    int thread;
+    std::atomic<bool> ready; // 信号处理函数写完后置位，汇总时跳过未写完的
+};
+
+// 信号处理函数和调用栈之间的两层：on_signal本身和内核的信号返回跳板
+static const int SKIP_FRAMES = 2;
+
+static locker registry_mutex;            // 保护线程表以及开始、停止
+static thread_info threads[profiler::MAX_THREADS];
+static int thread_count = 0;
+static thread_local int thread_index = -1;
+
+static sample *samples = NULL;
+static std::atomic<int> sample_next(0);
+static std::atomic<bool> sampling(false);
+
+// 定时停止：每次start()的代数不同，stop()或新一轮start()后旧的等待线程直接退出
+static cond stop_cond;
+static long long stop_generation = 0;
+
+// 按需抓取调用栈：目标线程、结果和完成标志，由capture_mutex串行化
+static locker capture_mutex;
+static std::atomic<pid_t> capture_tid(0);
+static void **capture_frames = NULL;
+static int capture_max = 0;
+static std::atomic<int> capture_depth(-1);
+
+static void on_signal(int, siginfo_t *info, void *)
+{
+    int saved_errno = errno;
+    if (info && info->si_code == SI_TKILL)
+    {
+        if (capture_tid.load() == (pid_t)syscall(SYS_gettid))
+        {
+            capture_depth.store(backtrace(capture_frames, capture_max));
+        }
+    }
+    else if (sampling.load(std::memory_order_relaxed) && samples)
+    {
+        int index = sample_next.fetch_add(1, std::memory_order_relaxed);
+        if (index < profiler::MAX_SAMPLES)
+        {
+            sample &s = samples[index];
+            s.depth = backtrace(s.frames, profiler::MAX_FRAMES);
+            s.thread = thread_index;
+            s.ready.store(true, std::memory_order_release);
+        }
+    }
+    errno = saved_errno;
+}
+
+static void install_handler()
+{
+    static bool installed = false;
+    if (installed)
+    {
+        return;
+    }
+    //第一次调用backtrace会加载libgcc，不能发生在信号处理函数中
+    void *warmup[1];
+    backtrace(warmup, 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = on_signal;
+    sa.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+    installed = true;
+}
+
+void profiler::register_thread(const char *name)
+{
+    registry_mutex.lock();
+    if (thread_index < 0 && thread_count < MAX_THREADS)
+    {
+        thread_info &t = threads[thread_count];
+        t.thread = pthread_self();
+        t.tid = (pid_t)syscall(SYS_gettid);
+        t.name = name;
+        t.armed = false;
+        thread_index = thread_count++;
+    }
+    registry_mutex.unlock();
+}
+
+bool profiler::running()
+{
+    return sampling.load();
+}
+
+static void disarm_all()
+{
+    for (int i = 0; i < thread_count; i++)
+    {
+        if (threads[i].armed)
+        {
+            timer_delete(threads[i].timer);
+            threads[i].armed = false;
+        }
+    }
+}
+
+// 调用前需持有registry_mutex
+static void stop_locked()
+{
+    if (sampling.load())
+    {
+        disarm_all();
+        sampling.store(false);
+        stop_generation++;
+        stop_cond.broadcast();
+    }
+}
+
+bool profiler::start(int duration_ms, int hz)
+{
+    if (hz <= 0 || hz > 1000)
+    {
+        hz = DEFAULT_HZ;
+    }
+    registry_mutex.lock();
+    if (sampling.load())
+    {
+        registry_mutex.unlock();
+        return false;
+    }
+
+    install_handler();
+
+    if (!samples)
+    {
+        samples = new sample[MAX_SAMPLES];
+    }
+    for (int i = 0; i < MAX_SAMPLES; i++)
+    {
+        samples[i].ready.store(false, std::memory_order_relaxed);
+    }
+    sample_next.store(0);
+
+    sampling.store(true);
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = 0;
+    spec.it_interval.tv_nsec = 1000000000L / hz;
+    spec.it_value = spec.it_interval;
+    int armed = 0;
+    for (int i = 0; i < thread_count; i++)
+    {
+        thread_info &t = threads[i];
+        clockid_t clock;
+        if (pthread_getcpuclockid(t.thread, &clock) != 0)
+        {
+            continue;
+        }
+        struct sigevent ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.sigev_notify = SIGEV_THREAD_ID;
+        ev.sigev_signo = SIGPROF;
+        ev._sigev_un._tid = t.tid;
+        if (timer_create(clock, &ev, &t.timer) != 0)
+        {
+            continue;
+        }
+        t.armed = true;
+        timer_settime(t.timer, 0, &spec, NULL);
+        armed++;
+    }
+    if (armed == 0)
+    {
+        sampling.store(false);
+        registry_mutex.unlock();
+        return false;
+    }
+
+    //定时停止：等待线程在超时或被stop()唤醒后停止
+    if (duration_ms > 0)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += duration_ms / 1000;
+        deadline.tv_nsec += (long)(duration_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        long long generation = ++stop_generation;
+        struct timer_arg
+        {
+            long long generation;
+            struct timespec deadline;
+        };
+        timer_arg *arg = new timer_arg{generation, deadline};
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, [](void *p) -> void * {
+                timer_arg *a = (timer_arg *)p;
+                registry_mutex.lock();
+                bool expired = false;
+                while (stop_generation == a->generation && sampling.load() && !expired)
+                {
+                    expired = !stop_cond.timewait(registry_mutex.get(), a->deadline);
+                }
+                if (expired && stop_generation == a->generation)
+                {
+                    stop_locked();
+                }
+                registry_mutex.unlock();
+                delete a;
+                return NULL;
+            }, arg) == 0)
+        {
+            pthread_detach(tid);
+        }
+        else
+        {
+            delete arg;
+        }
+    }
+    registry_mutex.unlock();
+    return true;
+}
+
+void profiler::stop()
+{
+    registry_mutex.lock();
+    stop_locked();
+    registry_mutex.unlock();
+}
+
+// 把返回地址转换为函数名，取不到符号时显示为 模块名+偏移
+static std::string symbolize(void *addr)
+{
+    Dl_info info;
+    //返回地址指向调用指令之后，减一落在调用指令所在的函数内
+    void *pc = (char *)addr - 1;
+    if (!dladdr(pc, &info) || !info.dli_fname)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%p", addr);
+        return buf;
+    }
+    if (info.dli_sname)
+    {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(info.dli_sname, NULL, NULL, &status);
+        std::string name = status == 0 && demangled ? demangled : info.dli_sname;
+        free(demangled);
+        return name;
+    }
+    const char *module = strrchr(info.dli_fname, '/');
+    module = module ? module + 1 : info.dli_fname;
+    char buf[300];
+    snprintf(buf, sizeof(buf), "%s+0x%lx", module, (unsigned long)((char *)pc - (char *)info.dli_fbase));
+    return buf;
+}
+
+void profiler::folded(std::string &out)
+{
+    registry_mutex.lock();
+    if (!samples)
+    {
+        registry_mutex.unlock();
+        return;
+    }
+    int count = sample_next.load();
+    count = count < MAX_SAMPLES ? count : MAX_SAMPLES;
+
+    std::map<void *, std::string> symbols;
+    std::map<std::string, long long> stacks;
+    for (int i = 0; i < count; i++)
+    {
+        const sample &s = samples[i];
+        if (!s.ready.load(std::memory_order_acquire))
+        {
+            continue;
+        }
+        std::string stack = s.thread >= 0 ? threads[s.thread].name : "unknown";
+        for (int f = s.depth - 1; f >= SKIP_FRAMES; f--)
+        {
+            std::map<void *, std::string>::iterator it = symbols.find(s.frames[f]);
+            if (it == symbols.end())
+            {
+                it = symbols.insert(std::make_pair(s.frames[f], symbolize(s.frames[f]))).first;
+            }
+            stack += ';';
+            stack += it->second;
+        }
+        stacks[stack]++;
+    }
+    int dropped = sample_next.load() - count;
+    registry_mutex.unlock();
+
+    char line[64];
+    for (std::map<std::string, long long>::iterator it = stacks.begin(); it != stacks.end(); ++it)
+    {
+        out += it->first;
+        snprintf(line, sizeof(line), " %lld\n", it->second);
+        out += line;
+    }
+    if (dropped > 0)
+    {
+        snprintf(line, sizeof(line), "dropped_samples %d\n", dropped);
+        out += line;
+    }
+}
+
+int profiler::sample_thread(pid_t tid, void **frames, int max_frames, int timeout_ms)
+{
+    registry_mutex.lock();
+    install_handler();
+    registry_mutex.unlock();
+
+    capture_mutex.lock();
+    capture_frames = frames;
+    capture_max = max_frames;
+    capture_depth.store(-1);
+    capture_tid.store(tid);
+    int depth = 0;
+    if (syscall(SYS_tgkill, getpid(), tid, SIGPROF) == 0)
+    {
+        for (int waited = 0; waited < timeout_ms && capture_depth.load() < 0; waited++)
+        {
+            struct timespec interval = {0, 1000000};
+            nanosleep(&interval, NULL);
+        }
+        depth = capture_depth.load();
+    }
+    //超时后目标线程仍可能在稍后写入，清除目标后再返回
+    capture_tid.store(0);
+    depth = depth > 0 ? depth : 0;
+    capture_mutex.unlock();
+    return depth;
+}
+
+void profiler::format_stack(void **frames, int depth, std::string &out)
+{
+    for (int f = SKIP_FRAMES; f < depth; f++)
+    {
+        out += "    ";
+        out += symbolize(frames[f]);
+        out += '\n';
+    }
+}
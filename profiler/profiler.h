@@ -0,0 +1,42 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+/*************************************************************
+*采样剖析器：为每个登记过的线程创建一个按该线程CPU时间计时的定时器(timer_create)，
+*到期时向该线程发送SIGPROF，信号处理函数用backtrace记录调用栈
+*停止后把调用栈汇总成折叠格式（线程名;根函数;...;叶函数 次数），可直接交给flamegraph.pl生成火焰图
+*只统计占用CPU的时间，阻塞在epoll_wait、信号量上的线程不会被采样
+*同一个信号处理函数也用于按需抓取某个线程的调用栈，用si_code区分定时器触发和tgkill
+*函数名通过dladdr取得，可执行文件需要用-rdynamic链接，否则只能显示地址
+**************************************************************/
+
+#include <string>
+#include <sys/types.h>
+
+class profiler
+{
+public:
+    // 最多登记的线程数、每个调用栈的最大深度、一次采样最多保存的调用栈数
+    static const int MAX_THREADS = 64;
+    static const int MAX_FRAMES = 32;
+    static const int MAX_SAMPLES = 65536;
+    static const int DEFAULT_HZ = 99;
+
+    // 线程开始运行时调用，登记后才会被采样；name为折叠格式中的第一层，如"worker"
+    static void register_thread(const char *name);
+
+    // 开始采样，duration_ms后自动停止，<=0时一直采样到stop()；已在采样时返回false
+    static bool start(int duration_ms, int hz = DEFAULT_HZ);
+    // 停止采样，可重复调用
+    static void stop();
+    static bool running();
+    // 把最近一次采样的结果以折叠格式追加到out，采样进行中时返回已采到的部分
+    static void folded(std::string &out);
+
+    // 向线程tid发送SIGPROF并取得它当前的调用栈，最多等待timeout_ms毫秒，返回栈深度，失败返回0
+    // 用于看门狗报告卡住的线程，同一时刻只能有一个调用者；目标线程中未被SA_RESTART重启的系统调用(如nanosleep)会返回EINTR
+    static int sample_thread(pid_t tid, void **frames, int max_frames, int timeout_ms);
+    // 把sample_thread取得的调用栈写成文本，每帧一行，跳过信号处理相关的帧
+    static void format_stack(void **frames, int depth, std::string &out);
+};
+
+#endif
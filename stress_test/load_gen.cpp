@@ -0,0 +1,896 @@
+/*************************************************************
+*负载生成器
+*多个线程各自用epoll驱动一组连接，按权重混合发送GET请求，统计延迟分位数和吞吐量，以JSON输出
+*闭环模式(-r 0)：每个连接始终保持-p个未完成的请求，收到应答后立即补发
+*开环模式(-r 每秒请求数)：按固定速率安排每个请求的预定发送时间，与服务器是否跟得上无关；
+*  延迟从预定发送时间算起，服务器变慢时请求在客户端排队的时间也计入延迟，避免协调遗漏(coordinated omission)
+*  同时给出从实际发送时间算起的延迟，两者的差距就是排队的时间
+*  到结束时间仍未收到应答或还未发出的请求，以结束时间减去预定发送时间作为延迟的下界计入，
+*  不丢弃过载时最慢的那部分请求；它们的个数分别为in_flight和unsent
+*服务器在应答后关闭连接时自动重连，未收到应答的请求在新连接上重发，保留原来的预定发送时间
+*用法：./load_gen [-c 连接数] [-t 线程数] [-d 秒数] [-r 每秒请求数] [-p 流水线深度] [-K]
+*                [-u 路径[:权重]]... [-T 超时ms] [-o 输出文件] [ip [port]]
+*默认向127.0.0.1:9006发送/welcome.html
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+
+// 对数-线性分桶：小于2^SUB_BITS us时每1us一个桶，之后每个2的幂区间分2^SUB_BITS个桶，相对误差不超过3%
+static const int SUB_BITS = 5;
+static const int SUB_BUCKETS = 1 << SUB_BITS;
+static const int MAX_EXPONENT = 36;
+static const int HIST_BUCKETS = SUB_BUCKETS + (MAX_EXPONENT - SUB_BITS + 1) * SUB_BUCKETS;
+
+struct histogram
+{
+    long long counts[HIST_BUCKETS + 1]; // 最后一个桶存放超出范围的值
+    long long total;
+    long long sum;
+    long long max;
+
+    histogram() : total(0), sum(0), max(0)
+    {
+        memset(counts, 0, sizeof(counts));
+    }
+
+    static int index(long long v)
+    {
+        if (v < SUB_BUCKETS)
+        {
+            return v < 0 ? 0 : (int)v;
+        }
+        int e = 63 - __builtin_clzll((unsigned long long)v);
+        if (e > MAX_EXPONENT)
+        {
+            return HIST_BUCKETS;
+        }
+        int sub = (int)(v >> (e - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return SUB_BUCKETS + (e - SUB_BITS) * SUB_BUCKETS + sub;
+    }
+
+    // 第i个桶的上界
+    static long long bound(int i)
+    {
+        if (i < SUB_BUCKETS)
+        {
+            return i;
+        }
+        int e = (i - SUB_BUCKETS) / SUB_BUCKETS + SUB_BITS;
+        int sub = (i - SUB_BUCKETS) % SUB_BUCKETS;
+        return ((long long)(SUB_BUCKETS + sub + 1) << (e - SUB_BITS)) - 1;
+    }
+
+    void record(long long us)
+    {
+        counts[index(us)]++;
+        total++;
+        sum += us;
+        max = us > max ? us : max;
+    }
+
+    void merge(const histogram &other)
+    {
+        for (int i = 0; i <= HIST_BUCKETS; i++)
+        {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        max = other.max > max ? other.max : max;
+    }
+
+    // 第ceil(q*total)个值所在桶的上界，不超过最大值
+    long long quantile(double q) const
+    {
+        if (total == 0)
+        {
+            return 0;
+        }
+        double exact = q * total;
+        long long rank = (long long)exact;
+        rank = rank < exact ? rank + 1 : rank;
+        rank = rank < 1 ? 1 : rank;
+        long long cumulative = 0;
+        for (int i = 0; i < HIST_BUCKETS; i++)
+        {
+            cumulative += counts[i];
+            if (cumulative >= rank)
+            {
+                return bound(i) < max ? bound(i) : max;
+            }
+        }
+        return max;
+    }
+};
+
+struct request_spec
+{
+    std::string path;
+    int weight;
+    std::string text; // 完整的请求报文
+};
+
+struct config
+{
+    struct sockaddr_in address;
+    const char *ip;
+    int port;
+    int connections;
+    int threads;
+    double duration;
+    double rps;          // 0为闭环模式
+    int pipeline;
+    bool keepalive;
+    long long timeout_us;
+    std::vector<request_spec> specs;
+    int total_weight;
+};
+
+// 一个已安排的请求
+struct pending
+{
+    long long intended; // 预定发送时间，闭环模式下为第一次发送的时间
+    long long sent;     // 实际发送时间
+    int spec;
+};
+
+// epoll事件中表示timerfd的下标
+static const unsigned int TIMER_INDEX = 0xffffffffu;
+
+enum CONN_STATE
+{
+    CONN_CLOSED = 0,
+    CONN_CONNECTING,
+    CONN_OPEN
+};
+
+struct connection
+{
+    int fd;
+    CONN_STATE state;
+    long long retry_at;         // 连接失败后，下次尝试连接的时间
+    std::deque<pending> inflight;
+    std::string out;            // 尚未写出的请求
+    size_t out_offset;
+    bool want_write;            // 当前是否关注EPOLLOUT
+    // 应答解析
+    std::string header;
+    bool in_body;
+    long long body_remaining;   // -1表示读到连接关闭为止
+    int status;
+    bool close_after;           // 应答要求关闭连接
+    int responses;              // 本连接上收到的应答数
+};
+
+struct worker
+{
+    int index;
+    const config *cfg;
+    std::vector<connection> conns;
+    int epollfd;
+    int timerfd;                 // 开环模式下在下一个预定发送时间唤醒epoll_wait，精度不受毫秒超时的限制
+    unsigned int seed;
+    std::deque<pending> backlog; // 已到预定时间、还没有连接可以发送的请求，以及需要重发的请求
+    double next_intended;        // 开环模式下一个请求的预定发送时间(us)
+    double interval;             // 开环模式下本线程两个请求的间隔(us)
+    long long deadline;
+
+    histogram corrected;
+    histogram uncorrected;
+    long long completed;
+    long long errors;
+    long long timeouts;
+    long long reconnects;
+    long long bytes;
+    long long in_flight;         // 结束时已发送、未收到应答的请求数
+    std::map<int, long long> status;
+};
+
+static long long now_us()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long)t.tv_sec * 1000000 + t.tv_nsec / 1000;
+}
+
+static int pick_spec(worker &w)
+{
+    const config &cfg = *w.cfg;
+    if (cfg.specs.size() == 1)
+    {
+        return 0;
+    }
+    int r = (int)(rand_r(&w.seed) % cfg.total_weight);
+    for (size_t i = 0; i < cfg.specs.size(); i++)
+    {
+        r -= cfg.specs[i].weight;
+        if (r < 0)
+        {
+            return (int)i;
+        }
+    }
+    return 0;
+}
+
+static void update_events(worker &w, int index)
+{
+    connection &c = w.conns[index];
+    bool want_write = c.state == CONN_CONNECTING || c.out_offset < c.out.size();
+    if (want_write == c.want_write)
+    {
+        return;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN | (want_write ? (uint32_t)EPOLLOUT : 0);
+    event.data.u32 = index;
+    epoll_ctl(w.epollfd, EPOLL_CTL_MOD, c.fd, &event);
+    c.want_write = want_write;
+}
+
+static void open_conn(worker &w, int index, long long now)
+{
+    connection &c = w.conns[index];
+    c.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c.fd < 0)
+    {
+        w.errors++;
+        c.retry_at = now + 10000;
+        return;
+    }
+    int one = 1;
+    setsockopt(c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int ret = connect(c.fd, (const struct sockaddr *)&w.cfg->address, sizeof(w.cfg->address));
+    if (ret != 0 && errno != EINPROGRESS)
+    {
+        close(c.fd);
+        c.fd = -1;
+        w.errors++;
+        c.retry_at = now + 10000;
+        return;
+    }
+    c.state = ret == 0 ? CONN_OPEN : CONN_CONNECTING;
+    c.out.clear();
+    c.out_offset = 0;
+    c.header.clear();
+    c.in_body = false;
+    c.close_after = false;
+    c.responses = 0;
+    c.want_write = c.state == CONN_CONNECTING;
+    struct epoll_event event;
+    event.events = EPOLLIN | (c.want_write ? (uint32_t)EPOLLOUT : 0);
+    event.data.u32 = index;
+    epoll_ctl(w.epollfd, EPOLL_CTL_ADD, c.fd, &event);
+}
+
+// 关闭连接，未收到应答的请求放回backlog队首重发；failed为true时队首的请求计为错误
+static void close_conn(worker &w, int index, bool failed)
+{
+    connection &c = w.conns[index];
+    if (c.fd >= 0)
+    {
+        epoll_ctl(w.epollfd, EPOLL_CTL_DEL, c.fd, NULL);
+        close(c.fd);
+        c.fd = -1;
+    }
+    c.state = CONN_CLOSED;
+    c.retry_at = 0;
+    if (failed && !c.inflight.empty())
+    {
+        w.errors++;
+        c.inflight.pop_front();
+    }
+    while (!c.inflight.empty())
+    {
+        w.backlog.push_front(c.inflight.back());
+        c.inflight.pop_back();
+    }
+    w.reconnects++;
+}
+
+static void send_pending(worker &w, int index, const pending &p, long long now)
+{
+    connection &c = w.conns[index];
+    pending sent = p;
+    sent.sent = now;
+    c.inflight.push_back(sent);
+    if (c.out_offset == c.out.size())
+    {
+        c.out.clear();
+        c.out_offset = 0;
+    }
+    c.out += w.cfg->specs[p.spec].text;
+}
+
+static bool flush_conn(worker &w, int index)
+{
+    connection &c = w.conns[index];
+    while (c.out_offset < c.out.size())
+    {
+        ssize_t n = send(c.fd, c.out.data() + c.out_offset, c.out.size() - c.out_offset, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            return false;
+        }
+        c.out_offset += n;
+    }
+    update_events(w, index);
+    return true;
+}
+
+// 把请求分配给有空闲流水线位置的连接：先发送backlog中的请求，闭环模式下再补充新请求
+static void dispatch(worker &w, long long now)
+{
+    const config &cfg = *w.cfg;
+    int depth = cfg.keepalive ? cfg.pipeline : 1;
+    for (size_t i = 0; i < w.conns.size(); i++)
+    {
+        connection &c = w.conns[i];
+        if (c.state != CONN_OPEN || c.close_after)
+        {
+            continue;
+        }
+        // 不保持连接时每个连接只发送一个请求
+        if (!cfg.keepalive && c.responses > 0)
+        {
+            continue;
+        }
+        bool added = false;
+        while ((int)c.inflight.size() < depth)
+        {
+            if (!w.backlog.empty())
+            {
+                send_pending(w, (int)i, w.backlog.front(), now);
+                w.backlog.pop_front();
+            }
+            else if (cfg.rps <= 0 && now < w.deadline)
+            {
+                pending p;
+                p.intended = now;
+                p.spec = pick_spec(w);
+                send_pending(w, (int)i, p, now);
+            }
+            else
+            {
+                break;
+            }
+            added = true;
+        }
+        if (added && !flush_conn(w, (int)i))
+        {
+            close_conn(w, (int)i, true);
+        }
+    }
+}
+
+// 到结束时间仍未完成的请求按结束时间计入延迟，是实际延迟的下界；sent为false表示请求还未发出
+static void record_cutoff(worker &w, const pending &p, bool sent)
+{
+    if (p.intended >= w.deadline)
+    {
+        return;
+    }
+    w.corrected.record(w.deadline - p.intended);
+    if (sent)
+    {
+        w.uncorrected.record(w.deadline - p.sent);
+    }
+}
+
+static void complete(worker &w, connection &c, long long now)
+{
+    if (c.inflight.empty())
+    {
+        return;
+    }
+    pending p = c.inflight.front();
+    c.inflight.pop_front();
+    c.responses++;
+    if (now <= w.deadline)
+    {
+        w.completed++;
+        w.status[c.status]++;
+        w.corrected.record(now - p.intended);
+        w.uncorrected.record(now - p.sent);
+    }
+    else
+    {
+        // 结束后才到达的应答与未收到应答的请求一样处理
+        w.in_flight++;
+        record_cutoff(w, p, true);
+    }
+}
+
+// 解析应答头部，返回false表示应答格式错误
+static bool parse_header(connection &c)
+{
+    const char *text = c.header.c_str();
+    if (strncmp(text, "HTTP/1.", 7) != 0 || strlen(text) < 12)
+    {
+        return false;
+    }
+    c.status = atoi(text + 9);
+    c.body_remaining = -1;
+    c.close_after = false;
+    for (const char *line = strstr(text, "\r\n"); line && line[2]; line = strstr(line + 2, "\r\n"))
+    {
+        const char *field = line + 2;
+        if (strncasecmp(field, "Content-Length:", 15) == 0)
+        {
+            c.body_remaining = atoll(field + 15);
+        }
+        else if (strncasecmp(field, "Connection:", 11) == 0)
+        {
+            const char *value = field + 11;
+            value += strspn(value, " \t");
+            c.close_after = strncasecmp(value, "close", 5) == 0;
+        }
+    }
+    return true;
+}
+
+// 读取并解析应答，返回false表示连接已关闭或出错，需要重连
+static bool read_conn(worker &w, int index, long long now)
+{
+    connection &c = w.conns[index];
+    char buf[65536];
+    while (true)
+    {
+        ssize_t n = recv(c.fd, buf, sizeof(buf), 0);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (n == 0)
+        {
+            // 没有Content-Length的应答以连接关闭为结束
+            if (c.in_body && c.body_remaining < 0)
+            {
+                complete(w, c, now);
+                c.in_body = false;
+            }
+            return false;
+        }
+        w.bytes += n;
+
+        const char *data = buf;
+        size_t left = n;
+        while (left > 0)
+        {
+            if (!c.in_body)
+            {
+                // 头部可能跨多次recv，逐段追加后查找空行
+                size_t old_length = c.header.size();
+                c.header.append(data, left);
+                size_t search_from = old_length > 3 ? old_length - 3 : 0;
+                size_t end = c.header.find("\r\n\r\n", search_from);
+                if (end == std::string::npos)
+                {
+                    left = 0;
+                    break;
+                }
+                size_t used = end + 4 - old_length;
+                c.header.resize(end + 2);
+                if (!parse_header(c))
+                {
+                    return false;
+                }
+                c.header.clear();
+                c.in_body = true;
+                data += used;
+                left -= used;
+            }
+            if (c.body_remaining < 0)
+            {
+                left = 0;
+                break;
+            }
+            size_t take = (long long)left < c.body_remaining ? left : (size_t)c.body_remaining;
+            c.body_remaining -= take;
+            data += take;
+            left -= take;
+            if (c.body_remaining == 0)
+            {
+                c.in_body = false;
+                complete(w, c, now);
+                if (c.close_after)
+                {
+                    return false;
+                }
+            }
+        }
+    }
+}
+
+static void check_timeouts(worker &w, long long now)
+{
+    for (size_t i = 0; i < w.conns.size(); i++)
+    {
+        connection &c = w.conns[i];
+        if (c.state != CONN_CLOSED && !c.inflight.empty() && now - c.inflight.front().sent > w.cfg->timeout_us)
+        {
+            w.timeouts++;
+            close_conn(w, (int)i, true);
+        }
+    }
+}
+
+static void *run_worker(void *arg)
+{
+    worker &w = *(worker *)arg;
+    const config &cfg = *w.cfg;
+    w.epollfd = epoll_create1(EPOLL_CLOEXEC);
+    long long start = now_us();
+    for (size_t i = 0; i < w.conns.size(); i++)
+    {
+        w.conns[i].fd = -1;
+        w.conns[i].state = CONN_CLOSED;
+        w.conns[i].retry_at = 0;
+        w.conns[i].close_after = false;
+        open_conn(w, (int)i, start);
+    }
+    w.reconnects = 0;
+    w.timerfd = -1;
+    if (cfg.rps > 0)
+    {
+        // 各线程的发送时间错开，合起来是均匀的
+        w.interval = 1e6 * cfg.threads / cfg.rps;
+        w.next_intended = start + w.interval * w.index / cfg.threads;
+        w.timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u32 = TIMER_INDEX;
+        epoll_ctl(w.epollfd, EPOLL_CTL_ADD, w.timerfd, &event);
+    }
+
+    struct epoll_event events[256];
+    long long last_timeout_check = start;
+    while (true)
+    {
+        long long now = now_us();
+        if (now >= w.deadline)
+        {
+            break;
+        }
+        if (cfg.rps > 0)
+        {
+            while (w.next_intended <= now && w.next_intended < w.deadline)
+            {
+                pending p;
+                p.intended = (long long)w.next_intended;
+                p.spec = pick_spec(w);
+                w.backlog.push_back(p);
+                w.next_intended += w.interval;
+            }
+        }
+        for (size_t i = 0; i < w.conns.size(); i++)
+        {
+            if (w.conns[i].state == CONN_CLOSED && now >= w.conns[i].retry_at)
+            {
+                open_conn(w, (int)i, now);
+            }
+        }
+        dispatch(w, now);
+        if (now - last_timeout_check >= 10000)
+        {
+            check_timeouts(w, now);
+            last_timeout_check = now;
+        }
+
+        if (w.timerfd >= 0)
+        {
+            long long next = (long long)w.next_intended;
+            struct itimerspec when;
+            memset(&when, 0, sizeof(when));
+            when.it_value.tv_sec = next / 1000000;
+            when.it_value.tv_nsec = (next % 1000000) * 1000;
+            timerfd_settime(w.timerfd, TFD_TIMER_ABSTIME, &when, NULL);
+        }
+        int ready = epoll_wait(w.epollfd, events, 256, 10);
+        now = now_us();
+        for (int e = 0; e < ready; e++)
+        {
+            if (events[e].data.u32 == TIMER_INDEX)
+            {
+                unsigned long long expirations;
+                ssize_t n = read(w.timerfd, &expirations, sizeof(expirations));
+                (void)n;
+                continue;
+            }
+            int index = (int)events[e].data.u32;
+            connection &c = w.conns[index];
+            if (c.state == CONN_CLOSED)
+            {
+                continue;
+            }
+            if (c.state == CONN_CONNECTING)
+            {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(c.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0)
+                {
+                    close_conn(w, index, false);
+                    w.errors++;
+                    c.retry_at = now + 10000;
+                    continue;
+                }
+                c.state = CONN_OPEN;
+                update_events(w, index);
+                continue;
+            }
+            if ((events[e].events & EPOLLOUT) && !flush_conn(w, index))
+            {
+                close_conn(w, index, true);
+                continue;
+            }
+            if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            {
+                if (!read_conn(w, index, now))
+                {
+                    // 连接上已有应答时，服务器关闭连接是正常的，未应答的请求重发；否则计为错误
+                    close_conn(w, index, c.responses == 0 && !c.inflight.empty());
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < w.conns.size(); i++)
+    {
+        connection &c = w.conns[i];
+        for (size_t k = 0; k < c.inflight.size(); k++)
+        {
+            w.in_flight++;
+            record_cutoff(w, c.inflight[k], true);
+        }
+        if (c.fd >= 0)
+        {
+            close(c.fd);
+        }
+    }
+    for (size_t k = 0; k < w.backlog.size(); k++)
+    {
+        record_cutoff(w, w.backlog[k], false);
+    }
+    if (w.timerfd >= 0)
+    {
+        close(w.timerfd);
+    }
+    close(w.epollfd);
+    return NULL;
+}
+
+static void print_latency(FILE *out, const char *name, const histogram &h)
+{
+    fprintf(out, "  \"%s\": {\"mean\": %.1f, \"p50\": %lld, \"p90\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld}", name,
+            h.total ? (double)h.sum / h.total : 0.0, h.quantile(0.5), h.quantile(0.9), h.quantile(0.99), h.quantile(0.999), h.max);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-c connections] [-t threads] [-d seconds] [-r rps] [-p pipeline] [-K]\n"
+                    "       [-u path[:weight]]... [-T timeout_ms] [-o output.json] [ip [port]]\n"
+                    "  -r 0 runs closed loop; -K opens a new connection for every request\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    config cfg;
+    cfg.ip = "127.0.0.1";
+    cfg.port = 9006;
+    cfg.connections = 64;
+    cfg.threads = 2;
+    cfg.duration = 10;
+    cfg.rps = 0;
+    cfg.pipeline = 1;
+    cfg.keepalive = true;
+    cfg.timeout_us = 5000000;
+    cfg.total_weight = 0;
+    const char *output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:d:r:p:Ku:T:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'c':
+            cfg.connections = atoi(optarg);
+            break;
+        case 't':
+            cfg.threads = atoi(optarg);
+            break;
+        case 'd':
+            cfg.duration = atof(optarg);
+            break;
+        case 'r':
+            cfg.rps = atof(optarg);
+            break;
+        case 'p':
+            cfg.pipeline = atoi(optarg);
+            break;
+        case 'K':
+            cfg.keepalive = false;
+            break;
+        case 'u':
+        {
+            request_spec spec;
+            const char *colon = strrchr(optarg, ':');
+            spec.path = colon ? std::string(optarg, colon - optarg) : std::string(optarg);
+            spec.weight = colon ? atoi(colon + 1) : 1;
+            if (spec.path.empty() || spec.path[0] != '/' || spec.weight <= 0)
+            {
+                usage(argv[0]);
+            }
+            cfg.specs.push_back(spec);
+            break;
+        }
+        case 'T':
+            cfg.timeout_us = atoll(optarg) * 1000;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc)
+    {
+        cfg.ip = argv[optind++];
+    }
+    if (optind < argc)
+    {
+        cfg.port = atoi(argv[optind++]);
+    }
+    if (optind < argc || cfg.connections <= 0 || cfg.threads <= 0 || cfg.duration <= 0 || cfg.rps < 0 ||
+        cfg.pipeline <= 0 || cfg.timeout_us <= 0)
+    {
+        usage(argv[0]);
+    }
+    if (cfg.threads > cfg.connections)
+    {
+        cfg.threads = cfg.connections;
+    }
+
+    memset(&cfg.address, 0, sizeof(cfg.address));
+    cfg.address.sin_family = AF_INET;
+    cfg.address.sin_port = htons(cfg.port);
+    if (inet_pton(AF_INET, cfg.ip, &cfg.address.sin_addr) != 1)
+    {
+        fprintf(stderr, "invalid address %s\n", cfg.ip);
+        return 1;
+    }
+    if ((ntohl(cfg.address.sin_addr.s_addr) >> 24) != 127)
+    {
+        fprintf(stderr, "warning: %s is not a loopback address, network latency is included\n", cfg.ip);
+    }
+
+    if (cfg.specs.empty())
+    {
+        request_spec spec;
+        spec.path = "/welcome.html";
+        spec.weight = 1;
+        cfg.specs.push_back(spec);
+    }
+    char host[64];
+    snprintf(host, sizeof(host), "%s:%d", cfg.ip, cfg.port);
+    for (size_t i = 0; i < cfg.specs.size(); i++)
+    {
+        request_spec &spec = cfg.specs[i];
+        spec.text = "GET " + spec.path + " HTTP/1.1\r\nHost: " + host +
+                    (cfg.keepalive ? "\r\nConnection: keep-alive\r\n\r\n" : "\r\nConnection: close\r\n\r\n");
+        cfg.total_weight += spec.weight;
+    }
+
+    std::vector<worker> workers(cfg.threads);
+    std::vector<pthread_t> threads(cfg.threads);
+    long long start = now_us();
+    long long deadline = start + (long long)(cfg.duration * 1e6);
+    for (int i = 0; i < cfg.threads; i++)
+    {
+        worker &w = workers[i];
+        w.index = i;
+        w.cfg = &cfg;
+        w.conns.resize(cfg.connections / cfg.threads + (i < cfg.connections % cfg.threads ? 1 : 0));
+        w.seed = (unsigned int)(start + i * 7919);
+        w.next_intended = 0;
+        w.interval = 0;
+        w.deadline = deadline;
+        w.completed = w.errors = w.timeouts = w.reconnects = w.bytes = w.in_flight = 0;
+        if (pthread_create(&threads[i], NULL, run_worker, &w) != 0)
+        {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+    }
+
+    histogram corrected, uncorrected;
+    long long completed = 0, errors = 0, timeouts = 0, reconnects = 0, bytes = 0, unsent = 0, in_flight = 0;
+    std::map<int, long long> status;
+    for (int i = 0; i < cfg.threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+        worker &w = workers[i];
+        corrected.merge(w.corrected);
+        uncorrected.merge(w.uncorrected);
+        completed += w.completed;
+        errors += w.errors;
+        timeouts += w.timeouts;
+        reconnects += w.reconnects;
+        bytes += w.bytes;
+        unsent += (long long)w.backlog.size();
+        in_flight += w.in_flight;
+        for (std::map<int, long long>::iterator it = w.status.begin(); it != w.status.end(); ++it)
+        {
+            status[it->first] += it->second;
+        }
+    }
+    double elapsed = (now_us() - start) / 1e6;
+
+    FILE *out = output ? fopen(output, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "cannot open %s\n", output);
+        return 1;
+    }
+    fprintf(out, "{\n");
+    fprintf(out, "  \"target\": \"%s\",\n  \"mode\": \"%s\",\n", host, cfg.rps > 0 ? "open" : "closed");
+    fprintf(out, "  \"connections\": %d,\n  \"threads\": %d,\n  \"pipeline\": %d,\n  \"keepalive\": %s,\n",
+            cfg.connections, cfg.threads, cfg.pipeline, cfg.keepalive ? "true" : "false");
+    fprintf(out, "  \"paths\": [");
+    for (size_t i = 0; i < cfg.specs.size(); i++)
+    {
+        fprintf(out, "%s{\"path\": \"%s\", \"weight\": %d}", i ? ", " : "", cfg.specs[i].path.c_str(), cfg.specs[i].weight);
+    }
+    fprintf(out, "],\n");
+    fprintf(out, "  \"target_rps\": %.1f,\n  \"duration_s\": %.3f,\n", cfg.rps, elapsed);
+    fprintf(out, "  \"requests\": %lld,\n  \"throughput_rps\": %.1f,\n  \"bytes\": %lld,\n", completed,
+            completed / cfg.duration, bytes);
+    fprintf(out, "  \"errors\": %lld,\n  \"timeouts\": %lld,\n  \"reconnects\": %lld,\n  \"in_flight\": %lld,\n"
+                 "  \"unsent\": %lld,\n", errors, timeouts, reconnects, in_flight, unsent);
+    fprintf(out, "  \"status\": {");
+    for (std::map<int, long long>::iterator it = status.begin(); it != status.end(); ++it)
+    {
+        fprintf(out, "%s\"%d\": %lld", it == status.begin() ? "" : ", ", it->first, it->second);
+    }
+    fprintf(out, "},\n");
+    print_latency(out, "latency_us", corrected);
+    fprintf(out, ",\n");
+    print_latency(out, "uncorrected_latency_us", uncorrected);
+    fprintf(out, "\n}\n");
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    return 0;
+}
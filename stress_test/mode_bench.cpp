@@ -0,0 +1,689 @@
+/*************************************************************
+*服务器模式对比测试
+*每种模式由编译选项和服务器的运行期选项组成，用make server SERVER_DEFS=...构建服务器（编译选项相同的模式共用一次构建），
+*带上运行期选项在本机回环地址上启动，
+*服务器和负载生成器load_gen分别绑定到固定的CPU集合，依次用不同的并发连接数压测
+*每次压测记录吞吐量、延迟分位数（load_gen按预定发送时间修正后的值）、服务器每个请求消耗的CPU时间
+*（/proc/pid/stat中utime+stime的增量）和压测结束时服务器的RSS，输出对比表格并保存为JSON
+*用-b指定之前保存的JSON时，表格中增加与之相比的吞吐量和p99变化，方便发现两次提交之间的性能回退
+*需要在仓库根目录下运行，load_gen不存在时先执行make load_gen
+*用法：./stress_test/mode_bench [-m 模式,...] [-M 名称=编译选项]... [-A 名称=运行期选项]... [-c 并发数,...] [-d 秒数] [-w 预热秒数]
+*                              [-s 服务器CPU列表] [-l 负载生成器CPU列表] [-p 端口] [-o 输出文件] [-b 基准文件]
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "../threadpool/affinity.h"
+
+// 一种服务器模式：名称、传给编译器的-D选项和服务器的命令行选项（以空格分隔）
+struct mode
+{
+    std::string name;
+    std::string defs;
+    std::string args;
+};
+
+// 内置的模式，与main.cpp中的默认配置（水平触发、同步日志、8个解析线程）对比
+static const char *builtin_modes[][3] = {
+    {"baseline", "", ""},
+    {"et", "", "--trigger=et --listen-trigger=et"},
+    {"asynlog", "", "--log=async"},
+    {"deferlog", "", "--log=defer"},
+    {"threads2", "", "--threads=2"},
+    {"threads16", "", "--threads=16"},
+};
+
+struct result
+{
+    std::string mode;
+    int concurrency;
+    double rps;
+    double p50;
+    double p99;
+    double cpu_us;      // 每个请求消耗的服务器CPU时间(us)
+    long long rss_kb;
+    long long errors;
+};
+
+static void split(const char *list, std::vector<std::string> &out)
+{
+    std::string s(list);
+    size_t begin = 0;
+    while (begin <= s.size())
+    {
+        size_t end = s.find(',', begin);
+        if (end == std::string::npos)
+        {
+            end = s.size();
+        }
+        if (end > begin)
+        {
+            out.push_back(s.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+}
+
+static std::string run_output(const char *command)
+{
+    std::string out;
+    FILE *p = popen(command, "r");
+    if (!p)
+    {
+        return out;
+    }
+    char buf[256];
+    while (fgets(buf, sizeof(buf), p))
+    {
+        out += buf;
+    }
+    pclose(p);
+    while (!out.empty() && (out[out.size() - 1] == '\n' || out[out.size() - 1] == '\r'))
+    {
+        out.erase(out.size() - 1);
+    }
+    return out;
+}
+
+static bool read_file(const std::string &path, std::string &out)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f)
+    {
+        return false;
+    }
+    char buf[4096];
+    size_t n;
+    out.clear();
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    {
+        out.append(buf, n);
+    }
+    fclose(f);
+    return true;
+}
+
+// 在text的from之后查找"key": 并取出其后的数值，找不到时返回def
+static double json_number(const std::string &text, const char *key, double def, size_t from = 0)
+{
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t pos = text.find(pattern, from);
+    if (pos == std::string::npos)
+    {
+        return def;
+    }
+    return strtod(text.c_str() + pos + pattern.size(), NULL);
+}
+
+static std::string json_string(const std::string &text, const char *key)
+{
+    std::string pattern = std::string("\"") + key + "\": \"";
+    size_t pos = text.find(pattern);
+    if (pos == std::string::npos)
+    {
+        return "";
+    }
+    pos += pattern.size();
+    size_t end = text.find('"', pos);
+    return end == std::string::npos ? "" : text.substr(pos, end - pos);
+}
+
+// 子进程中绑定CPU，把输出重定向到文件后执行argv
+static pid_t spawn(const std::vector<int> &cpus, const std::string &dir, const std::string &log, char *const argv[])
+{
+    pid_t pid = fork();
+    if (pid != 0)
+    {
+        return pid;
+    }
+    if (!cpus.empty())
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t i = 0; i < cpus.size(); i++)
+        {
+            CPU_SET(cpus[i], &set);
+        }
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+    if (!dir.empty() && chdir(dir.c_str()) != 0)
+    {
+        _exit(127);
+    }
+    int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd >= 0)
+    {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    execv(argv[0], argv);
+    _exit(127);
+}
+
+// 服务器开始监听前最多等待timeout_ms
+static bool wait_listening(int port, pid_t server, int timeout_ms)
+{
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    for (int waited = 0; waited < timeout_ms; waited += 50)
+    {
+        if (waitpid(server, NULL, WNOHANG) == server)
+        {
+            return false;
+        }
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        bool ok = connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0;
+        close(fd);
+        if (ok)
+        {
+            return true;
+        }
+        usleep(50 * 1000);
+    }
+    return false;
+}
+
+// 进程累计的用户态和内核态CPU时间(us)
+static long long cpu_time_us(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    std::string stat;
+    if (!read_file(path, stat))
+    {
+        return 0;
+    }
+    // 进程名可能含空格，从最后一个')'之后开始数字段，utime和stime是第14、15个字段
+    size_t pos = stat.rfind(')');
+    if (pos == std::string::npos)
+    {
+        return 0;
+    }
+    unsigned long long utime = 0, stime = 0;
+    if (sscanf(stat.c_str() + pos + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2)
+    {
+        return 0;
+    }
+    return (long long)((utime + stime) * 1000000ULL / sysconf(_SC_CLK_TCK));
+}
+
+static long long rss_kb(pid_t pid)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+    std::string status;
+    if (!read_file(path, status))
+    {
+        return 0;
+    }
+    size_t pos = status.find("VmRSS:");
+    return pos == std::string::npos ? 0 : atoll(status.c_str() + pos + 6);
+}
+
+// load_gen的绝对路径，load_gen在服务器的工作目录中运行
+static std::string load_gen_path;
+// 服务器在临时目录中运行，用绝对路径指定仓库中的网站根目录
+static std::string doc_root_arg;
+
+// 运行一次load_gen，返回false表示load_gen失败
+static bool load(const std::vector<int> &cpus, const std::string &dir, int port, int concurrency, int seconds,
+                 const std::string &output, std::string &json)
+{
+    char c[16], d[16], p[16];
+    snprintf(c, sizeof(c), "%d", concurrency);
+    snprintf(d, sizeof(d), "%d", seconds);
+    snprintf(p, sizeof(p), "%d", port);
+    int threads = cpus.empty() ? 2 : (int)cpus.size();
+    char t[16];
+    snprintf(t, sizeof(t), "%d", threads < concurrency ? threads : concurrency);
+    char *argv[] = {(char *)load_gen_path.c_str(), (char *)"-c", c, (char *)"-t", t, (char *)"-d", d,
+                    (char *)"-o", (char *)output.c_str(), (char *)"127.0.0.1", p, NULL};
+    pid_t pid = spawn(cpus, dir, dir + "/load_gen.out", argv);
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        return false;
+    }
+    return read_file(output, json);
+}
+
+static bool stop_server(pid_t server)
+{
+    kill(server, SIGTERM);
+    for (int i = 0; i < 100; i++)
+    {
+        if (waitpid(server, NULL, WNOHANG) == server)
+        {
+            return true;
+        }
+        usleep(50 * 1000);
+    }
+    kill(server, SIGKILL);
+    waitpid(server, NULL, 0);
+    return false;
+}
+
+// 读取之前保存的结果，每个结果占一行
+static void load_baseline(const char *path, std::vector<result> &baseline)
+{
+    std::string text;
+    if (!read_file(path, text))
+    {
+        fprintf(stderr, "cannot read baseline %s\n", path);
+        return;
+    }
+    size_t begin = 0;
+    while (begin < text.size())
+    {
+        size_t end = text.find('\n', begin);
+        if (end == std::string::npos)
+        {
+            end = text.size();
+        }
+        std::string line = text.substr(begin, end - begin);
+        if (line.find("\"concurrency\"") != std::string::npos)
+        {
+            result r;
+            r.mode = json_string(line, "mode");
+            r.concurrency = (int)json_number(line, "concurrency", 0);
+            r.rps = json_number(line, "rps", 0);
+            r.p50 = json_number(line, "p50_us", 0);
+            r.p99 = json_number(line, "p99_us", 0);
+            r.cpu_us = json_number(line, "cpu_us_per_req", 0);
+            r.rss_kb = (long long)json_number(line, "rss_kb", 0);
+            r.errors = (long long)json_number(line, "errors", 0);
+            baseline.push_back(r);
+        }
+        begin = end + 1;
+    }
+}
+
+static const result *find(const std::vector<result> &results, const result &r)
+{
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        if (results[i].mode == r.mode && results[i].concurrency == r.concurrency)
+        {
+            return &results[i];
+        }
+    }
+    return NULL;
+}
+
+static void print_row(const result &r, const result *base)
+{
+    printf("%-12s %6d %10.0f %9.0f %9.0f %8.1f %9lld %7lld", r.mode.c_str(), r.concurrency, r.rps, r.p50, r.p99,
+           r.cpu_us, r.rss_kb, r.errors);
+    if (base && base->rps > 0 && base->p99 > 0)
+    {
+        printf(" %+7.1f%% %+7.1f%%", (r.rps / base->rps - 1) * 100, (r.p99 / base->p99 - 1) * 100);
+    }
+    printf("\n");
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-m mode,...] [-M name=defs]... [-A name=args]... [-c concurrency,...] [-d seconds] [-w warmup]\n"
+                    "       [-s server_cpus] [-l loadgen_cpus] [-p port] [-o output.json] [-b baseline.json]\n"
+                    "  built-in modes:", name);
+    for (size_t i = 0; i < sizeof(builtin_modes) / sizeof(builtin_modes[0]); i++)
+    {
+        fprintf(stderr, " %s", builtin_modes[i][0]);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> names, levels;
+    std::vector<mode> custom;
+    int seconds = 5, warmup = 1, port = 9106;
+    const char *server_spec = "0";
+    const char *load_spec = NULL;
+    const char *baseline_path = NULL;
+    std::string output;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:M:A:c:d:w:s:l:p:o:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'm':
+            split(optarg, names);
+            break;
+        case 'M':
+        case 'A':
+        {
+            // 同名的-M和-A合并为一种模式
+            const char *eq = strchr(optarg, '=');
+            if (!eq || eq == optarg)
+            {
+                usage(argv[0]);
+            }
+            std::string name(optarg, eq - optarg);
+            size_t k = 0;
+            while (k < custom.size() && custom[k].name != name)
+            {
+                k++;
+            }
+            if (k == custom.size())
+            {
+                mode m;
+                m.name = name;
+                custom.push_back(m);
+                names.push_back(name);
+            }
+            (opt == 'M' ? custom[k].defs : custom[k].args) = eq + 1;
+            break;
+        }
+        case 'c':
+            split(optarg, levels);
+            break;
+        case 'd':
+            seconds = atoi(optarg);
+            break;
+        case 'w':
+            warmup = atoi(optarg);
+            break;
+        case 's':
+            server_spec = optarg;
+            break;
+        case 'l':
+            load_spec = optarg;
+            break;
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'b':
+            baseline_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind < argc || seconds <= 0 || warmup < 0 || port <= 0)
+    {
+        usage(argv[0]);
+    }
+    if (access("./main.cpp", F_OK) != 0 || access("./makefile", F_OK) != 0)
+    {
+        fprintf(stderr, "run from the repository root\n");
+        return 1;
+    }
+
+    // 模式：-m选择的内置模式和-M定义的模式，都未指定时运行所有内置模式
+    std::vector<mode> modes;
+    if (names.empty())
+    {
+        for (size_t i = 0; i < sizeof(builtin_modes) / sizeof(builtin_modes[0]); i++)
+        {
+            names.push_back(builtin_modes[i][0]);
+        }
+    }
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        bool found = false;
+        for (size_t j = 0; j < custom.size() && !found; j++)
+        {
+            if (custom[j].name == names[i])
+            {
+                modes.push_back(custom[j]);
+                found = true;
+            }
+        }
+        for (size_t j = 0; j < sizeof(builtin_modes) / sizeof(builtin_modes[0]) && !found; j++)
+        {
+            if (names[i] == builtin_modes[j][0])
+            {
+                mode m;
+                m.name = builtin_modes[j][0];
+                m.defs = builtin_modes[j][1];
+                m.args = builtin_modes[j][2];
+                modes.push_back(m);
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            fprintf(stderr, "unknown mode %s\n", names[i].c_str());
+            usage(argv[0]);
+        }
+    }
+    if (levels.empty())
+    {
+        split("16,64,256", levels);
+    }
+
+    // 负载生成器默认使用服务器之外的CPU，只有一个CPU时两者共用
+    std::vector<int> server_cpus, load_cpus;
+    if (!parse_cpu_list(server_spec, server_cpus))
+    {
+        fprintf(stderr, "invalid cpu list %s\n", server_spec);
+        return 1;
+    }
+    if (load_spec)
+    {
+        if (!parse_cpu_list(load_spec, load_cpus))
+        {
+            fprintf(stderr, "invalid cpu list %s\n", load_spec);
+            return 1;
+        }
+    }
+    else
+    {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        for (int cpu = 0; cpu < online; cpu++)
+        {
+            bool used = false;
+            for (size_t i = 0; i < server_cpus.size(); i++)
+            {
+                used = used || server_cpus[i] == cpu;
+            }
+            if (!used)
+            {
+                load_cpus.push_back(cpu);
+            }
+        }
+        if (load_cpus.empty())
+        {
+            load_cpus = server_cpus;
+        }
+    }
+    std::string load_desc;
+    for (size_t i = 0; i < load_cpus.size(); i++)
+    {
+        char cpu[16];
+        snprintf(cpu, sizeof(cpu), "%s%d", i ? "," : "", load_cpus[i]);
+        load_desc += cpu;
+    }
+
+    if (access("./stress_test/load_gen", X_OK) != 0 && system("make load_gen > /dev/null") != 0)
+    {
+        fprintf(stderr, "make load_gen failed\n");
+        return 1;
+    }
+
+    std::string commit = run_output("git rev-parse --short HEAD 2>/dev/null");
+    if (commit.empty())
+    {
+        commit = "unknown";
+    }
+    if (run_output("git status --porcelain --untracked-files=no 2>/dev/null").size() > 0)
+    {
+        commit += "-dirty";
+    }
+    if (output.empty())
+    {
+        output = "mode_bench_" + commit + ".json";
+    }
+    std::vector<result> baseline;
+    if (baseline_path)
+    {
+        load_baseline(baseline_path, baseline);
+    }
+
+    // 每种模式的服务器在单独的临时目录中运行，日志和管理套接字不会互相影响
+    char dir_template[] = "/tmp/mode_bench.XXXXXX";
+    if (!mkdtemp(dir_template))
+    {
+        fprintf(stderr, "mkdtemp failed: %s\n", strerror(errno));
+        return 1;
+    }
+    std::string root = dir_template;
+    load_gen_path = run_output("pwd") + "/stress_test/load_gen";
+    doc_root_arg = "--doc-root=" + run_output("pwd") + "/root";
+
+    printf("commit %s, server cpus %s, load_gen cpus %s, %ds per run, work dir %s\n", commit.c_str(), server_spec,
+           load_desc.c_str(), seconds, root.c_str());
+    printf("%-12s %6s %10s %9s %9s %8s %9s %7s%s\n", "mode", "conns", "rps", "p50(us)", "p99(us)", "cpu(us)",
+           "rss(kB)", "errors", baseline.empty() ? "" : "    d_rps    d_p99");
+
+    std::vector<result> results;
+    std::map<std::string, std::string> builds;  // 编译选项到服务器可执行文件
+    for (size_t i = 0; i < modes.size(); i++)
+    {
+        const mode &m = modes[i];
+        std::string dir = root + "/" + m.name;
+        if (system(("mkdir -p '" + dir + "'").c_str()) != 0)
+        {
+            fprintf(stderr, "%s: cannot create %s\n", m.name.c_str(), dir.c_str());
+            continue;
+        }
+        if (builds.find(m.defs) == builds.end())
+        {
+            std::string binary = dir + "/server";
+            std::string command = "make -B server SERVER='" + binary + "' SERVER_DEFS='" + m.defs + "' > '" + dir +
+                                  "/build.log' 2>&1";
+            if (system(command.c_str()) != 0)
+            {
+                fprintf(stderr, "%s: build failed, see %s/build.log\n", m.name.c_str(), dir.c_str());
+                continue;
+            }
+            builds[m.defs] = binary;
+        }
+        std::string binary = builds[m.defs];
+
+        char port_arg[16];
+        snprintf(port_arg, sizeof(port_arg), "%d", port);
+        std::vector<std::string> args;
+        std::string words = m.args;
+        for (size_t k = 0; k < words.size(); k++)
+        {
+            words[k] = words[k] == ' ' ? ',' : words[k];
+        }
+        split(words.c_str(), args);
+        std::vector<char *> server_argv;
+        server_argv.push_back((char *)binary.c_str());
+        server_argv.push_back((char *)doc_root_arg.c_str());
+        for (size_t k = 0; k < args.size(); k++)
+        {
+            server_argv.push_back((char *)args[k].c_str());
+        }
+        server_argv.push_back((char *)"127.0.0.1");
+        server_argv.push_back(port_arg);
+        server_argv.push_back(NULL);
+        pid_t server = spawn(server_cpus, dir, dir + "/server.out", &server_argv[0]);
+        if (server < 0 || !wait_listening(port, server, 5000))
+        {
+            fprintf(stderr, "%s: server did not start, see %s/server.out\n", m.name.c_str(), dir.c_str());
+            if (server > 0)
+            {
+                stop_server(server);
+            }
+            continue;
+        }
+
+        std::string json;
+        if (warmup > 0)
+        {
+            load(load_cpus, dir, port, atoi(levels[0].c_str()), warmup, dir + "/warmup.json", json);
+        }
+        for (size_t j = 0; j < levels.size(); j++)
+        {
+            int concurrency = atoi(levels[j].c_str());
+            if (concurrency <= 0)
+            {
+                continue;
+            }
+            char name[64];
+            snprintf(name, sizeof(name), "/load_%d.json", concurrency);
+            long long cpu_before = cpu_time_us(server);
+            if (!load(load_cpus, dir, port, concurrency, seconds, dir + name, json))
+            {
+                fprintf(stderr, "%s: load_gen failed at %d connections, see %s/load_gen.out\n", m.name.c_str(),
+                        concurrency, dir.c_str());
+                continue;
+            }
+            long long cpu = cpu_time_us(server) - cpu_before;
+
+            result r;
+            r.mode = m.name;
+            r.concurrency = concurrency;
+            r.rps = json_number(json, "throughput_rps", 0);
+            size_t latency = json.find("\"latency_us\"");
+            r.p50 = latency == std::string::npos ? 0 : json_number(json, "p50", 0, latency);
+            r.p99 = latency == std::string::npos ? 0 : json_number(json, "p99", 0, latency);
+            long long requests = (long long)json_number(json, "requests", 0);
+            r.cpu_us = requests > 0 ? (double)cpu / requests : 0;
+            r.rss_kb = rss_kb(server);
+            r.errors = (long long)(json_number(json, "errors", 0) + json_number(json, "timeouts", 0));
+            results.push_back(r);
+            print_row(r, find(baseline, r));
+            fflush(stdout);
+        }
+        stop_server(server);
+    }
+
+    FILE *out = fopen(output.c_str(), "w");
+    if (!out)
+    {
+        fprintf(stderr, "cannot open %s\n", output.c_str());
+        return 1;
+    }
+    time_t now = time(NULL);
+    char date[32];
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+    fprintf(out, "{\n  \"commit\": \"%s\",\n  \"date\": \"%s\",\n  \"server_cpus\": \"%s\",\n  \"load_cpus\": \"%s\",\n",
+            commit.c_str(), date, server_spec, load_desc.c_str());
+    fprintf(out, "  \"duration_s\": %d,\n  \"modes\": [", seconds);
+    for (size_t i = 0; i < modes.size(); i++)
+    {
+        fprintf(out, "%s{\"name\": \"%s\", \"defs\": \"%s\", \"args\": \"%s\"}", i ? ", " : "", modes[i].name.c_str(),
+                modes[i].defs.c_str(), modes[i].args.c_str());
+    }
+    fprintf(out, "],\n  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const result &r = results[i];
+        fprintf(out, "    {\"mode\": \"%s\", \"concurrency\": %d, \"rps\": %.1f, \"p50_us\": %.0f, \"p99_us\": %.0f, "
+                     "\"cpu_us_per_req\": %.2f, \"rss_kb\": %lld, \"errors\": %lld}%s\n",
+                r.mode.c_str(), r.concurrency, r.rps, r.p50, r.p99, r.cpu_us, r.rss_kb, r.errors,
+                i + 1 < results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+    printf("results written to %s\n", output.c_str());
+    return 0;
+}
@@ -0,0 +1,152 @@
+#ifndef __AFFINITY_H__
+#define __AFFINITY_H__
+
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+/**
+ * CPU亲和性与NUMA内存放置的辅助函数
+ * 不依赖libnuma，NUMA拓扑从/sys中读取，内存策略直接使用mbind系统调用
+*/
+
+// 与<linux/mempolicy.h>中的定义一致
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+/**
+ * 解析CPU列表，格式与taskset -c相同，如"0-3,6"
+ * 另外支持"node:N"，表示NUMA节点N上的所有CPU
+ * 空字符串表示不绑定，返回true且cpus为空
+*/
+inline bool parse_cpu_list(const char *spec, std::vector<int> &cpus)
+{
+    cpus.clear();
+    if (!spec || spec[0] == '\0')
+    {
+        return true;
+    }
+
+    char buf[256];
+    if (strncmp(spec, "node:", 5) == 0)
+    {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", atoi(spec + 5));
+        FILE *fp = fopen(path, "r");
+        if (!fp)
+        {
+            return false;
+        }
+        bool ok = fgets(buf, sizeof(buf), fp) != NULL;
+        fclose(fp);
+        if (!ok)
+        {
+            return false;
+        }
+        buf[strcspn(buf, "\n")] = '\0';
+        return parse_cpu_list(buf, cpus);
+    }
+
+    const char *p = spec;
+    while (*p)
+    {
+        char *end;
+        long first = strtol(p, &end, 10);
+        if (end == p || first < 0)
+        {
+            return false;
+        }
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || last < first)
+            {
+                return false;
+            }
+            p = end;
+        }
+        for (long cpu = first; cpu <= last; cpu++)
+        {
+            cpus.push_back((int)cpu);
+        }
+        if (*p == ',')
+        {
+            p++;
+        }
+        else if (*p != '\0')
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * 把调用线程绑定到指定CPU上
+*/
+inline bool pin_current_thread(int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+    {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+/**
+ * 查询CPU所在的NUMA节点，/sys/devices/system/cpu/cpuN/下有nodeM目录
+ * 单节点或没有NUMA信息的机器返回-1
+*/
+inline int cpu_to_node(int cpu)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (!dir)
+    {
+        return -1;
+    }
+    int node = -1;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9')
+        {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+/**
+ * 让[addr, addr + len)范围内的内存优先从node节点分配
+ * 需要在内存第一次被访问之前调用，之后由first-touch在该节点上分配物理页
+*/
+inline bool bind_memory_to_node(void *addr, size_t len, int node)
+{
+    if (node < 0 || node >= (int)(sizeof(unsigned long) * 8))
+    {
+        return false;
+    }
+    long page = sysconf(_SC_PAGESIZE);
+    unsigned long start = (unsigned long)addr & ~(unsigned long)(page - 1);
+    unsigned long end = (unsigned long)addr + len;
+    unsigned long nodemask = 1UL << node;
+    return syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8, 0) == 0;
+}
+
+#endif
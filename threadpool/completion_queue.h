@@ -0,0 +1,88 @@
+#ifndef __COMPLETION_QUEUE_H__
+#define __COMPLETION_QUEUE_H__
+
+#include <vector>
+#include <exception>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "../lock/locker.h"
+#include "task.h"
+
+/**
+ * 完成队列
+ * 工作线程把需要在事件循环线程中执行的后续操作（如重新注册epoll事件、关闭连接）投递到这里，
+ * 并通过eventfd唤醒事件循环；事件循环把eventfd注册到epoll中，可读时调用run()执行所有投递的任务
+ * 这样epoll内核事件表和连接状态只由事件循环线程修改
+*/
+class completion_queue
+{
+public:
+    completion_queue() : m_eventfd(-1)
+    {
+        m_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (m_eventfd < 0)
+        {
+            throw std::exception();
+        }
+    }
+
+    ~completion_queue()
+    {
+        close(m_eventfd);
+    }
+
+    // 需要注册到epoll中的文件描述符
+    int get_fd() const
+    {
+        return m_eventfd;
+    }
+
+    /**
+     * 投递一个任务，可在任意线程中调用
+     * 只有队列由空变为非空时才写eventfd，避免一批完成事件产生多次系统调用
+    */
+    void post(task t)
+    {
+        m_locker.lock();
+        bool need_wakeup = m_pending.empty();
+        m_pending.push_back(std::move(t));
+        m_locker.unlock();
+
+        if (need_wakeup)
+        {
+            uint64_t one = 1;
+            ssize_t ret = write(m_eventfd, &one, sizeof(one));
+            (void)ret; // 计数器溢出时返回EAGAIN，此时eventfd已经可读，不影响唤醒
+        }
+    }
+
+    /**
+     * 在事件循环线程中调用，执行所有已投递的任务
+     * 先在锁内交换出整个队列，再在锁外逐个执行，执行期间新投递的任务会再次唤醒事件循环
+    */
+    void run()
+    {
+        uint64_t count;
+        ssize_t ret = read(m_eventfd, &count, sizeof(count));
+        (void)ret;
+
+        m_locker.lock();
+        m_running.swap(m_pending);
+        m_locker.unlock();
+
+        for (size_t i = 0; i < m_running.size(); i++)
+        {
+            m_running[i]();
+        }
+        m_running.clear();
+    }
+
+private:
+    int m_eventfd;               // 唤醒事件循环的eventfd
+    locker m_locker;             // 保护m_pending的互斥锁
+    std::vector<task> m_pending; // 等待事件循环执行的任务
+    std::vector<task> m_running; // 事件循环正在执行的任务，与m_pending交换以复用内存
+};
+
+#endif
@@ -0,0 +1,141 @@
+#ifndef __TASK_H__
+#define __TASK_H__
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * 只能移动的通用任务类，用于在线程之间传递任意可调用对象
+ * 与std::function相比：
+ * 1. 只要求可调用对象可移动，可以捕获unique_ptr等只能移动的资源
+ * 2. 小于INLINE_SIZE的可调用对象直接存放在内部缓冲区中，不需要堆分配
+ *    (捕获几个指针和整数的lambda都属于这种情况)
+*/
+class task
+{
+public:
+    // 内部缓冲区大小，超过该大小或对齐要求过高的可调用对象放到堆上
+    static constexpr std::size_t INLINE_SIZE = 48;
+
+public:
+    task() : m_ops(NULL) {}
+
+    template <typename F,
+              typename = typename std::enable_if<!std::is_same<typename std::decay<F>::type, task>::value>::type>
+    task(F &&f) : m_ops(NULL)
+    {
+        typedef typename std::decay<F>::type functor;
+        if (sizeof(functor) <= INLINE_SIZE && alignof(functor) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible<functor>::value)
+        {
+            new (m_storage) functor(std::forward<F>(f));
+            m_ops = &inline_ops<functor>::table;
+        }
+        else
+        {
+            *reinterpret_cast<functor **>(m_storage) = new functor(std::forward<F>(f));
+            m_ops = &heap_ops<functor>::table;
+        }
+    }
+
+    task(task &&other) : m_ops(other.m_ops)
+    {
+        if (m_ops)
+        {
+            m_ops->move(m_storage, other.m_storage);
+            other.m_ops = NULL;
+        }
+    }
+
+    task &operator=(task &&other)
+    {
+        if (this != &other)
+        {
+            reset();
+            m_ops = other.m_ops;
+            if (m_ops)
+            {
+                m_ops->move(m_storage, other.m_storage);
+                other.m_ops = NULL;
+            }
+        }
+        return *this;
+    }
+
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    ~task()
+    {
+        reset();
+    }
+
+    // 执行任务
+    void operator()()
+    {
+        m_ops->invoke(m_storage);
+    }
+
+    // 是否持有可调用对象
+    explicit operator bool() const
+    {
+        return m_ops != NULL;
+    }
+
+    // 销毁持有的可调用对象
+    void reset()
+    {
+        if (m_ops)
+        {
+            m_ops->destroy(m_storage);
+            m_ops = NULL;
+        }
+    }
+
+private:
+    // 类型擦除后的操作表，每种可调用对象类型对应一个静态实例
+    struct ops
+    {
+        void (*invoke)(void *storage);
+        void (*move)(void *dst, void *src); // 移动到dst并销毁src
+        void (*destroy)(void *storage);
+    };
+
+    // 可调用对象直接存放在m_storage中
+    template <typename F>
+    struct inline_ops
+    {
+        static void invoke(void *storage) { (*static_cast<F *>(storage))(); }
+        static void move(void *dst, void *src)
+        {
+            new (dst) F(std::move(*static_cast<F *>(src)));
+            static_cast<F *>(src)->~F();
+        }
+        static void destroy(void *storage) { static_cast<F *>(storage)->~F(); }
+        static const ops table;
+    };
+
+    // m_storage中只存放指向堆上可调用对象的指针
+    template <typename F>
+    struct heap_ops
+    {
+        static void invoke(void *storage) { (**static_cast<F **>(storage))(); }
+        static void move(void *dst, void *src) { *static_cast<F **>(dst) = *static_cast<F **>(src); }
+        static void destroy(void *storage) { delete *static_cast<F **>(storage); }
+        static const ops table;
+    };
+
+private:
+    alignas(std::max_align_t) unsigned char m_storage[INLINE_SIZE];
+    const ops *m_ops;
+};
+
+template <typename F>
+const task::ops task::inline_ops<F>::table = {&task::inline_ops<F>::invoke, &task::inline_ops<F>::move, &task::inline_ops<F>::destroy};
+
+template <typename F>
+const task::ops task::heap_ops<F>::table = {&task::heap_ops<F>::invoke, &task::heap_ops<F>::move, &task::heap_ops<F>::destroy};
+
+#endif
@@ -2,13 +2,42 @@
 #define __THREADPOOL_H__
 
 #include "../lock/locker.h"
+#include "task.h"
+#include "affinity.h"
+#include "../profiler/profiler.h"
 
-#include <list>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <string>
 #include <cstdio>
 #include <exception>
 #include <pthread.h>
-#include "../lock/locker.h"
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
 
+/**
+ * 看门狗发现工作线程卡住时报告的信息
+*/
+template <typename T>
+struct stall_info
+{
+    const char *pool;       // 线程池的名字
+    int worker;             // 工作线程的编号
+    pid_t tid;              // 工作线程的内核线程号
+    long long stalled_ms;   // 当前任务已执行的时间
+    T *request;             // 当前任务处理的请求，通过set_current设置，可能为NULL
+    std::string stack;      // 工作线程的调用栈，每帧一行，取不到时为空
+    bool replaced;          // 是否已创建新线程顶替
+};
+
+/**
+ * 线程池
+ * 工作队列中存放的是通用的task，可以执行任意只能移动的可调用对象；
+ * append(T *)是对submit的封装，用于执行T::process()
+*/
 template <typename T>
 class threadpool
 {
@@ -16,142 +45,730 @@ public:
     /**
      * 构造函数
     */
-    threadpool(int thread_number = 8, int max_requests = 10000);
+    threadpool(int thread_number = 8, int max_requests = 10000, int lane_number = 1);
     /**
-     * 析构函数
+     * 析构函数，未停止的线程池在这里硬停止
     */
     ~threadpool();
+    /**
+     * 创建工作线程，开始处理任务
+    */
+    bool start();
+    /**
+     * 优雅停止：不再接受新任务，在timeout_ms毫秒内等待已入队和正在执行的任务完成，然后停止所有线程
+     * 超时前全部完成返回true；被看门狗顶替的线程中的任务不计入等待，见abandoned()
+    */
+    bool drain(int timeout_ms);
+    /**
+     * 硬停止：丢弃队列中尚未执行的任务，唤醒所有工作线程并等待它们退出
+     * timeout_ms为负数时一直等待；超时后仍在执行任务的线程将被放弃（分离），空闲的线程总是等待其退出
+     * 被放弃的线程完成任务后直接退出，不再访问线程池，只访问自己的槽位
+    */
+    void stop(int timeout_ms = -1);
     /**
      * 向请求队列添加任务
+     * lane为优先级通道，0号通道优先级最高
+    */
+    bool append(T *request, int lane = 0);
+    /**
+     * 向请求队列添加任意任务，如阻塞的文件操作、压缩、哈希等
+     * 任务的后续处理需要回到事件循环时，应通过completion_queue投递
     */
-    bool append(T *request);
+    bool submit(task t, int lane = 0);
+    /**
+     * 设置优先级通道的权重
+     * 出队时按权重在非空通道之间轮转，权重越大，每一轮能取出的任务越多
+    */
+    bool set_lane_weight(int lane, int weight);
+    /**
+     * 设置工作线程绑定的CPU，需在start()之前调用
+     * 第i个工作线程绑定到cpus[i % cpus.size()]，cpus为空时不绑定，继承创建者的亲和性
+    */
+    bool set_cpus(const std::vector<int> &cpus);
+    /**
+     * 设置线程池的名字，用于采样剖析结果中区分线程，需在start()之前调用
+    */
+    void set_name(const char *name);
+    /**
+     * 所有通道中等待执行的任务数
+    */
+    int queue_size();
+    /**
+     * 正在执行的任务数
+    */
+    int active();
+
+    /**
+     * 启动看门狗线程，需在start()之后调用
+     * 工作线程的一个任务执行超过stall_ms毫秒时，对该线程抓取一次调用栈并调用handler报告，每个任务只报告一次
+     * replace为true时，把卡住的线程标记为丢失并创建新线程顶替，丢失的线程完成当前任务后自行退出
+     * 顶替的线程最多为m_thread_number个，用完后只报告不顶替
+    */
+    bool start_watchdog(int stall_ms, bool replace, void (*handler)(const stall_info<T> &));
+    /**
+     * 设置当前工作线程正在处理的请求，看门狗报告时带上；append提交的任务会自动设置
+    */
+    static void set_current(T *request);
+    /**
+     * 看门狗发现的卡住的任务数和被顶替的线程数
+    */
+    long long stalls();
+    long long lost();
+    /**
+     * 被放弃、未被回收的线程数，包括看门狗顶替的线程和stop超时时仍在执行任务的线程
+     * 不为0时这些线程可能仍在使用任务引用的对象（如请求），调用者不应释放它们
+    */
+    long long abandoned();
+    /**
+     * 追加线程池的状态：队列长度、正在执行的任务数，以及每个工作线程空闲或已执行当前任务多久
+     * 可在任意线程调用
+    */
+    void describe(std::string &out);
+
+private:
+    /**
+     * 每个工作线程一个槽位，由工作线程写、看门狗读，按缓存行对齐
+     * state在任务开始和结束时切换，看门狗和stop只能放弃处于SLOT_BUSY的线程
+    */
+    struct alignas(64) worker_slot
+    {
+        threadpool *pool;
+        pthread_t thread;
+        int index;                          // 线程编号，顶替的线程沿用被顶替者的编号，用于绑定CPU
+        std::atomic<pid_t> tid;
+        std::atomic<long long> busy_since;  // 当前任务的开始时间(ms)，空闲时为0
+        std::atomic<T *> request;
+        std::atomic<int> state;             // SLOT_IDLE、SLOT_BUSY或SLOT_ABANDONED
+        long long reported;                 // 已报告过的任务的开始时间，只由看门狗访问
+    };
+
+    enum
+    {
+        SLOT_IDLE,      // 等待任务或正在访问线程池
+        SLOT_BUSY,      // 正在执行任务
+        SLOT_ABANDONED  // 已被放弃，完成当前任务后直接退出，不再访问线程池
+    };
 
 private:
     /**
      * 工作线程运行的函数，它不断从工作队列中取出任务并执行之
     */
     static void *word(void *arg);
-    void run();
+    void run(worker_slot *slot);
+    /**
+     * 在第slot个槽位上创建工作线程
+    */
+    bool spawn(int slot, int index);
+    static void *watchdog(void *arg);
+    void watch();
+    static long long now_ms();
+    /**
+     * 按权重从各个通道中选出下一个任务，调用前需持有m_queuelocker
+    */
+    bool next_task(task &t);
 
 private:
     int m_thread_number;        // 线程池中的线程数
     int m_max_requests;         // 请求队列中允许的最大请求数
-    pthread_t *m_threads;       // 描述线程池的数组，其大小为m_thread_number
-    std::list<T *> m_workqueue; // 请求队列
+    worker_slot *m_slots;       // 工作线程的槽位，前m_thread_number个为初始线程，其后留给顶替的线程
+    int m_lane_number;          // 优先级通道数
+    std::vector<std::deque<task> > m_workqueue; // 请求队列，每个优先级通道一个
+    std::vector<int> m_weights; // 每个通道的权重
+    std::vector<int> m_credits; // 每个通道在本轮中剩余可出队的任务数
+    int m_queue_size;           // 所有通道中的任务总数
+    int m_active;               // 正在执行的任务数
     locker m_queuelocker;       // 保护请求队列的互斥锁
     sem m_queuestat;            // 用信号量表示是否有任务需要处理
-    bool m_stop;                // 是否结束线程
+    int m_started;              // 已使用的槽位数，包括被顶替的线程
+    std::vector<int> m_cpus;    // 工作线程绑定的CPU列表
+    const char *m_name;         // 线程池的名字
+    std::atomic<bool> m_accepting; // 是否接受新任务，drain/stop后为false
+    std::atomic<bool> m_stop;   // 是否结束线程
+    pthread_t m_watchdog;       // 看门狗线程
+    bool m_watching;            // 看门狗线程是否已启动
+    int m_stall_ms;             // 任务执行超过该时间视为卡住
+    bool m_replace;             // 是否顶替卡住的线程
+    void (*m_stall_handler)(const stall_info<T> &);
+    locker m_watch_mutex;       // 与m_watch_cond配合，用于停止时唤醒看门狗
+    cond m_watch_cond;
+    std::atomic<long long> m_stalls;
+    std::atomic<long long> m_lost;
+    std::atomic<long long> m_abandoned;
+    static thread_local worker_slot *m_current; // 当前线程的槽位，非工作线程为NULL
 };
 
+template <typename T>
+thread_local typename threadpool<T>::worker_slot *threadpool<T>::m_current = NULL;
+
 /**
  * 构造函数
- * 首先检查输入数据合法性，然后给线程池的线程数组分配大小，最后创建线程池中的线程
+ * 检查输入数据合法性，然后给线程池的线程数组分配大小，线程在start()中创建
 */
 template <typename T>
-threadpool<T>::threadpool(int thread_number, int max_requests) : m_thread_number(thread_number),
-                                                                 m_max_requests(max_requests),
-                                                                 m_stop(false),
-                                                                 m_threads(NULL)
+threadpool<T>::threadpool(int thread_number, int max_requests, int lane_number) : m_thread_number(thread_number),
+                                                                                  m_max_requests(max_requests),
+                                                                                  m_slots(NULL),
+                                                                                  m_lane_number(lane_number),
+                                                                                  m_queue_size(0),
+                                                                                  m_active(0),
+                                                                                  m_started(0),
+                                                                                  m_name("worker"),
+                                                                                  m_accepting(true),
+                                                                                  m_stop(false),
+                                                                                  m_watching(false),
+                                                                                  m_stall_ms(0),
+                                                                                  m_replace(false),
+                                                                                  m_stall_handler(NULL),
+                                                                                  m_stalls(0),
+                                                                                  m_lost(0),
+                                                                                  m_abandoned(0)
 {
-    if ((thread_number <= 0) || (max_requests <= 0))
+    if ((thread_number <= 0) || (max_requests <= 0) || (lane_number <= 0))
     {
         throw std::exception();
     }
 
-    m_threads = new pthread_t[m_thread_number];
-    if (!m_threads)
+    // 每个通道默认权重为1，即在各通道间简单轮转
+    m_workqueue.resize(m_lane_number);
+    m_weights.assign(m_lane_number, 1);
+    m_credits.assign(m_lane_number, 1);
+
+    m_slots = new worker_slot[m_thread_number * 2];
+}
+
+/**
+ * 析构函数
+ * 停止并回收所有工作线程，再释放线程数组
+ * 被放弃的线程可能仍卡在任务中，完成后还会访问自己的槽位，有线程被放弃时槽位不释放
+*/
+template <typename T>
+threadpool<T>::~threadpool()
+{
+    stop();
+    if (m_abandoned.load() == 0)
     {
-        throw std::exception();
+        delete[] m_slots;
     }
+}
 
-    // 创建m_pthread_number个线程，并将其设置为脱离线程
-    // 设置为脱离线程的目的在于，在该状态下，线程主动与主控线程断开关系，线程结束后，不产生僵尸线程
-    for (int i = 0; i < thread_number; i++)
+/**
+ * 创建m_thread_number个可连接的工作线程
+ * 线程在stop()中被唤醒并回收，不会在进程退出时遗留在阻塞状态
+*/
+template <typename T>
+bool threadpool<T>::start()
+{
+    if (m_started > 0 || m_stop.load())
+    {
+        return false;
+    }
+    for (int i = 0; i < m_thread_number; i++)
     {
         printf("创建第 %d 个线程\n", i);
-        if (pthread_create(m_threads + i, NULL, word, this) != 0)
+        if (!spawn(i, i))
         {
-            delete[] m_threads;
-            throw std::exception();
+            stop();
+            return false;
         }
-        // 设置为脱离线程
-        if (pthread_detach(m_threads[i]) != 0)
+        m_started++;
+    }
+    return true;
+}
+
+template <typename T>
+bool threadpool<T>::spawn(int slot, int index)
+{
+    worker_slot &w = m_slots[slot];
+    w.pool = this;
+    w.index = index;
+    w.tid = 0;
+    w.busy_since = 0;
+    w.request = NULL;
+    w.state = SLOT_IDLE;
+    w.reported = 0;
+    return pthread_create(&w.thread, NULL, word, &w) == 0;
+}
+
+/**
+ * 优雅停止
+ * 先关闭入口，再以1ms为间隔检查队列和正在执行的任务是否清空，最后硬停止
+*/
+template <typename T>
+bool threadpool<T>::drain(int timeout_ms)
+{
+    m_accepting = false;
+
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    bool drained = false;
+    while (true)
+    {
+        m_queuelocker.lock();
+        drained = (m_queue_size == 0 && m_active == 0);
+        m_queuelocker.unlock();
+        if (drained || m_started == 0)
+        {
+            break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec >= deadline.tv_nsec))
         {
-            delete[] m_threads;
-            throw std::exception();
+            break;
         }
+        struct timespec interval = {0, 1000000};
+        nanosleep(&interval, NULL);
     }
+
+    stop(drained ? -1 : 0);
+    return drained;
 }
 
 /**
- * 析构函数
- * 释放线程池数组的内存，将结束标志置为true
+ * 硬停止
+ * 置位原子的结束标志，为每个工作线程各投递一次信号量，保证阻塞在m_queuestat上的线程全部被唤醒
+ * 队列清空后不会再有线程开始新任务，超时时只放弃仍处于SLOT_BUSY的线程，其余线程很快退出，直接等待
 */
 template <typename T>
-threadpool<T>::~threadpool()
+void threadpool<T>::stop(int timeout_ms)
 {
-    delete[] m_threads;
-    m_stop = true;
+    m_accepting = false;
+    if (m_stop.exchange(true))
+    {
+        return;
+    }
+
+    m_queuelocker.lock();
+    for (int i = 0; i < m_lane_number; i++)
+    {
+        m_workqueue[i].clear();
+    }
+    m_queue_size = 0;
+    m_queuelocker.unlock();
+
+    for (int i = 0; i < m_started; i++)
+    {
+        m_queuestat.post();
+    }
+
+    if (m_watching)
+    {
+        m_watch_mutex.lock();
+        m_watch_cond.signal();
+        m_watch_mutex.unlock();
+        pthread_join(m_watchdog, NULL);
+        m_watching = false;
+    }
+
+    struct timespec deadline;
+    if (timeout_ms >= 0)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout_ms / 1000;
+        deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+    for (int i = 0; i < m_started; i++)
+    {
+        worker_slot &w = m_slots[i];
+        if (w.state.load() == SLOT_ABANDONED)
+        {
+            // 已被看门狗分离
+            continue;
+        }
+        if (timeout_ms >= 0 && pthread_timedjoin_np(w.thread, NULL, &deadline) == 0)
+        {
+            continue;
+        }
+        int busy = SLOT_BUSY;
+        if (timeout_ms >= 0 && w.state.compare_exchange_strong(busy, SLOT_ABANDONED))
+        {
+            // 线程卡在任务中无法按时退出，分离后放弃等待
+            pthread_detach(w.thread);
+            m_abandoned++;
+            continue;
+        }
+        // 空闲或刚完成任务的线程不会再开始新任务，等待其退出
+        pthread_join(w.thread, NULL);
+    }
+    m_started = 0;
 }
 
 /**
  * 向工作队列中添加请求
+*/
+template <typename T>
+bool threadpool<T>::append(T *request, int lane)
+{
+    if (!request)
+    {
+        return false;
+    }
+    return submit([request] { set_current(request); request->process(); }, lane);
+}
+
+/**
+ * 向工作队列中添加任务
  * 如果工作队列已满，则添加失败
  * 添加成功后工作队列的信号量加一
 */
 template <typename T>
-bool threadpool<T>::append(T *request)
+bool threadpool<T>::submit(task t, int lane)
 {
+    if (lane < 0 || lane >= m_lane_number)
+    {
+        lane = m_lane_number - 1;
+    }
+
+    if (!m_accepting.load(std::memory_order_relaxed))
+    {
+        return false;
+    }
+
     // 操作工作队列前保证加锁，因为工作队列是被所有线程所共享的
+    // 在锁内再检查一次，保证stop()清空队列后不会再有任务入队
     m_queuelocker.lock();
-    if (m_workqueue.size() > m_max_requests)
+    if (!m_accepting.load(std::memory_order_relaxed) || m_queue_size >= m_max_requests)
     {
         m_queuelocker.unlock();
         return false;
     }
-    m_workqueue.push_back(request);
+    m_workqueue[lane].push_back(std::move(t));
+    m_queue_size++;
     m_queuelocker.unlock();
     m_queuestat.post(); // 信号量加一
     return true;
 }
 
+/**
+ * 设置通道权重
+ * 只影响之后的出队顺序，权重至少为1，保证低优先级通道不会被饿死
+*/
+template <typename T>
+bool threadpool<T>::set_lane_weight(int lane, int weight)
+{
+    if (lane < 0 || lane >= m_lane_number || weight <= 0)
+    {
+        return false;
+    }
+    m_queuelocker.lock();
+    m_weights[lane] = weight;
+    if (m_credits[lane] > weight)
+    {
+        m_credits[lane] = weight;
+    }
+    m_queuelocker.unlock();
+    return true;
+}
+
+template <typename T>
+bool threadpool<T>::set_cpus(const std::vector<int> &cpus)
+{
+    if (m_started > 0)
+    {
+        return false;
+    }
+    m_cpus = cpus;
+    return true;
+}
+
+template <typename T>
+void threadpool<T>::set_name(const char *name)
+{
+    m_name = name;
+}
+
+template <typename T>
+int threadpool<T>::queue_size()
+{
+    m_queuelocker.lock();
+    int size = m_queue_size;
+    m_queuelocker.unlock();
+    return size;
+}
+
+template <typename T>
+int threadpool<T>::active()
+{
+    m_queuelocker.lock();
+    int active = m_active;
+    m_queuelocker.unlock();
+    return active;
+}
+
+template <typename T>
+void threadpool<T>::set_current(T *request)
+{
+    if (m_current)
+    {
+        m_current->request.store(request, std::memory_order_relaxed);
+    }
+}
+
+template <typename T>
+long long threadpool<T>::stalls()
+{
+    return m_stalls.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+long long threadpool<T>::lost()
+{
+    return m_lost.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+long long threadpool<T>::abandoned()
+{
+    return m_abandoned.load(std::memory_order_relaxed);
+}
+
+template <typename T>
+void threadpool<T>::describe(std::string &out)
+{
+    char line[160];
+    m_queuelocker.lock();
+    int started = m_started;
+    int queued = m_queue_size;
+    int active = m_active;
+    m_queuelocker.unlock();
+    snprintf(line, sizeof(line), "pool %s: threads=%d queued=%d active=%d stalls=%lld replaced=%lld\n",
+             m_name, m_thread_number, queued, active, stalls(), lost());
+    out += line;
+
+    long long now = now_ms();
+    for (int i = 0; i < started; i++)
+    {
+        worker_slot &w = m_slots[i];
+        long long since = w.busy_since.load(std::memory_order_acquire);
+        int n = snprintf(line, sizeof(line), "  worker %d tid=%d %s", w.index, (int)w.tid.load(), since ? "busy" : "idle");
+        if (since)
+        {
+            n += snprintf(line + n, sizeof(line) - n, " %lldms", now - since);
+        }
+        snprintf(line + n, sizeof(line) - n, "%s\n", w.state.load() == SLOT_ABANDONED ? " lost" : "");
+        out += line;
+    }
+}
+
+template <typename T>
+long long threadpool<T>::now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+template <typename T>
+bool threadpool<T>::start_watchdog(int stall_ms, bool replace, void (*handler)(const stall_info<T> &))
+{
+    if (m_watching || m_started == 0 || stall_ms <= 0)
+    {
+        return false;
+    }
+    m_stall_ms = stall_ms;
+    m_replace = replace;
+    m_stall_handler = handler;
+    if (pthread_create(&m_watchdog, NULL, watchdog, this) != 0)
+    {
+        return false;
+    }
+    m_watching = true;
+    return true;
+}
+
+template <typename T>
+void *threadpool<T>::watchdog(void *arg)
+{
+    threadpool *pool = (threadpool *)arg;
+    pool->watch();
+    return pool;
+}
+
+/**
+ * 看门狗线程
+ * 每隔stall_ms/4检查一次各个工作线程当前任务的开始时间，超时的任务报告一次
+ * 报告前向卡住的线程发送信号抓取调用栈，不需要暂停整个进程
+*/
+template <typename T>
+void threadpool<T>::watch()
+{
+    int interval_ms = m_stall_ms / 4 > 0 ? m_stall_ms / 4 : 1;
+    void *frames[profiler::MAX_FRAMES];
+    while (!m_stop.load(std::memory_order_acquire))
+    {
+        m_watch_mutex.lock();
+        if (!m_stop.load(std::memory_order_acquire))
+        {
+            m_watch_cond.timewait(m_watch_mutex.get(), interval_ms);
+        }
+        m_watch_mutex.unlock();
+
+        long long now = now_ms();
+        m_queuelocker.lock();
+        int started = m_started;
+        m_queuelocker.unlock();
+        for (int i = 0; i < started && !m_stop.load(std::memory_order_acquire); i++)
+        {
+            worker_slot &w = m_slots[i];
+            long long since = w.busy_since.load(std::memory_order_acquire);
+            if (since == 0 || w.state.load() == SLOT_ABANDONED || w.reported == since || now - since < m_stall_ms)
+            {
+                continue;
+            }
+            w.reported = since;
+            m_stalls++;
+
+            stall_info<T> info;
+            info.pool = m_name;
+            info.worker = w.index;
+            info.tid = w.tid.load();
+            info.stalled_ms = now - since;
+            info.request = w.request.load(std::memory_order_relaxed);
+            info.replaced = false;
+            int depth = profiler::sample_thread(info.tid, frames, profiler::MAX_FRAMES, 100);
+            profiler::format_stack(frames, depth, info.stack);
+
+            // 在锁内检查并创建顶替的线程，与stop()互斥
+            // 线程仍在执行这个任务时才放弃它；放弃后它不再访问线程池，由这里代为减少m_active
+            m_queuelocker.lock();
+            int busy = SLOT_BUSY;
+            if (m_replace && m_started < m_thread_number * 2 && !m_stop.load() &&
+                w.busy_since.load() == since && w.state.compare_exchange_strong(busy, SLOT_ABANDONED))
+            {
+                pthread_detach(w.thread);
+                m_active--;
+                m_abandoned++;
+                if (spawn(m_started, w.index))
+                {
+                    m_started++;
+                    m_lost++;
+                    info.replaced = true;
+                }
+            }
+            m_queuelocker.unlock();
+
+            if (m_stall_handler)
+            {
+                m_stall_handler(info);
+            }
+        }
+    }
+}
+
+/**
+ * 加权公平出队
+ * 从高优先级通道开始，取第一个非空且本轮仍有额度的通道出队，额度减一
+ * 所有非空通道的额度都用完后，按权重重新发放额度，开始新的一轮
+ * 这样高优先级通道在拥塞时按权重获得更多的出队机会，而低优先级通道仍能持续前进
+*/
+template <typename T>
+bool threadpool<T>::next_task(task &t)
+{
+    if (m_queue_size == 0)
+    {
+        return false;
+    }
+    for (int round = 0; round < 2; round++)
+    {
+        for (int i = 0; i < m_lane_number; i++)
+        {
+            if (!m_workqueue[i].empty() && m_credits[i] > 0)
+            {
+                m_credits[i]--;
+                t = std::move(m_workqueue[i].front());
+                m_workqueue[i].pop_front();
+                m_queue_size--;
+                return true;
+            }
+        }
+        // 非空通道的额度都已耗尽，开始新的一轮
+        for (int i = 0; i < m_lane_number; i++)
+        {
+            m_credits[i] = m_weights[i];
+        }
+    }
+    return false;
+}
+
 /**
  * 线程的运行函数
- * 传入参数arg是this指针，指针指向了线程池本身
+ * 传入参数arg是该线程的槽位，槽位中保存了线程池的this指针
  * （因为这是一个静态函数，在静态函数中使用了动态成员，包括成员变量和成员函数）
 */
 template <typename T>
 void *threadpool<T>::word(void *arg)
 {
-    threadpool *pool = (threadpool *)arg;
-    pool->run();
-    return pool;
+    worker_slot *slot = (worker_slot *)arg;
+    slot->pool->run(slot);
+    return slot->pool;
 }
 
 /**
  * 工作线程处理的任务的函数
 */
 template <typename T>
-void threadpool<T>::run()
+void threadpool<T>::run(worker_slot *slot)
 {
+    m_current = slot;
+    slot->tid = (pid_t)syscall(SYS_gettid);
+    int index = slot->index;
+    if (!m_cpus.empty())
+    {
+        int cpu = m_cpus[index % m_cpus.size()];
+        if (!pin_current_thread(cpu))
+        {
+            printf("线程 %d 绑定CPU %d 失败\n", index, cpu);
+        }
+    }
+    profiler::register_thread(m_name);
     printf("线程开始处理任务\n");
-    while (!m_stop)
+    while (!m_stop.load(std::memory_order_acquire))
     {
         m_queuestat.wait(); // 处理了队列中的一件任务，信号量减一
+        if (m_stop.load(std::memory_order_acquire))
+        {
+            break;
+        }
+        task t;
         m_queuelocker.lock();
-        if (m_workqueue.empty())
+        bool got = next_task(t);
+        if (got)
         {
-            m_queuelocker.unlock();
-            continue;
+            m_active++;
+            slot->state.store(SLOT_BUSY);
         }
-        T *request = m_workqueue.front();
-        m_workqueue.pop_front();
         m_queuelocker.unlock();
-        if (!request)
+        if (!got)
         {
             continue;
         }
-        request->process();
+        slot->busy_since.store(now_ms(), std::memory_order_release);
+        t();
+        t.reset(); // 任务捕获的资源在计数减少之前释放，drain返回后不再有任务代码运行
+        int busy = SLOT_BUSY;
+        if (!slot->state.compare_exchange_strong(busy, SLOT_IDLE))
+        {
+            // 已被看门狗或stop放弃，线程池可能已经析构，只能访问自己的槽位
+            return;
+        }
+        slot->request.store(NULL, std::memory_order_relaxed);
+        slot->busy_since.store(0, std::memory_order_release);
+
+        m_queuelocker.lock();
+        m_active--;
+        m_queuelocker.unlock();
     }
 }
 
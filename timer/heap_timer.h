@@ -0,0 +1,158 @@
+#ifndef _HEAP_TIMER_H_
+#define _HEAP_TIMER_H_
+
+#include <vector>
+#include "lst_timer.h"
+
+// d叉最小堆，堆顶为最早超时的定时器，定时器的index记录它在数组中的下标
+// 加入、调整、删除都是O(log n)，tick每个到期的定时器O(log n)
+// D为4时树更矮，一次下沉比较的4个子节点位于同一缓存行，通常比二叉堆快
+template <int D>
+class heap_timer : public timer_container
+{
+public:
+    heap_timer() {}
+    ~heap_timer()
+    {
+        for( size_t i = 0; i < m_heap.size(); i++ )
+        {
+            delete m_heap[i];
+        }
+    }
+
+    void add_timer( util_timer* timer )
+    {
+        if( !timer )
+        {
+            return;
+        }
+        timer->index = (int)m_heap.size();
+        m_heap.push_back( timer );
+        sift_up( timer->index );
+        publish_size( 1 );
+        publish();
+    }
+
+    // expire可能变大也可能变小，两个方向都尝试
+    void adjust_timer( util_timer* timer )
+    {
+        if( !timer || timer->index < 0 )
+        {
+            return;
+        }
+        int i = timer->index;
+        sift_up( i );
+        if( timer->index == i )
+        {
+            sift_down( i );
+        }
+        publish();
+    }
+
+    void del_timer( util_timer* timer )
+    {
+        if( !timer || timer->index < 0 )
+        {
+            return;
+        }
+        remove( timer->index );
+        delete timer;
+        publish_size( -1 );
+        publish();
+    }
+
+    void tick( time_t cur )
+    {
+        while( !m_heap.empty() && m_heap[0]->expire <= cur )
+        {
+            util_timer* timer = m_heap[0];
+            remove( 0 );
+            publish_size( -1 );
+            timer->cb_func( timer->user_data );
+            delete timer;
+        }
+        publish();
+    }
+    using timer_container::tick;
+
+private:
+    void publish()
+    {
+        publish_expire( m_heap.empty() ? 0 : m_heap[0]->expire );
+    }
+
+    void place( int i, util_timer* timer )
+    {
+        m_heap[i] = timer;
+        timer->index = i;
+    }
+
+    void sift_up( int i )
+    {
+        util_timer* timer = m_heap[i];
+        while( i > 0 )
+        {
+            int parent = ( i - 1 ) / D;
+            if( m_heap[parent]->expire <= timer->expire )
+            {
+                break;
+            }
+            place( i, m_heap[parent] );
+            i = parent;
+        }
+        place( i, timer );
+    }
+
+    void sift_down( int i )
+    {
+        int n = (int)m_heap.size();
+        util_timer* timer = m_heap[i];
+        while( true )
+        {
+            int first = i * D + 1;
+            if( first >= n )
+            {
+                break;
+            }
+            int last = first + D < n ? first + D : n;
+            int smallest = first;
+            for( int c = first + 1; c < last; c++ )
+            {
+                if( m_heap[c]->expire < m_heap[smallest]->expire )
+                {
+                    smallest = c;
+                }
+            }
+            if( m_heap[smallest]->expire >= timer->expire )
+            {
+                break;
+            }
+            place( i, m_heap[smallest] );
+            i = smallest;
+        }
+        place( i, timer );
+    }
+
+    // 用最后一个定时器填补下标i，再恢复堆序
+    void remove( int i )
+    {
+        util_timer* timer = m_heap[i];
+        util_timer* last = m_heap.back();
+        m_heap.pop_back();
+        timer->index = -1;
+        if( last != timer )
+        {
+            place( i, last );
+            sift_up( i );
+            if( last->index == i )
+            {
+                sift_down( i );
+            }
+        }
+    }
+
+private:
+    std::vector<util_timer*> m_heap;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define _LST_TIMER_H_
 
 #include <time.h>
+#include <atomic>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include "../log/log.h"
@@ -30,7 +31,7 @@ struct client_data
 class util_timer
 {
 public:
-    util_timer() : prev( NULL ), next( NULL ){}
+    util_timer() : prev( NULL ), next( NULL ), index( -1 ){}
 
 public:
     // 超时时间
@@ -43,10 +44,61 @@ public:
     util_timer* prev;
     // 指向后一个定时器
     util_timer* next;
+    // 在堆中的下标或在时间轮中的槽位，由定时器容器维护
+    int index;
 };
 
-// 定时器链表
-class sort_timer_lst
+// 定时器容器接口：链表sort_timer_lst、d叉堆heap_timer、时间轮wheel_timer
+// 容器拥有加入的定时器，del_timer和tick到期后负责delete
+class timer_container
+{
+public:
+    timer_container() : m_size( 0 ), m_next_expire( 0 ) {}
+    virtual ~timer_container() {}
+
+    // 加入定时器
+    virtual void add_timer( util_timer* timer ) = 0;
+    // 定时器的expire改变后调整其位置
+    virtual void adjust_timer( util_timer* timer ) = 0;
+    // 取消并删除定时器
+    virtual void del_timer( util_timer* timer ) = 0;
+    // 执行并删除所有expire不晚于cur的定时器
+    virtual void tick( time_t cur ) = 0;
+    void tick()
+    {
+        tick( time( NULL ) );
+    }
+
+    // 以下两个函数可在其他线程中调用，返回容器最近一次修改后的状态
+    // 定时器个数
+    int size() const
+    {
+        return m_size.load( std::memory_order_relaxed );
+    }
+    // 最早的超时时间，容器为空时为0
+    time_t next_expire() const
+    {
+        return m_next_expire.load( std::memory_order_relaxed );
+    }
+
+protected:
+    void publish_size( int delta )
+    {
+        m_size.store( m_size.load( std::memory_order_relaxed ) + delta, std::memory_order_relaxed );
+    }
+    void publish_expire( time_t expire )
+    {
+        m_next_expire.store( expire, std::memory_order_relaxed );
+    }
+
+private:
+    // 只由操作容器的线程写，供管理接口等在其他线程中读取
+    std::atomic<int> m_size;
+    std::atomic<time_t> m_next_expire;
+};
+
+// 定时器链表，按超时时间升序排列：加入和调整为O(n)，删除为O(1)，tick只访问到期的定时器
+class sort_timer_lst : public timer_container
 {
 public:
     sort_timer_lst() : head( NULL ), tail( NULL ) {}
@@ -59,8 +111,11 @@ public:
             head = tmp->next;
             delete tmp;
             tmp = head;
+            publish_size( -1 );
         }
+        publish();
     }
+    using timer_container::tick;
 
     //添加定时器，内部调用私有成员add_timer
     void add_timer( util_timer* timer )
@@ -69,9 +124,11 @@ public:
         {
             return;
         }
+        publish_size( 1 );
         if( !head )
         {
             head = tail = timer;
+            publish();
             return; 
         }
         //如果新的定时器超时时间小于当前头部结点
@@ -81,6 +138,7 @@ public:
             timer->next = head;
             head->prev = timer;
             head = timer;
+            publish();
             return;
         }
         //否则调用私有成员，调整内部结点
@@ -99,6 +157,7 @@ public:
         //定时器超时值仍然小于下一个定时器超时值，不调整
         if( !tmp || ( timer->expire < tmp->expire ) )
         {
+            publish();
             return;
         }
 
@@ -109,6 +168,7 @@ public:
             head->prev = NULL;
             timer->next = NULL;
             add_timer( timer, head );
+            publish();
         }
         //被调整定时器在内部，将定时器取出，重新插入
         else
@@ -126,6 +186,7 @@ public:
         {
             return;
         }
+        publish_size( -1 );
 
         //链表中只有一个定时器，需要删除该定时器
         if( ( timer == head ) && ( timer == tail ) )
@@ -133,6 +194,7 @@ public:
             delete timer;
             head = NULL;
             tail = NULL;
+            publish();
             return;
         }
 
@@ -142,6 +204,7 @@ public:
             head = head->next;
             head->prev = NULL;
             delete timer;
+            publish();
             return;
         }
 
@@ -162,18 +225,15 @@ public:
 
     // SIGALRM信号每次被触发就在其信号处理函数（如果使用统一事件源，则是主函数）中执行一次tick函数
     // 以处理链表上到期的任务
-    void tick()
+    void tick( time_t cur )
     {
         if( !head )
         {
             return;
         }
         // printf( "timer tick\n" );
-        LOG_INFO("%s", "timer tick");
-        Log::get_instance()->flush();
+        LOG_DEBUG("%s", "timer tick");
 
-        //获取系统当前时间
-        time_t cur = time( NULL );
         util_timer* tmp = head;
 
         //遍历定时器链表
@@ -197,10 +257,18 @@ public:
             }
             delete tmp;
             tmp = head;
+            publish_size( -1 );
         }
+        publish();
     }
 
 private:
+    // 链表头部变化后更新m_next_expire
+    void publish()
+    {
+        publish_expire( head ? head->expire : 0 );
+    }
+
     //私有成员，被公有成员add_timer和adjust_time调用
     //主要用于调整链表内部结点
     void add_timer( util_timer* timer, util_timer* lst_head )
@@ -0,0 +1,183 @@
+#ifndef _WHEEL_TIMER_H_
+#define _WHEEL_TIMER_H_
+
+#include <vector>
+#include "lst_timer.h"
+
+// 时间轮：每秒一个槽，定时器按expire % 槽数放入对应槽的双向链表，index记录槽位
+// 加入、调整、删除都是O(1)；tick逐秒扫描经过的槽，只执行expire已到的定时器，超过一圈的留在原槽
+// 槽数应不小于常见的超时时长，这样大部分定时器在第一圈内到期，扫描时不必跳过未到期的定时器
+// next_expire在tick和加入更早的定时器时更新，删除或推迟最早的定时器后它可能早于实际值
+class wheel_timer : public timer_container
+{
+public:
+    explicit wheel_timer( int slots = 64, time_t now = time( NULL ) )
+        : m_slots( slots > 0 ? slots : 64, (util_timer*)NULL ), m_current( now ), m_count( 0 ) {}
+    ~wheel_timer()
+    {
+        for( size_t i = 0; i < m_slots.size(); i++ )
+        {
+            util_timer* tmp = m_slots[i];
+            while( tmp )
+            {
+                util_timer* next = tmp->next;
+                delete tmp;
+                tmp = next;
+            }
+        }
+    }
+
+    void add_timer( util_timer* timer )
+    {
+        if( !timer )
+        {
+            return;
+        }
+        link( timer );
+        m_count++;
+        publish_size( 1 );
+        time_t next = next_expire();
+        if( next == 0 || timer->expire < next )
+        {
+            publish_expire( timer->expire );
+        }
+    }
+
+    void adjust_timer( util_timer* timer )
+    {
+        if( !timer || timer->index < 0 )
+        {
+            return;
+        }
+        unlink( timer );
+        link( timer );
+        if( timer->expire < next_expire() )
+        {
+            publish_expire( timer->expire );
+        }
+    }
+
+    void del_timer( util_timer* timer )
+    {
+        if( !timer || timer->index < 0 )
+        {
+            return;
+        }
+        unlink( timer );
+        delete timer;
+        m_count--;
+        publish_size( -1 );
+        if( m_count == 0 )
+        {
+            publish_expire( 0 );
+        }
+    }
+
+    void tick( time_t cur )
+    {
+        // 从上次处理到的秒开始逐秒前进，相隔超过一圈时每个槽只需扫描一次
+        int slots = (int)m_slots.size();
+        time_t from = m_current;
+        time_t to = cur - from >= slots ? from + slots - 1 : cur;
+        for( time_t t = from; t <= to; t++ )
+        {
+            util_timer* tmp = m_slots[slot_of( t )];
+            while( tmp )
+            {
+                util_timer* next = tmp->next;
+                if( tmp->expire <= cur )
+                {
+                    unlink( tmp );
+                    m_count--;
+                    publish_size( -1 );
+                    tmp->cb_func( tmp->user_data );
+                    delete tmp;
+                }
+                tmp = next;
+            }
+        }
+        m_current = cur + 1 > m_current ? cur + 1 : m_current;
+        publish_expire( earliest() );
+    }
+    using timer_container::tick;
+
+private:
+    int slot_of( time_t t ) const
+    {
+        int slots = (int)m_slots.size();
+        int slot = (int)( t % slots );
+        return slot < 0 ? slot + slots : slot;
+    }
+
+    // 已经过去的时间放入下一个要处理的槽，保证下次tick时执行
+    void link( util_timer* timer )
+    {
+        int slot = slot_of( timer->expire < m_current ? m_current : timer->expire );
+        timer->index = slot;
+        timer->prev = NULL;
+        timer->next = m_slots[slot];
+        if( m_slots[slot] )
+        {
+            m_slots[slot]->prev = timer;
+        }
+        m_slots[slot] = timer;
+    }
+
+    void unlink( util_timer* timer )
+    {
+        if( timer->prev )
+        {
+            timer->prev->next = timer->next;
+        }
+        else
+        {
+            m_slots[timer->index] = timer->next;
+        }
+        if( timer->next )
+        {
+            timer->next->prev = timer->prev;
+        }
+        timer->prev = timer->next = NULL;
+        timer->index = -1;
+    }
+
+    // 最早的超时时间：先在一圈之内按槽的顺序找，找不到再遍历所有定时器
+    time_t earliest() const
+    {
+        if( m_count == 0 )
+        {
+            return 0;
+        }
+        int slots = (int)m_slots.size();
+        for( int d = 0; d < slots; d++ )
+        {
+            time_t t = m_current + d;
+            for( util_timer* tmp = m_slots[slot_of( t )]; tmp; tmp = tmp->next )
+            {
+                if( tmp->expire <= t )
+                {
+                    return tmp->expire;
+                }
+            }
+        }
+        time_t result = 0;
+        for( int i = 0; i < slots; i++ )
+        {
+            for( util_timer* tmp = m_slots[i]; tmp; tmp = tmp->next )
+            {
+                if( result == 0 || tmp->expire < result )
+                {
+                    result = tmp->expire;
+                }
+            }
+        }
+        return result;
+    }
+
+private:
+    std::vector<util_timer*> m_slots;
+    time_t m_current;   // 下一个要处理的秒
+    int m_count;
+};
+
+#endif
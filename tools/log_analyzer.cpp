@@ -0,0 +1,827 @@
+/*************************************************************
+*离线日志分析工具
+*读取服务器日志（如2021_07_10_ServerLog），按连接重建每个请求的处理过程，输出：
+*  每个时间段的请求数和应答数、各阶段耗时的直方图、状态码分布
+*文件用mmap映射，按记录边界切成多块由多个线程并行解析成紧凑的事件，再按时间顺序串行匹配
+*连接按"close fd N"中的描述符结束；带" fd N"的读写记录按描述符匹配，旧日志中没有描述符时按先后顺序匹配
+*有应答的请求计为完成，没有应答就被关闭的请求和找不到所属请求的记录分别单独统计
+*用法：./log_analyzer [-j 线程数] [-i 统计间隔秒数] 日志文件...
+**************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <algorithm>
+
+// 日志中与请求处理相关的记录
+enum EVENT_TYPE
+{
+    EVENT_DEAL = 0, // deal with the client(ip)[ fd N]：读到请求数据
+    EVENT_REQUEST,  // 请求行：METHOD URL HTTP/x.y
+    EVENT_RESPONSE, // request:HTTP/1.1 NNN ...：开始填写应答
+    EVENT_SEND,     // send data to the client(ip)[ fd N]：发送应答
+    EVENT_CLOSE     // close fd N：关闭连接
+};
+
+struct event
+{
+    long long time;  // us
+    unsigned int ip; // EVENT_DEAL/EVENT_SEND的客户端地址
+    int fd;          // 连接的描述符，记录中没有时为-1
+    short type;
+    short status;    // EVENT_RESPONSE的状态码，EVENT_REQUEST的方法下标
+};
+
+// 请求处理的各阶段
+enum STAGE
+{
+    STAGE_PARSE = 0, // 读到数据到解析出请求行
+    STAGE_RESPOND,   // 解析出请求行到开始填写应答
+    STAGE_SEND,      // 开始填写应答到发送或关闭连接
+    STAGE_TOTAL,     // 读到数据到请求结束
+    STAGE_NUMBER
+};
+
+static const char *stage_names[STAGE_NUMBER] = {"read -> request line", "request line -> response",
+                                                "response -> send/close", "total"};
+static const char *method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATCH"};
+static const int METHOD_NUMBER = sizeof(method_names) / sizeof(method_names[0]);
+
+// 以2为底的对数分桶，第i个桶为[2^(i-1), 2^i) us
+static const int HIST_BUCKETS = 40;
+
+struct chunk
+{
+    const char *begin;
+    const char *end;
+    std::vector<event> events;
+    long long records;
+};
+
+static bool earlier(const event &a, const event &b)
+{
+    return a.time < b.time;
+}
+
+// 记录以"YYYY-MM-DD HH:MM:SS.uuuuuu "开头
+static bool is_record_start(const char *p, const char *end)
+{
+    if (end - p < 27)
+    {
+        return false;
+    }
+    static const char pattern[] = "dddd-dd-dd dd:dd:dd.dddddd ";
+    for (int i = 0; i < 27; i++)
+    {
+        if (pattern[i] == 'd' ? (p[i] < '0' || p[i] > '9') : p[i] != pattern[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int digits(const char *p, int n)
+{
+    int v = 0;
+    for (int i = 0; i < n; i++)
+    {
+        v = v * 10 + (p[i] - '0');
+    }
+    return v;
+}
+
+// 公历日期到1970-01-01的天数
+static long long days_from_civil(int y, int m, int d)
+{
+    y -= m <= 2;
+    long long era = (y >= 0 ? y : y - 399) / 400;
+    long long yoe = y - era * 400;
+    long long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    long long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// 日志中的时间是本地时间，只用于计算间隔和分桶，不做时区换算
+static long long parse_time(const char *p)
+{
+    long long days = days_from_civil(digits(p, 4), digits(p + 5, 2), digits(p + 8, 2));
+    long long sec = days * 86400 + digits(p + 11, 2) * 3600 + digits(p + 14, 2) * 60 + digits(p + 17, 2);
+    return sec * 1000000 + digits(p + 20, 6);
+}
+
+static bool starts_with(const char *p, const char *end, const char *s, size_t len)
+{
+    return (size_t)(end - p) >= len && memcmp(p, s, len) == 0;
+}
+
+static unsigned int parse_ip(const char *p, const char *end)
+{
+    char buf[INET_ADDRSTRLEN] = {0};
+    int n = 0;
+    while (p < end && *p != ')' && n < INET_ADDRSTRLEN - 1)
+    {
+        buf[n++] = *p++;
+    }
+    struct in_addr addr;
+    return inet_pton(AF_INET, buf, &addr) == 1 ? addr.s_addr : 0;
+}
+
+// 解析p开始的非负整数，没有数字时返回-1
+static int parse_fd(const char *p, const char *end)
+{
+    if (p >= end || *p < '0' || *p > '9')
+    {
+        return -1;
+    }
+    int fd = 0;
+    while (p < end && *p >= '0' && *p <= '9')
+    {
+        fd = fd * 10 + (*p++ - '0');
+    }
+    return fd;
+}
+
+// "(ip) fd N"中的描述符，旧的日志中没有
+static int parse_client_fd(const char *p, const char *end)
+{
+    const char *paren = (const char *)memchr(p, ')', end - p);
+    if (!paren || !starts_with(paren, end, ") fd ", 5))
+    {
+        return -1;
+    }
+    return parse_fd(paren + 5, end);
+}
+
+// 解析一条记录，text为"[level]: "之后的内容，line_end为第一行的结尾，record_end为整条记录的结尾
+static void parse_record(long long time, const char *text, const char *line_end, const char *record_end,
+                         std::vector<event> &events)
+{
+    event ev;
+    ev.time = time;
+    ev.ip = 0;
+    ev.fd = -1;
+    ev.status = 0;
+
+    if (starts_with(text, line_end, "deal with the client(", 21))
+    {
+        ev.type = EVENT_DEAL;
+        ev.ip = parse_ip(text + 21, line_end);
+        ev.fd = parse_client_fd(text + 21, line_end);
+    }
+    else if (starts_with(text, line_end, "send data to the client(", 24))
+    {
+        ev.type = EVENT_SEND;
+        ev.ip = parse_ip(text + 24, line_end);
+        ev.fd = parse_client_fd(text + 24, line_end);
+    }
+    else if (starts_with(text, line_end, "close fd ", 9))
+    {
+        ev.type = EVENT_CLOSE;
+        ev.fd = parse_fd(text + 9, line_end);
+    }
+    else if (starts_with(text, line_end, "request:HTTP/1.", 15))
+    {
+        //应答每追加一段都会把整个写缓冲区记一次，只有仅含状态行的那条标志着一个新的应答
+        const char *crlf = (const char *)memchr(text, '\n', record_end - text);
+        if (!crlf || text + 19 > line_end)
+        {
+            return;
+        }
+        const char *rest = crlf + 1;
+        while (rest < record_end && (*rest == '\n' || *rest == '\r'))
+        {
+            rest++;
+        }
+        if (rest != record_end)
+        {
+            return;
+        }
+        ev.type = EVENT_RESPONSE;
+        ev.status = (short)digits(text + 17, 3);
+    }
+    else
+    {
+        int method = -1;
+        for (int i = 0; i < METHOD_NUMBER; i++)
+        {
+            size_t len = strlen(method_names[i]);
+            if (starts_with(text, line_end, method_names[i], len) && text + len < line_end && text[len] == ' ')
+            {
+                method = i;
+                break;
+            }
+        }
+        if (method < 0 || !memmem(text, line_end - text, " HTTP/", 6))
+        {
+            return;
+        }
+        ev.type = EVENT_REQUEST;
+        ev.status = (short)method;
+    }
+    events.push_back(ev);
+}
+
+static void *parse_chunk(void *arg)
+{
+    chunk *c = (chunk *)arg;
+    const char *p = c->begin;
+    const char *end = c->end;
+    c->records = 0;
+    while (p < end)
+    {
+        //找到下一条记录的开头，中间的都是上一条记录的后续行
+        const char *record_end = p;
+        const char *line_end = (const char *)memchr(p, '\n', end - p);
+        line_end = line_end ? line_end : end;
+        record_end = line_end;
+        while (record_end < end)
+        {
+            const char *next = record_end + 1;
+            if (next >= end || is_record_start(next, end))
+            {
+                record_end = next < end ? next : end;
+                break;
+            }
+            const char *nl = (const char *)memchr(next, '\n', end - next);
+            record_end = nl ? nl : end;
+        }
+
+        if (is_record_start(p, end))
+        {
+            c->records++;
+            const char *text = (const char *)memchr(p + 27, ' ', line_end - (p + 27));
+            if (text && p[27] == '[')
+            {
+                parse_record(parse_time(p), text + 1, line_end, record_end, c->events);
+            }
+        }
+        p = record_end;
+    }
+    return NULL;
+}
+
+struct request
+{
+    unsigned int ip;
+    int fd;
+    long long deal;
+    long long parsed;
+    long long responded;
+    int status;
+};
+
+struct report
+{
+    long long interval;                         // us
+    std::map<long long, std::pair<long long, long long> > rate; // 时间段 -> (请求数, 应答数)
+    std::map<int, long long> status;
+    long long methods[METHOD_NUMBER];
+    long long hist[STAGE_NUMBER][HIST_BUCKETS];
+    long long completed;        // 有应答并已发送或关闭的请求
+    long long unanswered;       // 没有应答就被关闭的请求
+    long long incomplete;       // 日志结束时仍未结束的请求
+    long long idle_closes;      // 关闭时该连接上没有未结束的请求
+    long long orphan_requests;  // 找不到所属请求的请求行
+    long long orphan_responses; // 找不到所属请求的应答
+    long long first;
+    long long last;
+};
+
+static void add_sample(report &r, int stage, long long us)
+{
+    if (us < 0)
+    {
+        return;
+    }
+    int b = 0;
+    while (b < HIST_BUCKETS - 1 && us >= (1LL << b))
+    {
+        b++;
+    }
+    r.hist[stage][b]++;
+}
+
+// 只有得到应答的请求计入完成数和各阶段的耗时，与状态码的统计一致
+static void finish(report &r, const request &req, long long end)
+{
+    if (!req.responded)
+    {
+        r.unanswered++;
+        return;
+    }
+    r.completed++;
+    if (req.parsed)
+    {
+        add_sample(r, STAGE_PARSE, req.parsed - req.deal);
+    }
+    if (req.parsed && req.responded)
+    {
+        add_sample(r, STAGE_RESPOND, req.responded - req.parsed);
+    }
+    if (req.responded)
+    {
+        add_sample(r, STAGE_SEND, end - req.responded);
+    }
+    add_sample(r, STAGE_TOTAL, end - req.deal);
+}
+
+typedef std::deque<long long> id_queue;
+
+// 按时间顺序匹配事件，同一时刻可能有多个请求在处理
+// 请求按读到数据的先后编号，未结束的请求按描述符、客户端地址和所处阶段建立索引，每个事件不需要遍历所有未结束的请求
+// 读写和关闭按描述符找到所属的请求；请求行和应答中没有描述符，按阶段分配给最早的请求
+// 先进先出的队列中结束的请求不立即删除，到达队首或队列过长时再去掉
+class matcher
+{
+public:
+    explicit matcher(report &r) : m_report(r), m_next(0) {}
+
+    void deal(const event &ev)
+    {
+        long long id = m_next++;
+        request req = {ev.ip, ev.fd, ev.time, 0, 0, 0};
+        m_live[id] = req;
+        m_order.push_back(id);
+        m_unparsed.push_back(id);
+        m_unresponded.push_back(id);
+        if (ev.fd >= 0)
+        {
+            m_by_fd[ev.fd].push_back(id);
+        }
+        else
+        {
+            m_nofd.push_back(id);
+        }
+        //超出的视为丢失了关闭记录
+        while (m_live.size() > MAX_PENDING)
+        {
+            pop_dead(m_order);
+            remove(m_order.front());
+            m_order.pop_front();
+            m_report.incomplete++;
+        }
+        compact();
+    }
+
+    //读到数据后可能因对方关闭而没有请求行，请求行分配给最近一个未解析的请求，
+    //避免被这类请求错位到更早的连接上
+    void request_line(const event &ev)
+    {
+        while (!m_unparsed.empty() && (!alive(m_unparsed.back()) || m_live[m_unparsed.back()].parsed))
+        {
+            m_unparsed.pop_back();
+        }
+        if (m_unparsed.empty())
+        {
+            m_report.orphan_requests++;
+            return;
+        }
+        long long id = m_unparsed.back();
+        m_unparsed.pop_back();
+        m_live[id].parsed = ev.time;
+        m_awaiting.insert(id);
+    }
+
+    //应答分配给最早一个已解析出请求行的请求，请求行无法识别时退回到最早的未应答请求
+    void response(const event &ev)
+    {
+        long long id;
+        if (!m_awaiting.empty())
+        {
+            id = *m_awaiting.begin();
+        }
+        else
+        {
+            while (!m_unresponded.empty() &&
+                   (!alive(m_unresponded.front()) || m_live[m_unresponded.front()].responded))
+            {
+                m_unresponded.pop_front();
+            }
+            if (m_unresponded.empty())
+            {
+                m_report.orphan_responses++;
+                return;
+            }
+            id = m_unresponded.front();
+        }
+        request &req = m_live[id];
+        m_awaiting.erase(id);
+        req.responded = ev.time;
+        req.status = ev.status;
+        if (req.fd < 0)
+        {
+            m_responded_nofd.insert(id);
+            m_responded_by_ip[req.ip].insert(id);
+        }
+    }
+
+    void send(const event &ev)
+    {
+        if (ev.fd >= 0)
+        {
+            std::unordered_map<int, id_queue>::iterator it = m_by_fd.find(ev.fd);
+            if (it == m_by_fd.end())
+            {
+                return;
+            }
+            pop_dead(it->second);
+            //同一连接上的请求很少，直接遍历
+            for (size_t k = 0; k < it->second.size(); k++)
+            {
+                long long id = it->second[k];
+                if (alive(id) && m_live[id].responded && m_live[id].ip == ev.ip)
+                {
+                    finish(id, ev.time);
+                    break;
+                }
+            }
+            return;
+        }
+        std::unordered_map<unsigned int, std::set<long long> >::iterator it = m_responded_by_ip.find(ev.ip);
+        if (it != m_responded_by_ip.end() && !it->second.empty())
+        {
+            finish(*it->second.begin(), ev.time);
+        }
+    }
+
+    //关闭时该描述符上所有未结束的请求随连接一起结束；没有描述符的日志中结束最早一个已经应答的请求，
+    //都没有应答时结束最早的请求；找不到所属的请求时视为空闲连接超时或对方关闭
+    void close(const event &ev)
+    {
+        if (ev.fd >= 0)
+        {
+            std::unordered_map<int, id_queue>::iterator it = m_by_fd.find(ev.fd);
+            if (it != m_by_fd.end())
+            {
+                id_queue ids;
+                ids.swap(it->second);
+                m_by_fd.erase(it);
+                bool found = false;
+                for (size_t k = 0; k < ids.size(); k++)
+                {
+                    if (alive(ids[k]))
+                    {
+                        finish(ids[k], ev.time);
+                        found = true;
+                    }
+                }
+                if (found)
+                {
+                    return;
+                }
+            }
+        }
+        if (!m_responded_nofd.empty())
+        {
+            finish(*m_responded_nofd.begin(), ev.time);
+            return;
+        }
+        pop_dead(m_nofd);
+        if (m_nofd.empty())
+        {
+            m_report.idle_closes++;
+            return;
+        }
+        finish(m_nofd.front(), ev.time);
+    }
+
+    size_t live() const
+    {
+        return m_live.size();
+    }
+
+private:
+    static const size_t MAX_PENDING = 65536; // 与服务器的MAX_FD一致
+
+    bool alive(long long id) const
+    {
+        return m_live.find(id) != m_live.end();
+    }
+
+    void pop_dead(id_queue &q)
+    {
+        while (!q.empty() && !alive(q.front()))
+        {
+            q.pop_front();
+        }
+    }
+
+    //队列中结束的请求超过未结束请求数的两倍时整体清理一次，均摊为O(1)
+    template <typename Queue>
+    void compact(Queue &q)
+    {
+        if (q.size() <= 2 * m_live.size() + 1024)
+        {
+            return;
+        }
+        Queue kept;
+        for (size_t k = 0; k < q.size(); k++)
+        {
+            if (alive(q[k]))
+            {
+                kept.push_back(q[k]);
+            }
+        }
+        q.swap(kept);
+    }
+
+    void compact()
+    {
+        compact(m_order);
+        compact(m_unparsed);
+        compact(m_unresponded);
+        compact(m_nofd);
+    }
+
+    //从所有有序索引中删除，先进先出的队列留到之后清理
+    void remove(long long id)
+    {
+        std::unordered_map<long long, request>::iterator it = m_live.find(id);
+        const request &req = it->second;
+        m_awaiting.erase(id);
+        if (req.fd < 0 && req.responded)
+        {
+            m_responded_nofd.erase(id);
+            std::unordered_map<unsigned int, std::set<long long> >::iterator ip = m_responded_by_ip.find(req.ip);
+            ip->second.erase(id);
+            if (ip->second.empty())
+            {
+                m_responded_by_ip.erase(ip);
+            }
+        }
+        m_live.erase(it);
+    }
+
+    void finish(long long id, long long end)
+    {
+        ::finish(m_report, m_live[id], end);
+        remove(id);
+    }
+
+private:
+    report &m_report;
+    long long m_next;                                  // 下一个请求的编号
+    std::unordered_map<long long, request> m_live;     // 未结束的请求
+    id_queue m_order;                                  // 按编号排列的请求，超出MAX_PENDING时从最早的开始丢弃
+    std::vector<long long> m_unparsed;                 // 未解析出请求行的请求，最近的在末尾
+    id_queue m_unresponded;                            // 未应答的请求
+    std::set<long long> m_awaiting;                    // 已解析出请求行、未应答的请求
+    std::unordered_map<int, id_queue> m_by_fd;         // 每个描述符上的请求
+    id_queue m_nofd;                                   // 日志中没有描述符的请求
+    std::set<long long> m_responded_nofd;              // 已应答、没有描述符的请求
+    std::unordered_map<unsigned int, std::set<long long> > m_responded_by_ip; // 同上，按客户端地址
+};
+
+static void reconstruct(const std::vector<event> &events, report &r)
+{
+    matcher m(r);
+    r.first = -1;
+    for (size_t j = 0; j < events.size(); j++)
+    {
+        const event &ev = events[j];
+        if (r.first < 0)
+        {
+            r.first = ev.time;
+        }
+        r.last = ev.time;
+        long long bucket = ev.time / r.interval;
+
+        switch (ev.type)
+        {
+        case EVENT_DEAL:
+            r.rate[bucket].first++;
+            m.deal(ev);
+            break;
+        case EVENT_REQUEST:
+            r.methods[ev.status]++;
+            m.request_line(ev);
+            break;
+        case EVENT_RESPONSE:
+            r.status[ev.status]++;
+            r.rate[bucket].second++;
+            m.response(ev);
+            break;
+        case EVENT_SEND:
+            m.send(ev);
+            break;
+        case EVENT_CLOSE:
+            m.close(ev);
+            break;
+        }
+    }
+    r.incomplete += m.live();
+}
+
+static void print_histogram(const report &r, int stage)
+{
+    long long total = 0;
+    long long max = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++)
+    {
+        total += r.hist[stage][b];
+        max = r.hist[stage][b] > max ? r.hist[stage][b] : max;
+    }
+    printf("\n%s (%lld samples)\n", stage_names[stage], total);
+    if (total == 0)
+    {
+        return;
+    }
+    long long seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++)
+    {
+        if (!r.hist[stage][b])
+        {
+            continue;
+        }
+        seen += r.hist[stage][b];
+        long long lo = b ? (1LL << (b - 1)) : 0;
+        long long hi = 1LL << b;
+        char bar[41];
+        int width = (int)(r.hist[stage][b] * 40 / max);
+        memset(bar, '#', width);
+        bar[width] = '\0';
+        printf("  [%8lld, %8lld) us %10lld %6.2f%% %-40s\n", lo, hi, r.hist[stage][b], 100.0 * seen / total, bar);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-j threads] [-i interval_seconds] log_file...\n", name);
+    exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    double interval = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:i:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'j':
+            threads = atoi(optarg);
+            break;
+        case 'i':
+            interval = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc || threads <= 0 || interval <= 0)
+    {
+        usage(argv[0]);
+    }
+
+    report r;
+    memset(r.methods, 0, sizeof(r.methods));
+    memset(r.hist, 0, sizeof(r.hist));
+    r.interval = (long long)(interval * 1000000);
+    r.completed = r.unanswered = r.incomplete = r.idle_closes = 0;
+    r.orphan_requests = r.orphan_responses = 0;
+    r.first = r.last = 0;
+
+    long long records = 0;
+    long long bytes = 0;
+    std::vector<event> events;
+    std::vector<std::pair<char *, size_t> > maps;
+    for (int f = optind; f < argc; f++)
+    {
+        int fd = open(argv[f], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0)
+        {
+            perror(argv[f]);
+            return 1;
+        }
+        if (st.st_size == 0)
+        {
+            close(fd);
+            continue;
+        }
+        char *data = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            perror(argv[f]);
+            return 1;
+        }
+        madvise(data, st.st_size, MADV_SEQUENTIAL);
+        maps.push_back(std::make_pair(data, (size_t)st.st_size));
+        bytes += st.st_size;
+
+        //按记录边界切块，每块交给一个线程
+        const char *end = data + st.st_size;
+        size_t step = st.st_size / threads + 1;
+        const char *p = data;
+        std::vector<chunk> chunks;
+        while (p < end)
+        {
+            const char *q = p + step < end ? p + step : end;
+            while (q < end)
+            {
+                const char *nl = (const char *)memchr(q, '\n', end - q);
+                if (!nl)
+                {
+                    q = end;
+                    break;
+                }
+                q = nl + 1;
+                if (is_record_start(q, end))
+                {
+                    break;
+                }
+            }
+            chunk c;
+            c.begin = p;
+            c.end = q;
+            chunks.push_back(c);
+            p = q;
+        }
+
+        std::vector<pthread_t> tids(chunks.size());
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            pthread_create(&tids[i], NULL, parse_chunk, &chunks[i]);
+        }
+        for (size_t i = 0; i < chunks.size(); i++)
+        {
+            pthread_join(tids[i], NULL);
+            records += chunks[i].records;
+            events.insert(events.end(), chunks[i].events.begin(), chunks[i].events.end());
+        }
+    }
+
+    //日志由多个线程写入，相邻记录的时间戳可能略有倒序，合并后按时间排序
+    std::stable_sort(events.begin(), events.end(), earlier);
+    reconstruct(events, r);
+
+    printf("%lld bytes, %lld log records, %lld requests completed, %lld incomplete\n",
+           bytes, records, r.completed, r.incomplete);
+    printf("unmatched: %lld closed without response, %lld idle closes, %lld request lines, %lld responses\n",
+           r.unanswered, r.idle_closes, r.orphan_requests, r.orphan_responses);
+    double span = (r.last - r.first) / 1e6;
+    if (span > 0)
+    {
+        printf("time span %.3f s, %.1f requests/s\n", span, (r.completed + r.unanswered + r.incomplete) / span);
+    }
+
+    printf("\nthroughput per %.3g s\n  %-26s %10s %10s\n", interval, "time", "requests", "responses");
+    for (std::map<long long, std::pair<long long, long long> >::iterator it = r.rate.begin(); it != r.rate.end(); ++it)
+    {
+        long long us = it->first * r.interval;
+        long long sec = us / 1000000;
+        long long days = sec / 86400;
+        //days_from_civil的逆运算只用于显示
+        long long z = days + 719468;
+        long long era = (z >= 0 ? z : z - 146096) / 146097;
+        long long doe = z - era * 146097;
+        long long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        long long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        long long mp = (5 * doy + 2) / 153;
+        int d = (int)(doy - (153 * mp + 2) / 5 + 1);
+        int m = (int)(mp < 10 ? mp + 3 : mp - 9);
+        long long y = yoe + era * 400 + (m <= 2);
+        printf("  %04lld-%02d-%02d %02lld:%02lld:%02lld.%06lld %10lld %10lld\n", y, m, d,
+               (sec % 86400) / 3600, (sec % 3600) / 60, sec % 60, us % 1000000,
+               it->second.first, it->second.second);
+    }
+
+    printf("\nstatus codes\n");
+    for (std::map<int, long long>::iterator it = r.status.begin(); it != r.status.end(); ++it)
+    {
+        printf("  %d %10lld\n", it->first, it->second);
+    }
+    printf("\nmethods\n");
+    for (int i = 0; i < METHOD_NUMBER; i++)
+    {
+        if (r.methods[i])
+        {
+            printf("  %-8s %10lld\n", method_names[i], r.methods[i]);
+        }
+    }
+
+    for (int s = 0; s < STAGE_NUMBER; s++)
+    {
+        print_histogram(r, s);
+    }
+
+    for (size_t i = 0; i < maps.size(); i++)
+    {
+        munmap(maps[i].first, maps[i].second);
+    }
+    return 0;
+}